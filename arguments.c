@@ -1,12 +1,15 @@
 #include "./arguments.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <argp.h>
 #include <wordexp.h>
+#include <errno.h>
 
 #include "./diagnostics.h"
+#include "./scrollback.h"
 
 const char *argp_program_version = "min-terminal";
 const char *argp_program_bug_address = "<emma.bastas@protonmail.com>";
@@ -21,6 +24,45 @@ static const struct argp_option ARGP_OPTIONS[] = {
       .doc = "Specify a command for the terminal to execute",
       .group = 0,
     },
+    { .name = "record",
+      .key = 'r',
+      .arg = "FILE",
+      .flags = 0,
+      .doc = "Record everything the program outputs to FILE, for replaying "
+             "later with build/replay/replay",
+      .group = 0,
+    },
+    { .name = "scrollback",
+      .key = 's',
+      .arg = "ROWS",
+      .flags = 0,
+      .doc = "The maximum number of rows kept in the scrollback buffer",
+      .group = 0,
+    },
+    { .name = "scrollback-memory",
+      .key = 'm',
+      .arg = "MiB",
+      .flags = 0,
+      .doc = "The maximum amount of memory the scrollback buffer uses",
+      .group = 0,
+    },
+    { .name = "scrollback-spill",
+      .key = 'S',
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Compress rows that don't fit in memory and keep them in a "
+             "temporary file instead of dropping them, then only --scrollback "
+             "limits the history",
+      .group = 0,
+    },
+    { .name = "grid",
+      .key = 'G',
+      .arg = NULL,
+      .flags = 0,
+      .doc = "Draw the terminal as one quad that looks up every cell in a "
+             "texture, instead of drawing every cell on its own",
+      .group = 0,
+    },
     { 0 },
 };
 
@@ -28,6 +70,11 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state);
 
 struct arguments_internal {
     wordexp_t execute;
+    char *record;
+    size_t scrollback_rows;
+    size_t scrollback_bytes;
+    bool scrollback_spill;
+    bool grid_renderer;
 };
 
 static struct argp argp = {
@@ -44,6 +91,11 @@ void arguments_parse(int argc, char **argv, struct arguments *args_ret) {
             .we_wordc = 0,  // These two will be overwritten while parsing cli
             .we_wordv = 0,  // arguments.
         },
+        .record = NULL,
+        .scrollback_rows = SCROLLBACK_DEFAULT_MAX_ROWS,
+        .scrollback_bytes = SCROLLBACK_DEFAULT_MAX_BYTES,
+        .scrollback_spill = false,
+        .grid_renderer = false,
     };
 
     argp_parse(&argp, argc, argv, 0, 0, &iargs);
@@ -76,10 +128,26 @@ void arguments_parse(int argc, char **argv, struct arguments *args_ret) {
 
     args_ret->program_name = args_ret->argv[0];
     args_ret->program_path = args_ret->argv[0];
+    args_ret->record_path = iargs.record;
+    args_ret->scrollback_rows = iargs.scrollback_rows;
+    args_ret->scrollback_bytes = iargs.scrollback_bytes;
+    args_ret->scrollback_spill = iargs.scrollback_spill;
+    args_ret->grid_renderer = iargs.grid_renderer;
 
     return;
 }
 
+// Parse the argument of an option that takes a positive number.
+static size_t parse_positive(struct argp_state *state, const char *arg) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (errno != 0 || end == arg || *end != '\0' || n == 0) {
+        argp_error(state, "`%s` isn't a positive number", arg);
+    }
+    return n;
+}
+
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     struct arguments_internal *iargs = state->input;
 
@@ -102,6 +170,26 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
             assert(false);
         }
 
+        return 0;
+    case 'r':
+        iargs->record = arg;
+        return 0;
+    case 's':
+        iargs->scrollback_rows = parse_positive(state, arg);
+        return 0;
+    case 'm': {
+        size_t megabytes = parse_positive(state, arg);
+        if (megabytes > SIZE_MAX / (1024 * 1024)) {
+            argp_error(state, "`%s` megabytes is too large", arg);
+        }
+        iargs->scrollback_bytes = megabytes * 1024 * 1024;
+        return 0;
+    }
+    case 'S':
+        iargs->scrollback_spill = true;
+        return 0;
+    case 'G':
+        iargs->grid_renderer = true;
         return 0;
     case ARGP_KEY_ARGS:     // Don't really know what this is.
         assert(false);
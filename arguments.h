@@ -14,10 +14,19 @@
   to parse the value of the --execute="..." option.
  */
 
+#include <stdlib.h>
+#include <stdbool.h>
+
 struct arguments {
     char **argv;         // Argument array passed as-is to `execv*` functions.
     char *program_path;  // Path to the program to run as the shell process.
     char *program_name;  // Name of the program.
+    char *record_path;   // Where to record the session, or NULL. See
+                         // recording.h.
+    size_t scrollback_rows;   // Limits for the scrollback buffer, see
+    size_t scrollback_bytes;  // scrollback.h.
+    bool scrollback_spill;    // Spill old rows to disk, see scrollback.h.
+    bool grid_renderer;       // See rendering.h.
 };
 
 void arguments_parse(int argc, char **argv, struct arguments *args_ret);
@@ -0,0 +1,271 @@
+#include "./compress.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "./CuTest.h"
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+// The last few bytes are always literals, so that looking for a match never
+// reads past the end of the input.
+#define LAST_LITERALS 5
+#define HASH_BITS 12
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+static uint32_t hash(uint32_t x) {
+    return (x * 2654435761u) >> (32 - HASH_BITS);
+}
+
+size_t compress_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+static uint8_t *write_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+static uint8_t *write_sequence(uint8_t *op,
+                               const uint8_t *literals,
+                               size_t literal_len,
+                               size_t offset,
+                               size_t match_len) {
+    uint8_t *token = op++;
+    *token = (literal_len < 15 ? literal_len : 15) << 4;
+    if (literal_len >= 15) {
+        op = write_length(op, literal_len - 15);
+    }
+
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    // The last sequence.
+    if (match_len == 0) {
+        return op;
+    }
+
+    *op++ = offset & 0xFF;
+    *op++ = offset >> 8;
+
+    match_len -= MIN_MATCH;
+    *token |= match_len < 15 ? match_len : 15;
+    if (match_len >= 15) {
+        op = write_length(op, match_len - 15);
+    }
+    return op;
+}
+
+size_t compress(const uint8_t *src, size_t len, uint8_t *dst) {
+    // Where we last saw each hash of 4 bytes, plus one so that 0 means never.
+    uint32_t table[1 << HASH_BITS] = { 0 };
+
+    uint8_t *op = dst;
+    size_t anchor = 0;  // Start of the literals not yet written.
+    size_t ip = 0;
+
+    while (len >= LAST_LITERALS + MIN_MATCH
+           && ip <= len - LAST_LITERALS - MIN_MATCH) {
+        uint32_t x = read32(src + ip);
+        uint32_t h = hash(x);
+        size_t ref = table[h];
+        table[h] = ip + 1;
+
+        if (ref == 0 || ip - (ref - 1) > MAX_OFFSET
+            || read32(src + ref - 1) != x) {
+            ip ++;
+            continue;
+        }
+        ref --;
+
+        size_t match_len = MIN_MATCH;
+        while (ip + match_len < len - LAST_LITERALS
+               && src[ref + match_len] == src[ip + match_len]) {
+            match_len ++;
+        }
+
+        op = write_sequence(op,
+                            src + anchor,
+                            ip - anchor,
+                            ip - ref,
+                            match_len);
+        ip += match_len;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, src + anchor, len - anchor, 0, 0);
+    return op - dst;
+}
+
+// Returns false if we ran out of input.
+static bool read_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+size_t decompress(const uint8_t *src,
+                  size_t len,
+                  uint8_t *dst,
+                  size_t capacity) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + len;
+    size_t op = 0;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !read_length(&ip, end, &literal_len)) {
+            return -1;
+        }
+        if (literal_len > (size_t) (end - ip) || literal_len > capacity - op) {
+            return -1;
+        }
+        memcpy(dst + op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        // The last sequence has no match.
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_length(&ip, end, &match_len)) {
+            return -1;
+        }
+        match_len += MIN_MATCH;
+
+        if (offset == 0 || offset > op || match_len > capacity - op) {
+            return -1;
+        }
+
+        // The match can overlap with what it produces, so byte by byte.
+        for (size_t i = 0; i < match_len; i++) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+
+    return op;
+}
+
+
+
+////////////////
+// UNIT TESTS //
+////////////////
+
+
+
+static size_t min_size(size_t x, size_t y) {
+    return x < y ? x : y;
+}
+
+void cu_assert_roundtrip(CuTest *tc, const uint8_t *data, size_t len) {
+    uint8_t *compressed = malloc(compress_bound(len));
+    uint8_t *decompressed = malloc(len + 1);
+
+    size_t clen = compress(data, len, compressed);
+    CuAssertTrue(tc, clen <= compress_bound(len));
+
+    size_t dlen = decompress(compressed, clen, decompressed, len + 1);
+    CuAssertIntEquals(tc, len, dlen);
+    CuAssertBytesEquals(tc, (uint8_t *) data, decompressed, len);
+
+    free(compressed);
+    free(decompressed);
+}
+
+void test_compress_small(CuTest *tc) {
+    cu_assert_roundtrip(tc, (uint8_t *) "", 0);
+    cu_assert_roundtrip(tc, (uint8_t *) "a", 1);
+    cu_assert_roundtrip(tc, (uint8_t *) "abcdefgh", 8);
+    cu_assert_roundtrip(tc, (uint8_t *) "aaaaaaaaaaaa", 12);
+}
+
+// Repetitive input like log lines compresses well, and long literal and match
+// runs need the extra length bytes.
+void test_compress_repetitive(CuTest *tc) {
+    size_t len = 100000;
+    uint8_t *data = malloc(len);
+    char line[64];
+    for (size_t n = 0, i = 0; n < len; i++) {
+        int line_len = snprintf(line,
+                                sizeof(line),
+                                "2024-03-01 INFO request id=%zu took %zums\n",
+                                i,
+                                i % 17);
+        memcpy(data + n, line, min_size(line_len, len - n));
+        n += min_size(line_len, len - n);
+    }
+    cu_assert_roundtrip(tc, data, len);
+
+    uint8_t *compressed = malloc(compress_bound(len));
+    CuAssertTrue(tc, compress(data, len, compressed) < len / 3);
+
+    memset(data, 'z', len);
+    cu_assert_roundtrip(tc, data, len);
+
+    free(compressed);
+    free(data);
+}
+
+// Random data doesn't compress, but it still has to come back the same.
+void test_compress_random(CuTest *tc) {
+    size_t len = 70000;
+    uint8_t *data = malloc(len);
+    uint32_t x = 12345;
+    for (size_t i = 0; i < len; i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = x >> 16;
+    }
+    cu_assert_roundtrip(tc, data, len);
+    free(data);
+}
+
+void test_decompress_corrupt(CuTest *tc) {
+    uint8_t out[16];
+    // A match before the start of the output.
+    CuAssertIntEquals(tc, -1, decompress((uint8_t *) "\x10" "a" "\x05\x00",
+                                         4, out, sizeof(out)));
+    // Literals running past the end of the input.
+    CuAssertIntEquals(tc, -1, decompress((uint8_t *) "\x50" "ab", 3,
+                                         out, sizeof(out)));
+    // Output larger than the capacity.
+    CuAssertIntEquals(tc, -1, decompress((uint8_t *) "\x1F" "a" "\x01\x00\x10",
+                                         5, out, sizeof(out)));
+}
+
+CuSuite *compress_test_suite() {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_compress_small);
+    SUITE_ADD_TEST(suite, test_compress_repetitive);
+    SUITE_ADD_TEST(suite, test_compress_random);
+    SUITE_ADD_TEST(suite, test_decompress_corrupt);
+    return suite;
+}
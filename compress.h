@@ -0,0 +1,42 @@
+#ifndef INCLUDED_COMPRESS_H
+#define INCLUDED_COMPRESS_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "./CuTest.h"
+
+/*
+  A small and fast LZ77 style block compressor, in the spirit of LZ4. It's
+  used to compress old parts of the scrollback buffer before they're written to
+  disk, see scrollback.c. Speed matters a lot more than the compression ratio
+  here, terminal output tends to be repetitive enough anyway.
+
+  A compressed block is a sequence of
+
+      token               uint8_t, literal length << 4 | match length - 4
+      [literal length]    more bytes if the literal length in token is 15
+      literals
+      offset              uint16_t, little endian
+      [match length]      more bytes if the match length in token is 15
+
+  where a match copies `match length` bytes starting `offset` bytes back in the
+  output. The last sequence stops after the literals. The extra length bytes
+  are added to the 15 from the token, and keep coming as long as they're 255.
+ */
+
+// The most `compress` can output for an input of `len` bytes.
+size_t compress_bound(size_t len);
+// Compress `len` bytes from `src` into `dst`, which has to have room for
+// `compress_bound(len)` bytes. Returns the compressed size.
+size_t compress(const uint8_t *src, size_t len, uint8_t *dst);
+// Decompress `len` bytes from `src` into `dst` which has room for `capacity`
+// bytes. Returns the decompressed size, or -1 if the input was corrupt.
+size_t decompress(const uint8_t *src,
+                  size_t len,
+                  uint8_t *dst,
+                  size_t capacity);
+
+CuSuite *compress_test_suite();
+
+#endif /* INCLUDED_COMPRESS_H */
@@ -1,6 +1,7 @@
 #include "./diagnostics.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
@@ -8,21 +9,78 @@
 
 
 static int current_type;
-static bool matches;
-static const int MASK = DIAGNOSTICS_ALL;
+bool diagnostics_matches;
+// The categories enabled at runtime, see `diagnostics_initialize`.
+static int mask = DIAGNOSTICS_ALL;
 
 // Temporary buffer used to avoid malloc etc.
 #define DIAGNOSTICS_TMP_BUF_SIZE 1024
 static char DIAGNOSTICS_TMP_BUF[DIAGNOSTICS_TMP_BUF_SIZE];
 
+static const struct {
+    const char *name;
+    enum diagnostics_type_e type;
+} CATEGORY_NAMES[] = {
+    { "misc",        DIAGNOSTICS_MISC },
+    { "x11",         DIAGNOSTICS_X11_EVENT },
+    { "parse-input", DIAGNOSTICS_TERM_PARSE_INPUT },
+    { "parse-state", DIAGNOSTICS_TERM_PARSE_STATE },
+    { "code-error",  DIAGNOSTICS_TERM_CODE_ERROR },
+    { "response",    DIAGNOSTICS_TERM_RESPONSE },
+    { "event-loop",  DIAGNOSTICS_EVENT_LOOP },
+    { "verbose",     DIAGNOSTICS_VERBOSE },
+    { "all",         DIAGNOSTICS_ALL },
+    { "none",        DIAGNOSTICS_NONE },
+};
+
+/*
+  Reads the runtime mask from MIN_TERMINAL_DIAGNOSTICS, for instance
+      MIN_TERMINAL_DIAGNOSTICS=code-error,x11
+  If the variable isn't set we default to everything that was compiled in.
+ */
 void diagnostics_initialize(void) {
+    const char *env = secure_getenv("MIN_TERMINAL_DIAGNOSTICS");
+
+    if (env != NULL) {
+        mask = DIAGNOSTICS_NONE;
+
+        while (*env != '\0') {
+            size_t len = strcspn(env, ",");
+
+            bool found = false;
+            for (size_t i = 0;
+                 i < sizeof(CATEGORY_NAMES) / sizeof(CATEGORY_NAMES[0]);
+                 i++) {
+                if (strlen(CATEGORY_NAMES[i].name) == len
+                    && strncmp(CATEGORY_NAMES[i].name, env, len) == 0) {
+                    mask |= CATEGORY_NAMES[i].type;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) {
+                fprintf(stderr,
+                        "Unknown diagnostics category \"%.*s\" in "
+                        "MIN_TERMINAL_DIAGNOSTICS\n",
+                        (int) len,
+                        env);
+            }
+
+            env += len;
+            if (*env == ',') {
+                env ++;
+            }
+        }
+    }
+
     diagnostics_type(DIAGNOSTICS_MISC, __FILE__, __LINE__);
 }
 
-void diagnostics_type(enum diagnostics_type_e t, char *filename, int line) {
+void diagnostics_select(enum diagnostics_type_e t, char *filename, int line) {
     current_type = t;
-    matches = (MASK & t) != 0;
-    if (!matches) {
+    diagnostics_matches = (mask & t) != 0;
+    if (!diagnostics_matches) {
         return;
     }
 
@@ -38,18 +96,14 @@ void diagnostics_type(enum diagnostics_type_e t, char *filename, int line) {
     fwrite(s, sizeof(char), strlen(s), stderr);
 }
 
-void diagnostics_printfe(const char *format, ...) {
+void diagnostics_printfe_impl(const char *format, ...) {
     va_list argp;
     va_start(argp, format);
-    diagnostics_vprintfe(format, argp);
+    diagnostics_vprintfe_impl(format, argp);
     va_end(argp);
 }
 
-void diagnostics_vprintfe(const char *format, va_list argp) {
-    if (!matches) {
-        return;
-    }
-
+void diagnostics_vprintfe_impl(const char *format, va_list argp) {
     int did_write = vsnprintf(DIAGNOSTICS_TMP_BUF,
                               DIAGNOSTICS_TMP_BUF_SIZE,
                               format,
@@ -95,18 +149,14 @@ void diagnostics_vprintfe(const char *format, va_list argp) {
     }
 }
 
-void diagnostics_printf(const char *format, ...) {
+void diagnostics_printf_impl(const char *format, ...) {
     va_list argp;
     va_start(argp, format);
-    diagnostics_vprintf(format, argp);
+    diagnostics_vprintf_impl(format, argp);
     va_end(argp);
 }
 
-void diagnostics_vprintf(const char *format, va_list argp) {
-    if (!matches) {
-        return;
-    }
-
+void diagnostics_vprintf_impl(const char *format, va_list argp) {
     const int ret = vprintf(format, argp);
 
     // Error occured.
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdarg.h>
+#include <stdbool.h>
 
 enum diagnostics_type_e {
     DIAGNOSTICS_MISC             = 1 << 0,
@@ -14,16 +15,56 @@ enum diagnostics_type_e {
     DIAGNOSTICS_EVENT_LOOP       = 1 << 7,
     DIAGNOSTICS_ALL              = (1 << 8) - 1,
     DIAGNOSTICS_NONE             = 0,
+    // The categories that fire for every byte we parse or every iteration of
+    // the event loop.
+    DIAGNOSTICS_VERBOSE          = DIAGNOSTICS_TERM_PARSE_INPUT
+                                   | DIAGNOSTICS_TERM_PARSE_STATE
+                                   | DIAGNOSTICS_EVENT_LOOP,
 };
 
+/*
+  Diagnostics are filtered twice:
+
+  1) At compile time by `DIAGNOSTICS_COMPILED`. The categories not in this mask
+     are compiled away entirely, `diagnostics_type` becomes a constant and the
+     `diagnostics_printf*` calls following it become dead code that the
+     compiler removes. The release build leaves out `DIAGNOSTICS_VERBOSE` since
+     doing something for every single byte we parse is way too slow.
+  2) At runtime by the mask given by the environment variable
+     MIN_TERMINAL_DIAGNOSTICS, a comma separated list of category names, see
+     `diagnostics_initialize`.
+
+  After `diagnostics_type` has been called `diagnostics_matches` tells whether
+  or not the category is enabled, so that a call site can skip work that's only
+  done for the sake of diagnostics.
+ */
+#ifndef DIAGNOSTICS_COMPILED
+#define DIAGNOSTICS_COMPILED DIAGNOSTICS_ALL
+#endif
+
+extern bool diagnostics_matches;
+
+#define diagnostics_type(t, filename, line)                        \
+    ((DIAGNOSTICS_COMPILED & (t)) != 0                             \
+     ? diagnostics_select((t), (filename), (line))                 \
+     : (void) (diagnostics_matches = false))
+#define diagnostics_printf(...)                                    \
+    (diagnostics_matches ? diagnostics_printf_impl(__VA_ARGS__) : (void) 0)
+#define diagnostics_vprintf(format, argp)                          \
+    (diagnostics_matches ? diagnostics_vprintf_impl((format), (argp)) : (void) 0)
+#define diagnostics_printfe(...)                                   \
+    (diagnostics_matches ? diagnostics_printfe_impl(__VA_ARGS__) : (void) 0)
+#define diagnostics_vprintfe(format, argp)                         \
+    (diagnostics_matches ? diagnostics_vprintfe_impl((format), (argp)) : (void) 0)
+
 void diagnostics_initialize(void);
-void diagnostics_type(enum diagnostics_type_e, char *filename, int line);
-void diagnostics_printf(const char *format, ...)
+void diagnostics_select(enum diagnostics_type_e, char *filename, int line);
+void diagnostics_printf_impl(const char *format, ...)
     __attribute__((format(printf, 1, 2)));
-void diagnostics_vprintf(const char *format, va_list argp);
-void diagnostics_printfe(const char *format, ...)
+void diagnostics_vprintf_impl(const char *format, va_list argp);
+void diagnostics_printfe_impl(const char *format, ...)
     __attribute__((format(printf, 1, 2)));
-void diagnostics_vprintfe(const char *format, va_list argp);
+void diagnostics_vprintfe_impl(const char *format, va_list argp);
 void diagnostics_flush(void);
 
 #endif /* INCLUDED_DIAGNOSTICS_H */
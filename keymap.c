@@ -174,12 +174,30 @@ void keymap_handle_x11_keypress(XKeyPressedEvent event) {
            || status == XLookupChars
            || status == XLookupBoth);
 
+    if (min_terminal_search_key(status == XLookupChars ? NoSymbol : keysym,
+                                buf,
+                                status == XLookupKeySym ? 0 : len)) {
+        return;
+    }
+
     // The key that was pressed corresponds to some letter.
     if (status == XLookupChars || status == XLookupBoth) {
         printf("\n\x1B[36m> Got key '");
         print_escape_non_printable(buf, len);
         printf("\x1B[36m' from x11.\x1B[0m\n");
 
+        // Ctrl+Shift+F, as opposed to Ctrl+F.
+        if (len == 1 && buf[0] == 6 && (event.state & ShiftMask)) {
+            min_terminal_search_start(false);
+            return;
+        }
+
+        // Ctrl+Shift+R.
+        if (len == 1 && buf[0] == 18 && (event.state & ShiftMask)) {
+            min_terminal_search_start(true);
+            return;
+        }
+
         if (len == 1 && buf[0] == 6) {
             min_terminal_scroll_forward();
             return;
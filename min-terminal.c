@@ -78,14 +78,17 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <sys/timerfd.h>
 #include <poll.h>
 #include <errno.h>
 #include <assert.h>
 #include <libgen.h>
 #include <limits.h>
+#include <time.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <X11/keysym.h>
 
 // We're using GLAD as our OpenGL loader, and header files we're using we're
 // generated with the following link. The header files themselves are located in
@@ -100,6 +103,7 @@
 #include "./termbuf.h"
 #include "./keymap.h"
 #include "./arguments.h"
+#include "./recording.h"
 #include "./diagnostics.h"
 #include "./util.h"
 
@@ -124,8 +128,51 @@ static pid_t shell_pid;       // The PID of the shell process.
 // doc comment for rationale.
 static int event_loop_self_pipes[2];
 
+// See FRAME PACING section in `event_loop` doc comment.
+static uint64_t frame_interval = 1000000000 / 60;  // Nanoseconds.
+static int frame_timer_fd;
+static bool frame_scheduled = false;
+static bool resize_pending = false;  // See RESIZING in `event_loop`.
+static uint64_t last_frame_time = 0;
+static uint64_t last_keypress_time = 0;
+// glXGetSyncValuesOML, if GLX_OML_sync_control is supported.
+static Bool (*get_sync_values)(Display *,
+                               GLXDrawable,
+                               int64_t *,
+                               int64_t *,
+                               int64_t *) = NULL;
+
+// See FAIR SCHEDULING section in `event_loop` doc comment.
+static const uint64_t PARSE_TIME_SLICE = 4000000;  // Nanoseconds.
+static const size_t MIN_PARSE_BUDGET = 4096;
+static const size_t MAX_PARSE_BUDGET = 4 * 1024 * 1024;
+static size_t parse_budget = 64 * 1024;  // Bytes.
+
 static int shell_terminated = false;
 
+// Only used with `--record FILE`, fd is -1 otherwise.
+static struct recording recording = { .fd = -1 };
+
+// See `min_terminal_search_start`.
+static struct {
+    bool active;
+    bool editing;  // Typing the query, rather than going through the matches.
+    uint8_t query[256];
+    size_t len;
+    uint64_t origin;  // The line at the bottom of the view when we started.
+    bool found;
+    struct termbuf_match match;
+    // The query is a regular expression, compiled into `re` once it has been
+    // typed. `invalid` if it didn't compile.
+    bool regex;
+    bool compiled;
+    bool invalid;
+    struct regex re;
+    // The other matches in view, see `render`.
+    struct termbuf_match visible[128];
+    int nvisible;
+} search = { 0 };
+
 #if _POSIX_C_SOURCE < 200112L
 #error "we don't have posix_openpt\n"
 #endif
@@ -134,7 +181,23 @@ void handle_primary_pty_input();
 void handle_primary_pty_hup();
 void handle_x11_event();
 void handle_x11_event_hup();
+void handle_frame_timer();
+void handle_frame_timer_hup();
+uint64_t monotonic_time();
+void apply_resize();
 void render();
+void render_search_matches(int row_on_screen,
+                           int scrollback_row,
+                           const struct termbuf_char *cells,
+                           int length);
+void render_search_match(int row_on_screen,
+                         int scrollback_row,
+                         const struct termbuf_char *cells,
+                         int length,
+                         const struct termbuf_match *match,
+                         int color);
+void render_search_prompt();
+void schedule_render();
 void gl_debug_msg_callback(GLenum source,
                            GLenum type,
                            GLuint id,
@@ -143,7 +206,61 @@ void gl_debug_msg_callback(GLenum source,
                            const GLchar *message,
                            const void *userParam);
 
+uint64_t monotonic_time() {
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret == 0);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Resize the terminal to fit the window, if the window has been resized since
+// the last frame. See RESIZING in `event_loop` doc comment.
+void apply_resize() {
+    if (!resize_pending) {
+        return;
+    }
+    resize_pending = false;
+
+    // Calculate a new column and row count.
+    int nrows, ncols;
+    rendering_calculate_sizes(window_height - 2 * BORDERPX,
+                              window_width - 2 * BORDERPX,
+                              CELL_HEIGHT,
+                              &nrows,
+                              &ncols);
+
+    // Most sizes along the way of a drag don't change the number of cells,
+    // and the shell doesn't need to hear about those.
+    if (nrows == tb.nrows && ncols == tb.ncols) {
+        return;
+    }
+
+    diagnostics_type(DIAGNOSTICS_X11_EVENT, __FILE__, __LINE__);
+    diagnostics_printf("New row:col %d:%d", nrows, ncols);
+
+    termbuf_resize(&tb, nrows, ncols);
+
+    if (recording.fd != -1) {
+        recording_write_resize(&recording, nrows, ncols);
+    }
+
+    // Update the dimensions of the pty file descriptor
+    struct winsize w = {
+        .ws_row = nrows,
+        .ws_col = ncols,
+        .ws_xpixel = 0,  // unused.
+        .ws_ypixel = 0,  // unused.
+    };
+
+    int ret = ioctl(primary_pty_fd, TIOCSWINSZ, &w);
+    if (ret == -1) {
+        assert(false);
+    }
+}
+
 void render() {
+    apply_resize();
+
     /*
                       Scrollback buffer
          |                                         |     .
@@ -180,55 +297,110 @@ void render() {
                scrollback buffer.
      */
 
+    // Where the cursor was drawn in the previous frame, and how far we had
+    // scrolled back.
+    static int last_cursor_row = 0;
+    static int last_cursor_col = 0;
+    static int last_scroll_position = -1;
+    static bool last_search_active = false;
+
+    // Only the damaged cells of the terminal buffer are redrawn, the rest of
+    // the previous frame is kept as it is. When looking at the scrollback
+    // buffer everything is shifted down on the screen though, so then we draw
+    // everything. Same thing while searching, so that the prompt and the
+    // highlighted match don't leave anything behind.
+    if (tb.scroll_position != 0 || tb.scroll_position != last_scroll_position
+        || search.active || last_search_active) {
+        termbuf_damage_all(&tb);
+    }
+    last_scroll_position = tb.scroll_position;
+    last_search_active = search.active;
+
+    // With a regex all the matches in view are highlighted, not just the
+    // current one.
+    search.nvisible = 0;
+    if (search.active && search.compiled) {
+        int position = tb.scroll_position;
+        uint64_t top = position > 0
+                       ? termbuf_scrollback_line(&tb, position)
+                       : termbuf_line(&tb, 1);
+        // The line of the row just below the view is close enough.
+        uint64_t bottom = position > tb.nrows
+                          ? termbuf_scrollback_line(&tb, position - tb.nrows)
+                          : termbuf_line(&tb, tb.nrows - position);
+        search.nvisible = termbuf_search_regex_lines(
+            &tb,
+            &search.re,
+            top,
+            bottom,
+            search.visible,
+            sizeof(search.visible) / sizeof(search.visible[0]));
+    }
+
+    // Erase the cursor from the previous frame.
+    if (1 <= last_cursor_row && last_cursor_row <= tb.nrows
+        && 1 <= last_cursor_col && last_cursor_col <= tb.ncols) {
+        termbuf_damage_span(&tb, last_cursor_row, last_cursor_col,
+                            last_cursor_col);
+    }
+
     int row_on_screen = 1;
 
-    for (int row = 1; row <= tb.scroll_position; row ++) {
-        static struct termbuf_char c = {
-            .bg.r = 255,
-            .bg.g = 0,
-            .bg.b = 0,
-            .fg.r = 255,
-            .fg.g = 255,
-            .fg.b = 255,
-        };
+    for (int row = 1; row <= tb.scroll_position && row <= tb.nrows; row ++) {
+        static const struct termbuf_char EMPTY = { 0 };
 
-        const char *ascii;
+        const struct termbuf_char *cells;
         int length;
-        termbuf_scrollback_get_row(&tb,
-                                   tb.scroll_position - row_on_screen + 1,
-                                   &ascii,
-                                   &length);
+        if (!termbuf_scrollback_get_row(&tb,
+                                        tb.scroll_position - row_on_screen + 1,
+                                        &cells,
+                                        &length)) {
+            length = 0;
+        }
 
         int n = length < tb.ncols ? length : tb.ncols;
 
-        for (int col = 1; col <= n; col ++) {
-
-            c.utf8_char[0] = ascii[col - 1];
-            c.flags = '!' <= ascii[col - 1] && ascii[col - 1] <= '~' ?
-                FLAG_LENGTH_1 : FLAG_LENGTH_0;
-
-            rendering_render_cell(0, 0, row_on_screen, col, &c);
+        if (n > 0) {
+            rendering_render_row(row_on_screen, cells, n);
         }
 
-        c.flags = FLAG_LENGTH_0;
         for (int col = n + 1; col <= tb.ncols; col++) {
-            rendering_render_cell(0, 0, row_on_screen, col, &c);
+            rendering_render_cell(0, 0, row_on_screen, col,
+                                  (struct termbuf_char *) &EMPTY);
         }
 
+        render_search_matches(row_on_screen,
+                              tb.scroll_position - row_on_screen + 1,
+                              cells,
+                              n);
+
         row_on_screen ++;
     }
 
     for (int row = 1; row <= tb.nrows - tb.scroll_position; row ++) {
-        for (int col = 1; col <= tb.ncols; col ++) {
-            struct termbuf_char *c =
-                tb.buf + (row - 1) * tb.ncols + col - 1;
+        struct termbuf_damage d = tb.damage[row - 1];
 
-            rendering_render_cell(0, 0, row_on_screen, col, c);
+        // Ligatures reach across cells, so a damaged row is drawn whole.
+        if (d.start <= d.end) {
+            rendering_render_row(row_on_screen,
+                                 termbuf_row(&tb, row),
+                                 tb.ncols);
         }
+        render_search_matches(row_on_screen,
+                              0,
+                              termbuf_row(&tb, row),
+                              tb.ncols);
         row_on_screen ++;
     }
 
-    struct termbuf_char c = tb.buf[tb.col - 1 + (tb.row - 1) * tb.ncols];
+    render_search_prompt();
+
+    termbuf_damage_clear(&tb);
+
+    // The cursor can sit just outside of the screen after writing to the last
+    // column.
+    int cursor_col = tb.col > tb.ncols ? tb.ncols : tb.col;
+    struct termbuf_char c = termbuf_row(&tb, tb.row)[cursor_col - 1];
     c.fg.r = 0;
     c.fg.g = 0;
     c.fg.b = 0;
@@ -237,10 +409,107 @@ void render() {
     c.bg.b = tb.palette[8 * 3 + 2];
 
     rendering_render_cell(0, 0, tb.row, tb.col, &c);
+    last_cursor_row = tb.row;
+    last_cursor_col = tb.col;
+
+    rendering_end_frame();
+}
+
+// Highlight the search matches on the row on screen at `row_on_screen`, which
+// is row `scrollback_row` of the scrollback buffer or 0 if it's on the screen.
+// The current match stands out from the others.
+void render_search_matches(int row_on_screen,
+                           int scrollback_row,
+                           const struct termbuf_char *cells,
+                           int length) {
+    if (!search.active) {
+        return;
+    }
+
+    for (int i = 0; i < search.nvisible; i++) {
+        render_search_match(row_on_screen, scrollback_row, cells, length,
+                            &search.visible[i], 3);
+    }
+    if (search.found) {
+        render_search_match(row_on_screen, scrollback_row, cells, length,
+                            &search.match, 11);
+    }
+}
+
+// Draw the part of `match` that's on the row in palette color `color`.
+void render_search_match(int row_on_screen,
+                         int scrollback_row,
+                         const struct termbuf_char *cells,
+                         int length,
+                         const struct termbuf_match *match,
+                         int color) {
+    static const struct termbuf_char EMPTY = { 0 };
+
+    int start;
+    int end;
+    if (scrollback_row > 0
+        ? !termbuf_scrollback_match_cols(&tb, scrollback_row, match, &start,
+                                         &end)
+        : !termbuf_row_match_cols(&tb, row_on_screen - tb.scroll_position,
+                                  match, &start, &end)) {
+        return;
+    }
 
-    // Use this instead if doing double buffering.
-    // glXSwapBuffers(display, window);
-    glFlush();
+    for (int col = start; col <= end && col <= tb.ncols; col++) {
+        struct termbuf_char c = col <= length ? cells[col - 1] : EMPTY;
+        c.flags &= ~FLAG_INVERT_COLORS;
+        c.fg = (struct color) { .r = 0, .g = 0, .b = 0 };
+        c.bg.r = tb.palette[color * 3];
+        c.bg.g = tb.palette[color * 3 + 1];
+        c.bg.b = tb.palette[color * 3 + 2];
+        rendering_render_cell(0, 0, row_on_screen, col, &c);
+    }
+}
+
+// Draw the query over the bottom row of the screen while searching.
+void render_search_prompt() {
+    if (!search.active) {
+        return;
+    }
+
+    const char *status = "";
+    if (search.invalid) {
+        status = "  (invalid regex)";
+    } else if (!search.found && search.len > 0
+               && !(search.regex && search.editing)) {
+        status = "  (not found)";
+    }
+
+    char text[sizeof(search.query) + 32];
+    int len = snprintf(text,
+                       sizeof(text),
+                       "%s%c%.*s%s",
+                       search.regex ? "re" : "",
+                       search.editing ? '/' : ':',
+                       (int) search.len,
+                       (char *) search.query,
+                       status);
+
+    struct termbuf_char c = {
+        .flags = FLAG_LENGTH_0,
+        .fg = { .r = 255, .g = 255, .b = 255 },
+        .bg = { .r = 0, .g = 0, .b = 0 },
+    };
+
+    // One cell per UTF-8 encoded character.
+    int i = 0;
+    for (int col = 1; col <= tb.ncols; col++) {
+        memset(c.utf8_char, 0, sizeof(c.utf8_char));
+        c.flags = FLAG_LENGTH_0;
+        if (i < len) {
+            int n = 0;
+            do {
+                c.utf8_char[n++] = text[i++];
+            } while (i < len && n < 4 && (text[i] & 0xC0) == 0x80);
+            c.flags = n;
+        }
+        rendering_render_cell(0, 0, tb.nrows, col, &c);
+    }
 }
 
 /*
@@ -314,6 +583,60 @@ void render() {
     I think this is similar to how GLFW does it
     https://github.com/glfw/glfw/pull/2033
 
+  * FRAME PACING
+    A program like `cat`ing a big file can make `primary_pty_fd` readable
+    thousands of times per second, and there's no point in rendering more often
+    than the display refreshes. So event handlers don't call `render` directly,
+    they call `schedule_render`. If a frame was rendered less than
+    `frame_interval` ago `schedule_render` arms `frame_timer_fd` to go off when
+    it's time for the next frame, and all damage done to the terminal buffer in
+    the meantime gets drawn in that one frame once poll wakes us up and
+    `handle_frame_timer` is executed.
+
+    The exception is the first frame after a key press, that one is rendered
+    immediately, otherwise we could add up to a frame of latency when typing.
+
+    `frame_interval` is the refresh interval of the display if the
+    GLX_OML_sync_control extension tells us what it is, and 60 Hz otherwise.
+    With GLX_EXT_swap_control (or GLX_MESA_swap_control) buffer swaps wait for
+    the vertical blank, so frames don't tear, see `setup_swap_control`.
+
+    The extension also tells us when the display last refreshed (UST), so the
+    frame timer goes off in step with the refreshes rather than at some
+    arbitrary point in between, see `last_vblank_time`. A frame rendered right
+    after a refresh has the whole interval to make it to the next one.
+
+    Waiting for the vertical blank has a cost for the frame after a key press:
+    if the frame before it is still waiting to be shown, `glXSwapBuffers`
+    blocks until it is, which can be up to a refresh. That's still sooner
+    than the frame timer would get to it, and without the wait that frame
+    could tear, so we take that over a lower swap interval.
+
+  * RESIZING
+    Dragging the edge of the window makes the window manager send us a
+    ConfigureNotify for every pixel or so. Resizing the terminal buffer for
+    each of them would be wasteful, and worse, every TIOCSWINSZ sends the shell
+    a SIGWINCH, so a TUI would redraw itself over and over for sizes that are
+    gone by the time its output reaches us. So `handle_x11_event` only
+    remembers the latest size of the window and schedules a frame, and
+    `apply_resize` resizes everything once at the start of `render`, which
+    means at most once per frame. Sizes that come out to the same number of
+    rows and columns don't resize anything at all.
+
+  * FAIR SCHEDULING
+    Something like `yes` writes to `primary_pty_fd` as fast as we can read, so
+    if `handle_primary_pty_input` read until there's nothing left it would
+    never return, and a Ctrl-C would sit in the X11 event queue forever. So it
+    only parses `parse_budget` bytes before returning to poll, which will
+    report `primary_pty_fd` as readable again right away but gets to handle
+    X11 events and the frame timer first.
+
+    The budget is in bytes because looking at the clock between every read is
+    wasteful, but we want it to correspond to roughly `PARSE_TIME_SLICE` of
+    work. So whenever the budget runs out we measure how long it took and scale
+    it accordingly, cheap output like plain text gets a larger budget than
+    output full of escape sequences.
+
  */
 void event_loop() {
     diagnostics_type(DIAGNOSTICS_EVENT_LOOP, __FILE__, __LINE__);
@@ -330,6 +653,7 @@ void event_loop() {
                  | StructureNotifyMask);
 
     render();
+    last_frame_time = monotonic_time();
 
     // See POLLING IN EVENT LOOP WITHOUT X11 RELATED BUGS section in
     // `event_loop` doc comment for rationale.
@@ -338,7 +662,13 @@ void event_loop() {
         assert(false);
     }
 
-    #define N_EVENT_TYPES 3
+    // See FRAME PACING section in `event_loop` doc comment.
+    frame_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (frame_timer_fd == -1) {
+        assert(false);
+    }
+
+    #define N_EVENT_TYPES 4
 
     struct pollfd pollfds[N_EVENT_TYPES] = {
         {
@@ -352,7 +682,11 @@ void event_loop() {
         {
             .fd = event_loop_self_pipes[0],
             .events = POLLIN,
-        }
+        },
+        {
+            .fd = frame_timer_fd,
+            .events = POLLIN,
+        },
     };
 
     void (*handlers[N_EVENT_TYPES*2]) (void) = {
@@ -362,6 +696,8 @@ void event_loop() {
         handle_x11_event_hup,
         handle_x11_event,
         handle_x11_event_hup,
+        handle_frame_timer,
+        handle_frame_timer_hup,
     };
 
     while(true) {
@@ -397,7 +733,37 @@ void handle_primary_pty_input() {
     #define BUFSIZE 4096
     uint8_t buf[BUFSIZE];
     size_t did_read;
+    size_t total_read = 0;
+    uint64_t start = monotonic_time();
     while (true) {
+        // See FAIR SCHEDULING section in `event_loop` doc comment.
+        if (total_read >= parse_budget) {
+            uint64_t elapsed = monotonic_time() - start;
+            if (elapsed == 0) {
+                elapsed = 1;
+            }
+
+            // Move halfway towards the budget that would have lasted for
+            // exactly one time slice, so that a single odd chunk doesn't
+            // throw it off too much.
+            size_t target = (double) total_read * PARSE_TIME_SLICE / elapsed;
+            parse_budget = (parse_budget + target) / 2;
+            if (parse_budget < MIN_PARSE_BUDGET) {
+                parse_budget = MIN_PARSE_BUDGET;
+            }
+            if (parse_budget > MAX_PARSE_BUDGET) {
+                parse_budget = MAX_PARSE_BUDGET;
+            }
+
+            diagnostics_type(DIAGNOSTICS_EVENT_LOOP, __FILE__, __LINE__);
+            diagnostics_printf("Parse budget exhausted after %zu bytes in "
+                               "%lu ns, new budget %zu\n",
+                               total_read,
+                               (unsigned long) elapsed,
+                               parse_budget);
+            break;
+        }
+
         did_read = read(primary_pty_fd, buf, BUFSIZE);
 
         if (did_read == BUFSIZE) {
@@ -420,10 +786,111 @@ void handle_primary_pty_input() {
             exit(-1);
         }
 
+        if (recording.fd != -1) {
+            recording_write_data(&recording, buf, did_read);
+        }
+
         termbuf_parse(&tb, buf, did_read);
+        total_read += did_read;
+    }
+
+    schedule_render();
+
+    // See POLLING IN EVENT LOOP WITHOUT X11 RELATED BUGS section in
+    // `event_loop` doc comment for rationale.
+    if(XPending(display) > 0) {
+        int ret = write(event_loop_self_pipes[1], "x", 1);
+        if (ret == -1) {
+            assert(false);
+        }
+    }
+}
+
+/*
+  When the display last refreshed, in the time of `monotonic_time`, or 0 if we
+  don't know. GLX_OML_sync_control gives us that in UST, which is microseconds
+  of CLOCK_MONOTONIC with Mesa. It doesn't have to be, so a time that isn't
+  within the last second is taken to be from some other clock.
+ */
+static uint64_t last_vblank_time(uint64_t now) {
+    int64_t ust, msc, sbc;
+    if (get_sync_values == NULL
+        || !get_sync_values(display, window, &ust, &msc, &sbc)
+        || ust <= 0) {
+        return 0;
+    }
+
+    uint64_t time = (uint64_t) ust * 1000;
+    if (time > now || now - time > 1000000000) {
+        return 0;
+    }
+    return time;
+}
+
+/*
+  Render now if it's been long enough since the last frame, or if this is the
+  first frame since a key was pressed. Otherwise render once the frame timer
+  goes off. See FRAME PACING section in `event_loop` doc comment.
+ */
+void schedule_render() {
+    uint64_t now = monotonic_time();
+
+    // If a frame is already scheduled it'll still go off, but rendering twice
+    // is better than waiting with showing what the user just typed.
+    if (last_keypress_time > last_frame_time) {
+        render();
+        last_frame_time = now;
+        return;
     }
 
+    if (frame_scheduled) {
+        return;
+    }
+
+    uint64_t next_frame_time = last_frame_time + frame_interval;
+
+    // Go off at the refresh closest to that.
+    uint64_t vblank_time = last_vblank_time(now);
+    if (vblank_time != 0 && next_frame_time > vblank_time) {
+        uint64_t n = (next_frame_time - vblank_time + frame_interval / 2)
+                     / frame_interval;
+        next_frame_time = vblank_time + n * frame_interval;
+    }
+
+    if (next_frame_time <= now) {
+        render();
+        last_frame_time = now;
+        return;
+    }
+
+    struct itimerspec its = {
+        .it_interval = { 0, 0 },
+        .it_value = {
+            .tv_sec = next_frame_time / 1000000000,
+            .tv_nsec = next_frame_time % 1000000000,
+        },
+    };
+    int ret = timerfd_settime(frame_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    if (ret == -1) {
+        assert(false);
+    }
+    frame_scheduled = true;
+}
+
+void handle_frame_timer() {
+    diagnostics_type(DIAGNOSTICS_EVENT_LOOP, __FILE__, __LINE__);
+    diagnostics_printf("\x1B[31mhandle_frame_timer\x1B[m\n");
+
+    uint64_t expirations;
+    ssize_t did_read = read(frame_timer_fd, &expirations, sizeof(expirations));
+    if (did_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    assert(did_read == sizeof(expirations));
+
+    frame_scheduled = false;
     render();
+    last_frame_time = monotonic_time();
 
     // See POLLING IN EVENT LOOP WITHOUT X11 RELATED BUGS section in
     // `event_loop` doc comment for rationale.
@@ -435,10 +902,18 @@ void handle_primary_pty_input() {
     }
 }
 
+void handle_frame_timer_hup() {
+    assert(false);
+}
+
 void handle_primary_pty_hup() {
     if (!shell_terminated) {
         printf("Child process has terminated. Press any key to exit\n");
         shell_terminated = true;
+
+        if (recording.fd != -1) {
+            recording_close(&recording);
+        }
     }
 }
 
@@ -491,6 +966,7 @@ void handle_x11_event() {
                 exit(0);
             }
 
+            last_keypress_time = monotonic_time();
             keymap_handle_x11_keypress(event.xkey);
             continue;
         }
@@ -517,40 +993,16 @@ void handle_x11_event() {
             // This event can happen for many reasons, one of them being when
             // the window is resized, which is the what were interested in.
             assert(xce.width >= 0 && xce.height >= 0);
-            if ((unsigned int) xce.width == window_height
-                && (unsigned int )xce.height == window_width) {
+            if ((unsigned int) xce.width == window_width
+                && (unsigned int) xce.height == window_height) {
                 continue;
             }
 
+            // Only the latest size matters, see RESIZING.
             window_width = xce.width;
             window_height = xce.height;
-            // TODO
-
-            // Calculate a new column and row count.
-            int nrows, ncols;
-            rendering_calculate_sizes(window_height - 2 * BORDERPX,
-                                      window_width - 2 * BORDERPX,
-                                      CELL_HEIGHT,
-                                      &nrows,
-                                      &ncols);
-
-            diagnostics_type(DIAGNOSTICS_X11_EVENT, __FILE__, __LINE__);
-            diagnostics_printf("New row:col %d:%d", nrows, ncols);
-
-            termbuf_resize(&tb, nrows, ncols);
-
-            // Update the dimensions of the pty file descriptor
-            struct winsize w = {
-                .ws_row = nrows,
-                .ws_col = ncols,
-                .ws_xpixel = 0,  // unused.
-                .ws_ypixel = 0,  // unused.
-            };
-
-            int ret = ioctl(primary_pty_fd, TIOCSWINSZ, &w);
-            if (ret == -1) {
-                assert(false);
-            }
+            resize_pending = true;
+            schedule_render();
 
             continue;
         }
@@ -581,7 +1033,10 @@ void handle_x11_event() {
 
             if (event.xvisibility.state == VisibilityUnobscured
                 || event.xvisibility.state == VisibilityPartiallyObscured) {
-                render();
+                // Whatever was covering the window took our previous frame
+                // with it.
+                termbuf_damage_all(&tb);
+                schedule_render();
             }
 
             continue;
@@ -612,13 +1067,188 @@ void min_terminal_scroll_forward() {
     if (tb.scroll_position < 0) {
         tb.scroll_position = 0;
     }
-    render();
+    schedule_render();
 }
 
 void min_terminal_scroll_backward() {
     tb.scroll_position += 6;
-    // TODO: Dont scroll too far.
-    render();
+    while (tb.scroll_position > 0
+           && !termbuf_scrollback_has_row(&tb, tb.scroll_position)) {
+        tb.scroll_position --;
+    }
+    schedule_render();
+}
+
+/*
+  SEARCH
+
+  Ctrl+Shift+F searches the scrollback buffer and the screen, a bit like `?` in
+  less. While the query is typed we search as you type, from where the view
+  was when the search started towards older output, and scroll the closest
+  match into view and highlight it. The query is shown on the bottom row.
+
+  Enter stops editing the query, after which `n` goes to the next older match,
+  `N` to the next newer one and `/` starts over with a new query. Escape, or
+  `q` when not editing, ends the search and leaves the view where it is.
+
+  Ctrl+Shift+R does the same with a regular expression, see regex.h. Half a
+  regex is rarely a valid one so that search only starts on Enter, and then all
+  the matches in view are highlighted.
+
+  See `termbuf_search` and `termbuf_search_regex` for how the searching is
+  done.
+ */
+static void search_forget_regex() {
+    if (search.compiled) {
+        regex_free(&search.re);
+    }
+    search.compiled = false;
+    search.invalid = false;
+}
+
+static void search_stop() {
+    search_forget_regex();
+    search.active = false;
+}
+
+void min_terminal_search_start(bool regex) {
+    search_forget_regex();
+    search.active = true;
+    search.editing = true;
+    search.regex = regex;
+    search.len = 0;
+    search.found = false;
+    search.origin = termbuf_line(&tb, tb.nrows - tb.scroll_position);
+    schedule_render();
+}
+
+// Scroll so that the match is in view, in the middle of the screen if it
+// wasn't already in view.
+static void search_show_match() {
+    int position = tb.scroll_position;
+
+    // Rows on the screen are in view unless we've scrolled past them.
+    if (search.match.line >= tb.scrollback.end) {
+        int row = search.match.line - tb.scrollback.end + 1;
+        if (row > tb.nrows - position) {
+            tb.scroll_position = 0;
+        }
+        return;
+    }
+
+    int n = termbuf_scrollback_row_of(&tb, search.match.line,
+                                      search.match.col);
+    if (n > position || n <= position - tb.nrows) {
+        position = n + tb.nrows / 2;
+        while (position > n && !termbuf_scrollback_has_row(&tb, position)) {
+            position --;
+        }
+        tb.scroll_position = position;
+    }
+}
+
+// Find the match closest to where we are, in either direction. Where we are
+// is the current match, or where we started if there is none.
+static void search_step(bool older) {
+    uint64_t line = search.origin;
+    int col = older ? INT_MAX : 0;
+    if (search.found) {
+        line = search.match.line;
+        col = search.match.col;
+    }
+
+    struct termbuf_match match;
+    bool found;
+    if (search.regex) {
+        found = search.compiled
+            && termbuf_search_regex(&tb, &search.re, line, col, older,
+                                    &match);
+    } else {
+        found = termbuf_search(&tb, search.query, search.len, line, col,
+                               older, &match);
+    }
+
+    if (found) {
+        search.match = match;
+        search.found = true;
+        search_show_match();
+    }
+}
+
+// The query changed, look for it from the start again.
+static void search_restart() {
+    search.found = false;
+    if (!search.regex) {
+        search_step(true);
+    }
+}
+
+// Done typing the query.
+static void search_finish_editing() {
+    if (search.regex) {
+        search_forget_regex();
+        search.compiled = regex_compile(search.query, search.len, &search.re);
+        search.invalid = !search.compiled;
+        if (search.invalid) {
+            return;
+        }
+        search_step(true);
+    }
+    search.editing = false;
+}
+
+bool min_terminal_search_key(KeySym keysym, const char *buf, int len) {
+    if (!search.active) {
+        return false;
+    }
+
+    if (keysym == XK_Escape) {
+        search_stop();
+    } else if (search.editing) {
+        if (keysym == XK_Return || keysym == XK_KP_Enter) {
+            search_finish_editing();
+        } else if (keysym == XK_BackSpace) {
+            // Backspacing past the start ends the search, like in less.
+            if (search.len == 0) {
+                search_stop();
+            } else {
+                do {
+                    search.len --;
+                } while (search.len > 0
+                         && (search.query[search.len] & 0xC0) == 0x80);
+                search.invalid = false;
+                search_restart();
+            }
+        } else if (len > 0 && (uint8_t) buf[0] >= 0x20 && buf[0] != 0x7F
+                   && search.len + len <= sizeof(search.query)) {
+            memcpy(search.query + search.len, buf, len);
+            search.len += len;
+            search.invalid = false;
+            search_restart();
+        }
+    } else if (len == 1) {
+        switch (buf[0]) {
+        case 'n':
+            search_step(true);
+            break;
+        case 'N':
+            search_step(false);
+            break;
+        case '/':
+            search_forget_regex();
+            search.editing = true;
+            search.len = 0;
+            search.found = false;
+            search.origin = termbuf_line(&tb, tb.nrows - tb.scroll_position);
+            break;
+        case 'q':
+            search_stop();
+            break;
+        }
+    }
+
+    schedule_render();
+    return true;
 }
 
 int min_terminal_write_to_shellf(int pty_fd, const char *format, ...) {
@@ -645,6 +1275,66 @@ int min_terminal_write_to_shellf(int pty_fd, const char *format, ...) {
 }
 
 #ifndef UNITTEST
+// Whether the GLX extension `name` is supported.
+static bool has_glx_extension(const char *name) {
+    const char *extensions = glXQueryExtensionsString(display, screen);
+    size_t len = strlen(name);
+    for (const char *p = extensions;
+         p != NULL && (p = strstr(p, name)) != NULL;
+         p += len) {
+        if ((p == extensions || p[-1] == ' ')
+            && (p[len] == ' ' || p[len] == '\0')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+  Sync buffer swaps to the vertical blank, and find out how often and when
+  that is.
+  The extensions for this aren't part of what GLAD loads for us so we look them
+  up ourselves.
+ */
+static void setup_swap_control() {
+    if (has_glx_extension("GLX_EXT_swap_control")) {
+        void (*swap_interval)(Display *, GLXDrawable, int) =
+            (void (*)(Display *, GLXDrawable, int))
+            glXGetProcAddress((const GLubyte *) "glXSwapIntervalEXT");
+        if (swap_interval != NULL) {
+            swap_interval(display, window, 1);
+        }
+    } else if (has_glx_extension("GLX_MESA_swap_control")) {
+        int (*swap_interval)(unsigned int) =
+            (int (*)(unsigned int))
+            glXGetProcAddress((const GLubyte *) "glXSwapIntervalMESA");
+        if (swap_interval != NULL) {
+            swap_interval(1);
+        }
+    }
+
+    if (has_glx_extension("GLX_OML_sync_control")) {
+        Bool (*get_msc_rate)(Display *, GLXDrawable, int32_t *, int32_t *) =
+            (Bool (*)(Display *, GLXDrawable, int32_t *, int32_t *))
+            glXGetProcAddress((const GLubyte *) "glXGetMscRateOML");
+        int32_t numerator, denominator;
+        if (get_msc_rate != NULL
+            && get_msc_rate(display, window, &numerator, &denominator)
+            && numerator > 0 && denominator > 0) {
+            // The rate is `numerator / denominator` Hz.
+            frame_interval = 1000000000ull * denominator / numerator;
+        }
+
+        get_sync_values =
+            (Bool (*)(Display *, GLXDrawable, int64_t *, int64_t *, int64_t *))
+            glXGetProcAddress((const GLubyte *) "glXGetSyncValuesOML");
+    }
+
+    diagnostics_type(DIAGNOSTICS_MISC, __FILE__, __LINE__);
+    diagnostics_printf("Frame interval %llu ns\n",
+                       (unsigned long long) frame_interval);
+}
+
 int main(int argc, char **argv) {
     diagnostics_initialize();
 
@@ -673,15 +1363,24 @@ int main(int argc, char **argv) {
         GLX_GREEN_SIZE,     8,
         GLX_BLUE_SIZE,      8,
         GLX_DEPTH_SIZE,     24,
-        GLX_DOUBLEBUFFER,   False,
+        GLX_DOUBLEBUFFER,   True,
         None,
     };
 
+    // We'd like a double buffered window, see PRESENTATION in rendering.c,
+    // but make do without.
     int n_attribs;
     GLXFBConfig *fbconfig = glXChooseFBConfig(display,
                                               DefaultScreen(display),
                                               visual_attribs,
                                               &n_attribs);
+    if (fbconfig == NULL) {
+        visual_attribs[11] = False;
+        fbconfig = glXChooseFBConfig(display,
+                                     DefaultScreen(display),
+                                     visual_attribs,
+                                     &n_attribs);
+    }
 
     if (fbconfig == NULL) {  // config != NULL implies that n_attribs > 0.
         assert(false);
@@ -841,6 +1540,8 @@ int main(int argc, char **argv) {
     }
     printf("Loaded GL %d.%d\n", GLAD_VERSION_MAJOR(gl_version), GLAD_VERSION_MINOR(gl_version));
 
+    setup_swap_control();
+
     GLint flags;
     glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
     if ((flags & GL_CONTEXT_FLAG_DEBUG_BIT) == 0) {
@@ -858,7 +1559,8 @@ int main(int argc, char **argv) {
                           GL_TRUE);     // enabled
 
 
-    rendering_initialize(display, window, glx_context, ttf_path);
+    rendering_initialize(display, window, glx_context, ttf_path,
+                         args.grid_renderer);
 
     union { int i; unsigned int ui; Window w; } dummy;
     XGetGeometry(display,
@@ -986,6 +1688,18 @@ int main(int argc, char **argv) {
     shell_pid = pid;
 
     termbuf_initialize(nrows, ncols, primary_pty_fd, &tb);
+    termbuf_configure_scrollback(&tb,
+                                 args.scrollback_rows,
+                                 args.scrollback_bytes);
+    if (args.scrollback_spill && !scrollback_enable_spill(&tb.scrollback)) {
+        fprintf(stderr,
+                "Could not create a file for the scrollback buffer, old rows "
+                "will be dropped instead\n");
+    }
+
+    if (args.record_path != NULL) {
+        recording_open(args.record_path, nrows, ncols, &recording);
+    }
 
     XIC input_context = XCreateIC(
       input_method,
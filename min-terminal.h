@@ -1,8 +1,16 @@
 #ifndef INCLUDED_MIN_TERMINAL_H
 #define INCLUDED_MIN_TERMINAL_H
 
+#include <stdbool.h>
+#include <X11/Xlib.h>
+
 void min_terminal_scroll_forward();
 void min_terminal_scroll_backward();
+// Searching the scrollback buffer, for a regex or plain text, see SEARCH in
+// min-terminal.c.
+void min_terminal_search_start(bool regex);
+// Handle a key press while searching, returns false if we're not searching.
+bool min_terminal_search_key(KeySym keysym, const char *buf, int len);
 
 int min_terminal_write_to_shellf(int pty, const char *format, ...)
     __attribute__((format(printf, 2, 3)));
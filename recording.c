@@ -0,0 +1,253 @@
+#include "./recording.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "./CuTest.h"
+
+static const char MAGIC[8] = { 'm', 't', 'r', 'e', 'c', '0', '1', '\n' };
+
+struct __attribute__((packed)) file_header {
+    char magic[8];
+    uint32_t nrows;
+    uint32_t ncols;
+};
+
+struct __attribute__((packed)) frame_header {
+    uint64_t time;
+    uint32_t type;
+    uint32_t len;
+};
+
+static uint64_t recording_now(void) {
+    struct timespec ts;
+    int ret = clock_gettime(CLOCK_MONOTONIC, &ts);
+    assert(ret == 0);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Like `write` but keeps going until everything has been written.
+static void write_all(int fd, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t did_write = write(fd, p, len);
+        if (did_write == -1 && errno == EINTR) {
+            continue;
+        }
+        if (did_write == -1) {
+            fprintf(stderr, "Error writing recording: %s\n", strerror(errno));
+            assert(false);
+        }
+        p += did_write;
+        len -= did_write;
+    }
+}
+
+void recording_open(const char *path,
+                    int nrows,
+                    int ncols,
+                    struct recording *rec_ret) {
+    rec_ret->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (rec_ret->fd == -1) {
+        fprintf(stderr,
+                "Could not open recording file `%s`: %s\n",
+                path,
+                strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    rec_ret->start = recording_now();
+
+    struct file_header header = {
+        .nrows = nrows,
+        .ncols = ncols,
+    };
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    write_all(rec_ret->fd, &header, sizeof(header));
+}
+
+void recording_close(struct recording *rec) {
+    close(rec->fd);
+    rec->fd = -1;
+}
+
+static void recording_write_frame(struct recording *rec,
+                                  enum recording_frame_type type,
+                                  const void *data,
+                                  size_t len) {
+    struct frame_header header = {
+        .time = recording_now() - rec->start,
+        .type = type,
+        .len = len,
+    };
+    write_all(rec->fd, &header, sizeof(header));
+    write_all(rec->fd, data, len);
+}
+
+void recording_write_data(struct recording *rec,
+                          const uint8_t *data,
+                          size_t len) {
+    recording_write_frame(rec, RECORDING_FRAME_DATA, data, len);
+}
+
+void recording_write_resize(struct recording *rec, int nrows, int ncols) {
+    uint32_t size[2] = { nrows, ncols };
+    recording_write_frame(rec, RECORDING_FRAME_RESIZE, size, sizeof(size));
+}
+
+bool recording_reader_open(const char *path, struct recording_reader *r_ret) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st;
+    int ret = fstat(fd, &st);
+    if (ret == -1 || (size_t) st.st_size < sizeof(struct file_header)) {
+        close(fd);
+        return false;
+    }
+
+    r_ret->len = st.st_size;
+    r_ret->buf = mmap(NULL, r_ret->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r_ret->buf == MAP_FAILED) {
+        return false;
+    }
+
+    struct file_header header;
+    memcpy(&header, r_ret->buf, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        munmap(r_ret->buf, r_ret->len);
+        return false;
+    }
+
+    r_ret->nrows = header.nrows;
+    r_ret->ncols = header.ncols;
+    r_ret->offset = sizeof(header);
+    return true;
+}
+
+void recording_reader_close(struct recording_reader *r) {
+    munmap(r->buf, r->len);
+}
+
+bool recording_reader_next(struct recording_reader *r,
+                           struct recording_frame *frame_ret) {
+    if (r->offset + sizeof(struct frame_header) > r->len) {
+        return false;
+    }
+
+    struct frame_header header;
+    memcpy(&header, r->buf + r->offset, sizeof(header));
+
+    // The recording was cut short, for instance because the terminal crashed.
+    // Just ignore the last incomplete frame.
+    if (r->offset + sizeof(header) + header.len > r->len) {
+        return false;
+    }
+
+    const uint8_t *data = r->buf + r->offset + sizeof(header);
+    r->offset += sizeof(header) + header.len;
+
+    frame_ret->type = header.type;
+    frame_ret->time = header.time;
+
+    switch (header.type) {
+    case RECORDING_FRAME_DATA:
+        frame_ret->data = data;
+        frame_ret->len = header.len;
+        return true;
+    case RECORDING_FRAME_RESIZE:
+        {
+            assert(header.len == 2 * sizeof(uint32_t));
+            uint32_t size[2];
+            memcpy(size, data, sizeof(size));
+            frame_ret->nrows = size[0];
+            frame_ret->ncols = size[1];
+            frame_ret->data = NULL;
+            frame_ret->len = 0;
+            return true;
+        }
+    default:
+        fprintf(stderr, "Unknown recording frame type %u\n", header.type);
+        assert(false);
+    }
+}
+
+
+
+////////////////
+// UNIT TESTS //
+////////////////
+
+
+
+void test_recording_roundtrip(CuTest *tc) {
+    char path[] = "/tmp/min-terminal-recording-XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    close(fd);
+
+    struct recording rec;
+    recording_open(path, 24, 80, &rec);
+    recording_write_data(&rec, (const uint8_t *) "hello", 5);
+    recording_write_resize(&rec, 30, 100);
+    recording_write_data(&rec, (const uint8_t *) "\x1B[mworld", 8);
+    recording_close(&rec);
+
+    struct recording_reader r;
+    CuAssertTrue(tc, recording_reader_open(path, &r));
+    CuAssertIntEquals(tc, 24, r.nrows);
+    CuAssertIntEquals(tc, 80, r.ncols);
+
+    struct recording_frame frame;
+    CuAssertTrue(tc, recording_reader_next(&r, &frame));
+    CuAssertIntEquals(tc, RECORDING_FRAME_DATA, frame.type);
+    CuAssertIntEquals(tc, 5, frame.len);
+    CuAssertBytesEquals(tc, (unsigned char *) "hello", frame.data, 5);
+    uint64_t time = frame.time;
+
+    CuAssertTrue(tc, recording_reader_next(&r, &frame));
+    CuAssertIntEquals(tc, RECORDING_FRAME_RESIZE, frame.type);
+    CuAssertIntEquals(tc, 30, frame.nrows);
+    CuAssertIntEquals(tc, 100, frame.ncols);
+    CuAssertTrue(tc, frame.time >= time);
+
+    CuAssertTrue(tc, recording_reader_next(&r, &frame));
+    CuAssertIntEquals(tc, RECORDING_FRAME_DATA, frame.type);
+    CuAssertIntEquals(tc, 8, frame.len);
+    CuAssertBytesEquals(tc, (unsigned char *) "\x1B[mworld", frame.data, 8);
+
+    CuAssertTrue(tc, !recording_reader_next(&r, &frame));
+
+    recording_reader_close(&r);
+    unlink(path);
+}
+
+void test_recording_not_a_recording(CuTest *tc) {
+    char path[] = "/tmp/min-terminal-recording-XXXXXX";
+    int fd = mkstemp(path);
+    CuAssertTrue(tc, fd != -1);
+    write_all(fd, "this is not a recording", 23);
+    close(fd);
+
+    struct recording_reader r;
+    CuAssertTrue(tc, !recording_reader_open(path, &r));
+
+    unlink(path);
+}
+
+CuSuite *recording_test_suite() {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_recording_roundtrip);
+    SUITE_ADD_TEST(suite, test_recording_not_a_recording);
+    return suite;
+}
@@ -0,0 +1,75 @@
+#ifndef INCLUDED_RECORDING_H
+#define INCLUDED_RECORDING_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "CuTest.h"
+
+/*
+  Recordings of everything the shell sent to the terminal, used to replay real
+  sessions deterministically when profiling, see `min-terminal --record FILE`
+  and ./tests/replay.c.
+
+  A recording file is a small header followed by a sequence of frames:
+
+      header: char magic[8] = "mtrec01\n", uint32_t nrows, uint32_t ncols
+      frame:  uint64_t time, uint32_t type, uint32_t len, uint8_t data[len]
+
+  where `time` is the number of nanoseconds since the recording started. A
+  frame is either data that was read from the pty, or a resize of the terminal
+  in which case `data` is two uint32_t's, nrows and ncols. Everything is in
+  native byte order, recordings are meant to be replayed on the same kind of
+  machine that made them.
+ */
+
+enum recording_frame_type {
+    RECORDING_FRAME_DATA   = 1,
+    RECORDING_FRAME_RESIZE = 2,
+};
+
+struct recording_frame {
+    enum recording_frame_type type;
+    uint64_t time;        // Nanoseconds since the recording started.
+    const uint8_t *data;  // Only for RECORDING_FRAME_DATA.
+    size_t len;           //
+    int nrows;            // Only for RECORDING_FRAME_RESIZE.
+    int ncols;            //
+};
+
+// Writing recordings.
+struct recording {
+    int fd;
+    uint64_t start;
+};
+
+void recording_open(const char *path,
+                    int nrows,
+                    int ncols,
+                    struct recording *rec_ret);
+void recording_close(struct recording *rec);
+void recording_write_data(struct recording *rec,
+                          const uint8_t *data,
+                          size_t len);
+void recording_write_resize(struct recording *rec, int nrows, int ncols);
+
+// Reading recordings.
+struct recording_reader {
+    uint8_t *buf;
+    size_t len;
+    size_t offset;
+    int nrows;
+    int ncols;
+};
+
+// Returns false if the file isn't a recording.
+bool recording_reader_open(const char *path, struct recording_reader *r_ret);
+void recording_reader_close(struct recording_reader *r);
+// Returns false when there are no more frames.
+bool recording_reader_next(struct recording_reader *r,
+                           struct recording_frame *frame_ret);
+
+CuSuite *recording_test_suite();
+
+#endif /* INCLUDED_RECORDING_H */
@@ -0,0 +1,866 @@
+#include "./regex.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "./CuTest.h"
+
+#define TABLE_SIZE (2 * REGEX_MAX_DFA_STATES)
+
+
+
+/////////////
+// PARSING //
+/////////////
+
+
+
+/*
+  A fragment of the NFA that's still being built. `holes` is a list of the
+  `out` and `out1` fields that haven't been pointed anywhere yet, each one
+  written as `2 * state + 0` for `out` or `2 * state + 1` for `out1`. The list
+  is threaded through the fields themselves and ends with -1.
+ */
+struct fragment {
+    int start;
+    int holes;
+};
+
+struct parser {
+    struct regex *re;
+    const uint8_t *p;
+    const uint8_t *end;
+    bool error;
+};
+
+static int add_state(struct regex *re, enum regex_op op, int lo, int hi) {
+    if (re->nnfa == re->nfa_capacity) {
+        re->nfa_capacity = re->nfa_capacity == 0 ? 64 : 2 * re->nfa_capacity;
+        re->nfa = realloc(re->nfa,
+                          re->nfa_capacity * sizeof(struct regex_nfa_state));
+        if (re->nfa == NULL) {
+            assert(false);
+        }
+    }
+    re->nfa[re->nnfa] = (struct regex_nfa_state) {
+        .op = op,
+        .lo = lo,
+        .hi = hi,
+        .out = -1,
+        .out1 = -1,
+    };
+    return re->nnfa++;
+}
+
+static int *hole(struct regex *re, int h) {
+    return h % 2 == 0 ? &re->nfa[h / 2].out : &re->nfa[h / 2].out1;
+}
+
+static int append_holes(struct regex *re, int a, int b) {
+    if (a == -1) {
+        return b;
+    }
+    int last = a;
+    while (*hole(re, last) != -1) {
+        last = *hole(re, last);
+    }
+    *hole(re, last) = b;
+    return a;
+}
+
+static void patch(struct regex *re, int holes, int target) {
+    while (holes != -1) {
+        int *h = hole(re, holes);
+        holes = *h;
+        *h = target;
+    }
+}
+
+static struct fragment single(struct regex *re, enum regex_op op,
+                              int lo, int hi) {
+    int s = add_state(re, op, lo, hi);
+    return (struct fragment) { .start = s, .holes = 2 * s };
+}
+
+static struct fragment concat(struct regex *re,
+                              struct fragment a,
+                              struct fragment b) {
+    patch(re, a.holes, b.start);
+    return (struct fragment) { .start = a.start, .holes = b.holes };
+}
+
+static struct fragment alternate(struct regex *re,
+                                 struct fragment a,
+                                 struct fragment b) {
+    int s = add_state(re, REGEX_SPLIT, 0, 0);
+    re->nfa[s].out = a.start;
+    re->nfa[s].out1 = b.start;
+    return (struct fragment) {
+        .start = s,
+        .holes = append_holes(re, a.holes, b.holes),
+    };
+}
+
+static struct fragment repeat(struct regex *re, struct fragment a, char op) {
+    int s = add_state(re, REGEX_SPLIT, 0, 0);
+    re->nfa[s].out = a.start;
+
+    switch (op) {
+    case '*':
+        patch(re, a.holes, s);
+        return (struct fragment) { .start = s, .holes = 2 * s + 1 };
+    case '+':
+        patch(re, a.holes, s);
+        return (struct fragment) { .start = a.start, .holes = 2 * s + 1 };
+    case '?':
+        return (struct fragment) {
+            .start = s,
+            .holes = append_holes(re, a.holes, 2 * s + 1),
+        };
+    default:
+        assert(false);
+    }
+}
+
+// Any UTF-8 encoded character of more than one byte.
+static struct fragment multibyte(struct regex *re) {
+    struct fragment two = concat(re,
+                                 single(re, REGEX_RANGE, 0xC0, 0xDF),
+                                 single(re, REGEX_RANGE, 0x80, 0xBF));
+    struct fragment three = single(re, REGEX_RANGE, 0xE0, 0xEF);
+    struct fragment four = single(re, REGEX_RANGE, 0xF0, 0xF7);
+    for (int i = 0; i < 2; i++) {
+        three = concat(re, three, single(re, REGEX_RANGE, 0x80, 0xBF));
+    }
+    for (int i = 0; i < 3; i++) {
+        four = concat(re, four, single(re, REGEX_RANGE, 0x80, 0xBF));
+    }
+    return alternate(re, two, alternate(re, three, four));
+}
+
+/*
+  Character classes are sets of ASCII characters, 128 bits. A negated class
+  matches every other ASCII character and every non-ASCII character.
+ */
+struct class {
+    uint64_t bits[2];
+};
+
+static void class_add(struct class *c, int lo, int hi) {
+    for (int i = lo; i <= hi; i++) {
+        c->bits[i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+}
+
+static bool class_has(const struct class *c, int i) {
+    return c->bits[i / 64] & ((uint64_t) 1 << (i % 64));
+}
+
+// The classes of \d, \w and \s, returns false if `c` isn't one of them.
+static bool class_escape(uint8_t c, struct class *class_ret, bool *negated) {
+    memset(class_ret, 0, sizeof(*class_ret));
+    switch (c) {
+    case 'd':
+    case 'D':
+        class_add(class_ret, '0', '9');
+        break;
+    case 'w':
+    case 'W':
+        class_add(class_ret, '0', '9');
+        class_add(class_ret, 'a', 'z');
+        class_add(class_ret, 'A', 'Z');
+        class_add(class_ret, '_', '_');
+        break;
+    case 's':
+    case 'S':
+        class_add(class_ret, ' ', ' ');
+        class_add(class_ret, '\t', '\t');
+        break;
+    default:
+        return false;
+    }
+    *negated = 'A' <= c && c <= 'Z';
+    return true;
+}
+
+static struct fragment class_fragment(struct parser *ps,
+                                      const struct class *c,
+                                      bool negated) {
+    struct regex *re = ps->re;
+    bool have = false;
+    struct fragment f = { 0 };
+
+    // One range state for each run of characters in the class.
+    for (int i = 0; i < 128; ) {
+        if (class_has(c, i) == negated) {
+            i++;
+            continue;
+        }
+        int j = i;
+        while (j + 1 < 128 && class_has(c, j + 1) != negated) {
+            j++;
+        }
+        struct fragment range = single(re, REGEX_RANGE, i, j);
+        f = have ? alternate(re, f, range) : range;
+        have = true;
+        i = j + 1;
+    }
+
+    if (negated) {
+        f = have ? alternate(re, f, multibyte(re)) : multibyte(re);
+        have = true;
+    }
+
+    if (!have) {
+        ps->error = true;
+        return single(re, REGEX_EMPTY, 0, 0);
+    }
+    return f;
+}
+
+static struct fragment parse_alternation(struct parser *ps);
+
+static struct fragment parse_class(struct parser *ps) {
+    struct class c = { 0 };
+    bool negated = false;
+
+    if (ps->p < ps->end && *ps->p == '^') {
+        negated = true;
+        ps->p++;
+    }
+
+    // A ']' right at the start is just a character.
+    bool first = true;
+    while (ps->p < ps->end && (*ps->p != ']' || first)) {
+        first = false;
+        uint8_t lo = *ps->p++;
+
+        if (lo == '\\' && ps->p < ps->end) {
+            struct class escape;
+            bool escape_negated;
+            if (class_escape(*ps->p, &escape, &escape_negated)) {
+                if (escape_negated) {
+                    ps->error = true;
+                }
+                c.bits[0] |= escape.bits[0];
+                c.bits[1] |= escape.bits[1];
+                ps->p++;
+                continue;
+            }
+            lo = *ps->p++;
+        }
+
+        uint8_t hi = lo;
+        if (ps->end - ps->p >= 2 && ps->p[0] == '-' && ps->p[1] != ']') {
+            hi = ps->p[1];
+            ps->p += 2;
+        }
+
+        if (lo >= 0x80 || hi >= 0x80 || lo > hi) {
+            ps->error = true;
+            continue;
+        }
+        class_add(&c, lo, hi);
+    }
+
+    if (ps->p == ps->end) {
+        ps->error = true;
+    } else {
+        ps->p++;  // The ']'.
+    }
+
+    if (ps->re->ignore_case) {
+        for (int i = 'a'; i <= 'z'; i++) {
+            if (class_has(&c, i)) {
+                class_add(&c, i - 'a' + 'A', i - 'a' + 'A');
+            }
+        }
+    }
+
+    return class_fragment(ps, &c, negated);
+}
+
+static struct fragment parse_atom(struct parser *ps) {
+    struct regex *re = ps->re;
+    uint8_t c = *ps->p++;
+
+    switch (c) {
+    case '(':
+        {
+            struct fragment f = parse_alternation(ps);
+            if (ps->p == ps->end || *ps->p != ')') {
+                ps->error = true;
+                return f;
+            }
+            ps->p++;
+            return f;
+        }
+    case '[':
+        return parse_class(ps);
+    case '.':
+        return alternate(re, single(re, REGEX_RANGE, 0x00, 0x7F),
+                         multibyte(re));
+    case '^':
+        return single(re, REGEX_BEGIN, 0, 0);
+    case '$':
+        return single(re, REGEX_END, 0, 0);
+    case '*':
+    case '+':
+    case '?':
+    case ')':
+        ps->error = true;
+        return single(re, REGEX_EMPTY, 0, 0);
+    case '\\':
+        if (ps->p == ps->end) {
+            ps->error = true;
+            return single(re, REGEX_EMPTY, 0, 0);
+        }
+        c = *ps->p++;
+
+        struct class class;
+        bool negated;
+        if (class_escape(c, &class, &negated)) {
+            return class_fragment(ps, &class, negated);
+        }
+        if (c == 't') {
+            c = '\t';
+        }
+        break;
+    }
+
+    // A literal character, all of its bytes.
+    struct fragment f = single(re, REGEX_RANGE, c, c);
+    if (re->ignore_case && 'a' <= c && c <= 'z') {
+        f = alternate(re, f, single(re, REGEX_RANGE, c - 'a' + 'A',
+                                    c - 'a' + 'A'));
+    }
+    while (ps->p < ps->end && (*ps->p & 0xC0) == 0x80) {
+        f = concat(re, f, single(re, REGEX_RANGE, *ps->p, *ps->p));
+        ps->p++;
+    }
+    return f;
+}
+
+static struct fragment parse_repetition(struct parser *ps) {
+    struct fragment f = parse_atom(ps);
+    while (ps->p < ps->end
+           && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?')) {
+        f = repeat(ps->re, f, *ps->p++);
+    }
+    return f;
+}
+
+static struct fragment parse_concatenation(struct parser *ps) {
+    if (ps->p == ps->end || *ps->p == '|' || *ps->p == ')') {
+        return single(ps->re, REGEX_EMPTY, 0, 0);
+    }
+
+    struct fragment f = parse_repetition(ps);
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        f = concat(ps->re, f, parse_repetition(ps));
+    }
+    return f;
+}
+
+static struct fragment parse_alternation(struct parser *ps) {
+    struct fragment f = parse_concatenation(ps);
+    while (ps->p < ps->end && *ps->p == '|') {
+        ps->p++;
+        f = alternate(ps->re, f, parse_concatenation(ps));
+    }
+    return f;
+}
+
+
+
+/////////
+// DFA //
+/////////
+
+
+
+static void dfa_initialize(struct regex_dfa *dfa, bool unanchored) {
+    dfa->unanchored = unanchored;
+    dfa->states = malloc(REGEX_MAX_DFA_STATES
+                         * sizeof(struct regex_dfa_state));
+    dfa->table = malloc(TABLE_SIZE * sizeof(int));
+    if (dfa->states == NULL || dfa->table == NULL) {
+        assert(false);
+    }
+    dfa->nstates = 0;
+    memset(dfa->table, -1, TABLE_SIZE * sizeof(int));
+    dfa->start[0] = -1;
+    dfa->start[1] = -1;
+}
+
+static void dfa_flush(struct regex_dfa *dfa) {
+    for (int i = 0; i < dfa->nstates; i++) {
+        free(dfa->states[i].set);
+    }
+    dfa->nstates = 0;
+    memset(dfa->table, -1, TABLE_SIZE * sizeof(int));
+    dfa->start[0] = -1;
+    dfa->start[1] = -1;
+}
+
+static void dfa_free(struct regex_dfa *dfa) {
+    dfa_flush(dfa);
+    free(dfa->states);
+    free(dfa->table);
+}
+
+/*
+  Add NFA state `s` and everything reachable from it without consuming a byte
+  to `re->set`. The assertions are only passed if we're at the start resp. the
+  end of the text, but they're added to the set either way so that we can
+  check again once we know that we're at the end.
+ */
+static void closure(struct regex *re,
+                    int s,
+                    bool at_begin,
+                    bool at_end,
+                    int *nset) {
+    int nstack = 0;
+    re->stack[nstack++] = s;
+
+    while (nstack > 0) {
+        s = re->stack[--nstack];
+        if (s == -1 || re->marks[s] == re->mark) {
+            continue;
+        }
+        re->marks[s] = re->mark;
+        re->set[(*nset)++] = s;
+
+        const struct regex_nfa_state *state = &re->nfa[s];
+        switch (state->op) {
+        case REGEX_SPLIT:
+            re->stack[nstack++] = state->out1;
+            re->stack[nstack++] = state->out;
+            break;
+        case REGEX_EMPTY:
+            re->stack[nstack++] = state->out;
+            break;
+        case REGEX_BEGIN:
+            if (at_begin) {
+                re->stack[nstack++] = state->out;
+            }
+            break;
+        case REGEX_END:
+            if (at_end) {
+                re->stack[nstack++] = state->out;
+            }
+            break;
+        }
+    }
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+static bool set_matches(struct regex *re, const int *set, int nset) {
+    for (int i = 0; i < nset; i++) {
+        if (re->nfa[set[i]].op == REGEX_MATCH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Find or add the DFA state for the set of NFA states in `re->set`.
+static int dfa_state(struct regex *re, struct regex_dfa *dfa, int nset) {
+    qsort(re->set, nset, sizeof(int), compare_ints);
+
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < nset; i++) {
+        hash = (hash ^ re->set[i]) * 16777619u;
+    }
+
+    uint32_t slot = hash % TABLE_SIZE;
+    for (; dfa->table[slot] != -1; slot = (slot + 1) % TABLE_SIZE) {
+        const struct regex_dfa_state *state = &dfa->states[dfa->table[slot]];
+        if (state->nset == nset
+            && memcmp(state->set, re->set, nset * sizeof(int)) == 0) {
+            return dfa->table[slot];
+        }
+    }
+
+    // Out of states, start over.
+    if (dfa->nstates == REGEX_MAX_DFA_STATES) {
+        dfa_flush(dfa);
+        return dfa_state(re, dfa, nset);
+    }
+
+    struct regex_dfa_state *state = &dfa->states[dfa->nstates];
+    state->set = malloc(nset * sizeof(int) + 1);
+    if (state->set == NULL) {
+        assert(false);
+    }
+    memcpy(state->set, re->set, nset * sizeof(int));
+    state->nset = nset;
+    memset(state->next, -1, sizeof(state->next));
+    state->match = set_matches(re, re->set, nset);
+    state->match_at_end = -1;
+
+    dfa->table[slot] = dfa->nstates;
+    return dfa->nstates++;
+}
+
+static int dfa_start(struct regex *re, struct regex_dfa *dfa, bool at_begin) {
+    if (dfa->start[at_begin] == -1) {
+        int nset = 0;
+        re->mark ++;
+        closure(re, re->start, at_begin, false, &nset);
+        dfa->start[at_begin] = dfa_state(re, dfa, nset);
+    }
+    return dfa->start[at_begin];
+}
+
+// The state after `s` on byte `b`, encoded the same way as `next`.
+static int dfa_next(struct regex *re, struct regex_dfa *dfa, int s, uint8_t b) {
+    int next = dfa->states[s].next[b];
+    if (next != -1) {
+        return next;
+    }
+
+    int nset = 0;
+    re->mark ++;
+    const struct regex_dfa_state *state = &dfa->states[s];
+    for (int i = 0; i < state->nset; i++) {
+        const struct regex_nfa_state *n = &re->nfa[state->set[i]];
+        if (n->op == REGEX_RANGE && n->lo <= b && b <= n->hi) {
+            closure(re, n->out, false, false, &nset);
+        }
+    }
+    // Unanchored, a match can start anywhere.
+    if (dfa->unanchored) {
+        closure(re, re->start, false, false, &nset);
+    }
+
+    // Adding a state can flush all the others, then `s` is gone too.
+    int nstates = dfa->nstates;
+    next = dfa_state(re, dfa, nset);
+    next = next << 1 | dfa->states[next].match;
+    if (dfa->nstates >= nstates) {
+        dfa->states[s].next[b] = next;
+    }
+    return next;
+}
+
+// Whether state `s` matches if the text ends here, which it might thanks to $.
+static bool dfa_match_at_end(struct regex *re, struct regex_dfa *dfa, int s) {
+    struct regex_dfa_state *state = &dfa->states[s];
+    if (state->match_at_end == -1) {
+        int nset = 0;
+        re->mark ++;
+        for (int i = 0; i < state->nset; i++) {
+            closure(re, state->set[i], false, true, &nset);
+        }
+        state->match_at_end = set_matches(re, re->set, nset);
+    }
+    return state->match_at_end;
+}
+
+
+
+///////////////
+// SEARCHING //
+///////////////
+
+
+
+bool regex_compile(const uint8_t *pattern, size_t len, struct regex *re_ret) {
+    memset(re_ret, 0, sizeof(*re_ret));
+
+    // Same as the literal search, ignore case unless there are upper case
+    // letters. Escapes like \W don't count.
+    re_ret->ignore_case = true;
+    for (size_t i = 0; i < len; i++) {
+        if (pattern[i] == '\\') {
+            i++;
+        } else if ('A' <= pattern[i] && pattern[i] <= 'Z') {
+            re_ret->ignore_case = false;
+        }
+    }
+
+    struct parser ps = {
+        .re = re_ret,
+        .p = pattern,
+        .end = pattern + len,
+        .error = false,
+    };
+    struct fragment f = parse_alternation(&ps);
+    if (ps.p != ps.end) {
+        ps.error = true;  // An unmatched ')'.
+    }
+    patch(re_ret, f.holes, add_state(re_ret, REGEX_MATCH, 0, 0));
+    re_ret->start = f.start;
+
+    // Every state pushes at most two others onto the stack.
+    re_ret->stack = malloc((2 * re_ret->nnfa + 1) * sizeof(int));
+    re_ret->set = malloc(re_ret->nnfa * sizeof(int));
+    re_ret->marks = calloc(re_ret->nnfa, sizeof(uint32_t));
+    if (re_ret->stack == NULL || re_ret->set == NULL || re_ret->marks == NULL) {
+        assert(false);
+    }
+    dfa_initialize(&re_ret->anchored, false);
+    dfa_initialize(&re_ret->unanchored, true);
+
+    // The bytes that can start a match, when not at the start of the text.
+    int nset = 0;
+    re_ret->mark ++;
+    closure(re_ret, re_ret->start, false, false, &nset);
+    for (int i = 0; i < nset; i++) {
+        const struct regex_nfa_state *n = &re_ret->nfa[re_ret->set[i]];
+        if (n->op == REGEX_RANGE) {
+            memset(re_ret->first_bytes + n->lo, true, n->hi - n->lo + 1);
+        }
+    }
+
+    if (ps.error) {
+        regex_free(re_ret);
+        return false;
+    }
+
+    // Matching the empty string?
+    int s = dfa_start(re_ret, &re_ret->anchored, true);
+    if (re_ret->anchored.states[s].match
+        || dfa_match_at_end(re_ret, &re_ret->anchored, s)) {
+        regex_free(re_ret);
+        return false;
+    }
+
+    return true;
+}
+
+void regex_free(struct regex *re) {
+    free(re->nfa);
+    free(re->stack);
+    free(re->set);
+    free(re->marks);
+    dfa_free(&re->anchored);
+    dfa_free(&re->unanchored);
+}
+
+// Where the earliest match in `text` starting at `from` or later ends.
+static bool earliest_end(struct regex *re,
+                         const uint8_t *text,
+                         size_t len,
+                         size_t from,
+                         size_t *end_ret) {
+    struct regex_dfa *dfa = &re->unanchored;
+    const struct regex_dfa_state *states = dfa->states;
+    int idle = dfa_start(re, dfa, false);
+    int s = dfa_start(re, dfa, from == 0);
+    idle = dfa->start[0];
+
+    // This is where almost all of the time goes. In the idle state, where
+    // no match has started, bytes that can't start one are skipped without
+    // going through the DFA. Otherwise the transitions that are already known
+    // are followed without a call, and they tell us if it's a match too.
+    size_t i = from;
+    while (i < len) {
+        if (s == idle) {
+            while (i < len && !re->first_bytes[text[i]]) {
+                i++;
+            }
+            if (i == len) {
+                break;
+            }
+        }
+
+        int next = states[s].next[text[i]];
+        if (next == -1) {
+            next = dfa_next(re, dfa, s, text[i]);
+            idle = dfa->start[0];
+        }
+        s = next >> 1;
+        i++;
+        if (next & 1) {
+            *end_ret = i;
+            return true;
+        }
+    }
+
+    if (dfa_match_at_end(re, dfa, s)) {
+        *end_ret = len;
+        return true;
+    }
+    return false;
+}
+
+// The end of the longest match starting at `start`, or `start` if none.
+static size_t longest_match(struct regex *re,
+                            const uint8_t *text,
+                            size_t len,
+                            size_t start) {
+    struct regex_dfa *dfa = &re->anchored;
+    int s = dfa_start(re, dfa, start == 0);
+    size_t end = start;
+
+    for (size_t i = start; i < len; i++) {
+        int next = dfa_next(re, dfa, s, text[i]);
+        s = next >> 1;
+        if (dfa->states[s].nset == 0) {
+            return end;
+        }
+        if (next & 1) {
+            end = i + 1;
+        }
+    }
+
+    if (dfa_match_at_end(re, dfa, s)) {
+        end = len;
+    }
+    return end;
+}
+
+bool regex_search(struct regex *re,
+                  const uint8_t *text,
+                  size_t len,
+                  size_t from,
+                  size_t *start_ret,
+                  size_t *end_ret) {
+    size_t earliest;
+    if (from > len || !earliest_end(re, text, len, from, &earliest)) {
+        return false;
+    }
+
+    // The leftmost match starts before the earliest one ends.
+    for (size_t start = from; start < earliest; start++) {
+        if ((text[start] & 0xC0) == 0x80) {
+            continue;
+        }
+        size_t end = longest_match(re, text, len, start);
+        if (end > start) {
+            *start_ret = start;
+            *end_ret = end;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+////////////////
+// UNIT TESTS //
+////////////////
+
+
+
+void test_regex_match(CuTest *tc) {
+    struct {
+        const char *pattern;
+        const char *text;
+        const char *expected;
+    } cases[] = {
+        { "error", "an error occurred", "error" },
+        { "ERROR", "an error occurred", NULL },
+        { "error", "an ERROR occurred", "ERROR" },
+        { "e.r", "the ear", "ear" },
+        { "a+", "baaad", "aaa" },
+        { "ba*d", "bd", "bd" },
+        { "colou?r", "color", "color" },
+        { "(cat|dog)s", "hotdogs", "dogs" },
+        { "[0-9]+ms", "took 123ms", "123ms" },
+        { "\\d+\\.\\d+", "version 10.25 now", "10.25" },
+        { "[^ ]+$", "last word", "word" },
+        { "^last", "last word", "last" },
+        { "^word", "last word", NULL },
+        { "\\w+@\\w+", "mail me@host.com", "me@host" },
+        { "h.j", "hæj", "hæj" },
+        { "[]x]+", "a]x]b", "]x]" },
+        { "E\\d{0}", "E1", NULL },  // Braces aren't special.
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct regex re;
+        CuAssertTrue(tc, regex_compile((const uint8_t *) cases[i].pattern,
+                                       strlen(cases[i].pattern),
+                                       &re));
+        size_t start = 0;
+        size_t end = 0;
+        bool found = regex_search(&re,
+                                  (const uint8_t *) cases[i].text,
+                                  strlen(cases[i].text),
+                                  0,
+                                  &start,
+                                  &end);
+        if (cases[i].expected == NULL) {
+            CuAssertTrue(tc, !found);
+        } else {
+            CuAssertTrue(tc, found);
+            CuAssertIntEquals(tc, strlen(cases[i].expected), end - start);
+            CuAssertBytesEquals(tc,
+                                (unsigned char *) cases[i].expected,
+                                (unsigned char *) cases[i].text + start,
+                                end - start);
+        }
+        regex_free(&re);
+    }
+}
+
+void test_regex_invalid(CuTest *tc) {
+    const char *patterns[] = {
+        "(abc", "abc)", "*a", "[abc", "a**|", "x*", "", "^$", "a|",
+    };
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        struct regex re;
+        CuAssertTrue(tc, !regex_compile((const uint8_t *) patterns[i],
+                                        strlen(patterns[i]),
+                                        &re));
+    }
+}
+
+// Searching from somewhere in the middle, and ^ only matching at the start.
+void test_regex_from(CuTest *tc) {
+    struct regex re;
+    const char *pattern = "(^x|y)ab";
+    CuAssertTrue(tc, regex_compile((const uint8_t *) pattern,
+                                   strlen(pattern),
+                                   &re));
+    const uint8_t *text = (const uint8_t *) "xab xab yab";
+    size_t start = 0;
+    size_t end = 0;
+    CuAssertTrue(tc, regex_search(&re, text, 11, 0, &start, &end));
+    CuAssertIntEquals(tc, 0, start);
+    CuAssertTrue(tc, regex_search(&re, text, 11, 1, &start, &end));
+    CuAssertIntEquals(tc, 8, start);
+    CuAssertIntEquals(tc, 11, end);
+    CuAssertTrue(tc, !regex_search(&re, text, 11, 9, &start, &end));
+    regex_free(&re);
+}
+
+// Lots of states, more than fit in the DFA, still give the right answer.
+void test_regex_many_states(CuTest *tc) {
+    struct regex re;
+    const char *pattern = "[ab]*a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]c";
+    CuAssertTrue(tc, regex_compile((const uint8_t *) pattern,
+                                   strlen(pattern),
+                                   &re));
+
+    uint8_t text[5000];
+    uint32_t x = 1;
+    for (size_t i = 0; i < sizeof(text); i++) {
+        x = x * 1103515245 + 12345;
+        text[i] = (x >> 16) % 2 ? 'a' : 'b';
+    }
+    memcpy(text + 4000, "abbbbbbbbbbc", 12);
+
+    size_t start = 0;
+    size_t end = 0;
+    CuAssertTrue(tc, regex_search(&re, text, sizeof(text), 0, &start, &end));
+    CuAssertIntEquals(tc, 4012, end);
+    CuAssertTrue(tc, re.unanchored.nstates <= REGEX_MAX_DFA_STATES);
+    regex_free(&re);
+}
+
+CuSuite *regex_test_suite() {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_regex_match);
+    SUITE_ADD_TEST(suite, test_regex_invalid);
+    SUITE_ADD_TEST(suite, test_regex_from);
+    SUITE_ADD_TEST(suite, test_regex_many_states);
+    return suite;
+}
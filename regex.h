@@ -0,0 +1,106 @@
+#ifndef INCLUDED_REGEX_H
+#define INCLUDED_REGEX_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "./CuTest.h"
+
+/*
+  A small regular expression engine for searching the scrollback buffer, see
+  `termbuf_search_regex`. It supports
+
+      abc     literal text, UTF-8 included
+      .       any character
+      [a-z]   character classes, [^...] too, ASCII only
+      \d \w \s and \D \W \S
+      ^ $     the start and end of the text
+      ( | )   grouping and alternation
+      * + ?   repetition
+
+  and ignores case unless the pattern has upper case letters in it, same as
+  the literal search. Patterns that match the empty string are refused, they
+  would match everywhere.
+
+  The pattern is compiled into an NFA the usual way (Thompson's construction)
+  over bytes. The NFA is then run as a DFA that's built lazily: Each DFA state
+  is a set of NFA states, and the transitions out of it are computed the first
+  time they're needed and then remembered. There are at most
+  REGEX_MAX_DFA_STATES of them, when they run out we start over from scratch,
+  so memory use doesn't depend on how much text is searched.
+
+  To find a match we first run the DFA unanchored, as if the pattern started
+  with .*, which tells us where the earliest match ends or that there is none,
+  which is by far the most common outcome. Only then do we look for where the
+  match starts, by running the anchored DFA from each position in turn.
+ */
+
+#define REGEX_MAX_DFA_STATES 1024
+
+enum regex_op {
+    REGEX_RANGE,  // Consume a byte in `lo` through `hi`.
+    REGEX_SPLIT,  // Continue at both `out` and `out1`.
+    REGEX_EMPTY,  // Continue at `out`.
+    REGEX_BEGIN,  // Continue at `out` if we're at the start of the text.
+    REGEX_END,    // Continue at `out` if we're at the end of the text.
+    REGEX_MATCH,
+};
+
+struct regex_nfa_state {
+    uint8_t op;
+    uint8_t lo;
+    uint8_t hi;
+    int out;
+    int out1;
+};
+
+struct regex_dfa_state {
+    int *set;  // The NFA states, sorted.
+    int nset;
+    // The next state shifted left by one, with the lowest bit set if it's a
+    // match. -1 until it's been computed.
+    int next[256];
+    bool match;
+    int8_t match_at_end;  // -1 until it's been computed.
+};
+
+struct regex_dfa {
+    bool unanchored;
+    struct regex_dfa_state *states;
+    int nstates;
+    int *table;  // A hash table of indices into `states`, -1 if unused.
+    int start[2];  // Indexed by whether we're at the start of the text.
+};
+
+struct regex {
+    struct regex_nfa_state *nfa;
+    int nnfa;
+    int nfa_capacity;
+    int start;
+    bool ignore_case;
+    bool first_bytes[256];  // The bytes that a match can start with.
+    struct regex_dfa anchored;
+    struct regex_dfa unanchored;
+    // Scratch space for computing sets of NFA states.
+    int *stack;
+    int *set;
+    uint32_t *marks;
+    uint32_t mark;
+};
+
+// Returns false if the pattern isn't valid, or if it matches the empty string.
+bool regex_compile(const uint8_t *pattern, size_t len, struct regex *re_ret);
+void regex_free(struct regex *re);
+// Find the leftmost longest match in `text` that starts at `from` or later,
+// the match is the bytes `*start_ret` through `*end_ret - 1`.
+bool regex_search(struct regex *re,
+                  const uint8_t *text,
+                  size_t len,
+                  size_t from,
+                  size_t *start_ret,
+                  size_t *end_ret);
+
+CuSuite *regex_test_suite();
+
+#endif /* INCLUDED_REGEX_H */
@@ -1,4 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <assert.h>
 
@@ -41,26 +45,1037 @@ GLuint     gl_vao;
 GLuint     gl_vbo;
 GLuint     shaderprogram;
 
+GLuint     gl_instance_vbo;
+
 struct s_uniform_locations {
     GLint cell_width;
     GLint cell_height;
+    GLint nrows;
+    GLint ncols;
+    GLint descent;
+} uniform_locations;
+
+
+
+/////////////////////
+// CELL INSTANCING //
+/////////////////////
+
+
+
+/*
+  Issuing a glViewport, a bunch of glUniform's and a glDrawArrays for every
+  single cell means that the time it takes to render a frame is dominated by
+  the overhead of talking to the driver. Instead `rendering_render_cell` only
+  appends a `struct cell_instance` describing the cell to `instances`, and then
+  `rendering_flush` uploads all of them in one go and draws every cell with a
+  single instanced draw call. The vertex shader then places each instance of the
+  cell quad at the right position on the screen.
+
+  The instances are written straight into `gl_instance_vbo`, which is mapped
+  persistently and coherently, so there's no copy to make and nothing for the
+  driver to synchronize when we draw. The buffer is split into
+  INSTANCE_REGIONS regions of `instances_capacity` instances, and each frame
+  fills the next region, while the GPU may still be reading the previous
+  frames' regions. A fence is put after the last draw from a region, and
+  before writing into a region again we wait for its fence, which with three
+  regions the GPU has almost always passed already.
+
+  If a frame needs more instances than a region has room for, what we have so
+  far is drawn, and then we wait for the GPU to finish with everything so that
+  the buffer can be replaced with one twice as big.
+ */
+
+struct cell_instance {
+    GLshort col;             // 1-indexed.
+    GLshort row;             // 1-indexed.
+    // The rectangle in the glyph atlas that holds this cell's glyph.
+    GLshort atlas_x;
+    GLshort atlas_y;
+    GLshort bitmap_width;
+    GLshort bitmap_height;
+    GLshort bitmap_xoffset;
+    GLshort bitmap_yoffset;
+    GLubyte fg[3];
+    GLubyte bg[3];
+};
+
+#define INSTANCE_REGIONS 3
+#define INSTANCE_INITIAL_CAPACITY 4096
+
+// All of `gl_instance_vbo`, mapped.
+static struct cell_instance *instances;
+static size_t instances_capacity;  // Per region.
+// The region written to this frame, the number of instances in it and how
+// many of them have been drawn.
+static int instances_region;
+static size_t instances_len;
+static size_t instances_drawn;
+// Whether we've waited for the GPU to be done with `instances_region`.
+static bool instances_region_ready;
+// Put after the last draw from each region, or 0.
+static GLsync instances_fences[INSTANCE_REGIONS];
+
+// Whether the grid renderer is used instead, see GRID RENDERING.
+static bool grid_mode;
+// Set when the atlas is reset, the grid is then out of date.
+static bool grid_atlas_reset;
+// How many times `grid_flush` looks the glyphs up again when doing so resets
+// the atlas again.
+#define GRID_ATLAS_RESET_TRIES 3
+
+// Wait for the GPU to be done with a region of the instance buffer.
+static void instances_wait(int region) {
+    if (instances_fences[region] == 0) {
+        return;
+    }
+
+    for (;;) {
+        GLenum ret = glClientWaitSync(instances_fences[region],
+                                      GL_SYNC_FLUSH_COMMANDS_BIT,
+                                      1000000000);  // Nanoseconds.
+        if (ret == GL_ALREADY_SIGNALED || ret == GL_CONDITION_SATISFIED) {
+            break;
+        }
+        if (ret == GL_WAIT_FAILED) {
+            assert(false);
+        }
+    }
+    glDeleteSync(instances_fences[region]);
+    instances_fences[region] = 0;
+}
+
+// (Re)create the instance buffer with room for `capacity` instances per
+// region. The GPU has to be done with the old one.
+static void instances_allocate(size_t capacity) {
+    if (instances != NULL) {
+        glBindBuffer(GL_ARRAY_BUFFER, gl_instance_vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glDeleteBuffers(1, &gl_instance_vbo);
+    }
+
+    instances_capacity = capacity;
+    const GLbitfield flags = GL_MAP_WRITE_BIT
+                             | GL_MAP_PERSISTENT_BIT
+                             | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr size = INSTANCE_REGIONS * instances_capacity
+                            * sizeof(struct cell_instance);
+
+    glGenBuffers(1, &gl_instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, gl_instance_vbo);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    instances = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    if (instances == NULL) {
+        assert(false);
+    }
+
+    // The per-cell attributes, these advance once per instance rather than
+    // once per vertex. They point at the start of the buffer, the region is
+    // picked with the base instance when drawing.
+    const GLsizei stride = sizeof(struct cell_instance);
+    glVertexAttribIPointer(1, 2, GL_SHORT, stride,
+                           (void *) offsetof(struct cell_instance, col));
+    glVertexAttribIPointer(2, 4, GL_SHORT, stride,
+                           (void *) offsetof(struct cell_instance, atlas_x));
+    glVertexAttribIPointer(3, 2, GL_SHORT, stride,
+                           (void *) offsetof(struct cell_instance,
+                                             bitmap_xoffset));
+    glVertexAttribPointer(4, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (void *) offsetof(struct cell_instance, fg));
+    glVertexAttribPointer(5, 3, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+                          (void *) offsetof(struct cell_instance, bg));
+    for (int i = 1; i <= 5; i++) {
+        glVertexAttribDivisor(i, 1);
+        glEnableVertexAttribArray(i);
+    }
+
+    instances_region = 0;
+    instances_len = 0;
+    instances_drawn = 0;
+    instances_region_ready = true;
+}
+
+// Get room for one more instance in this frame's region.
+static struct cell_instance *instances_next(void) {
+    if (!instances_region_ready) {
+        instances_wait(instances_region);
+        instances_region_ready = true;
+    }
+
+    if (instances_len == instances_capacity) {
+        rendering_flush();
+        instances_fences[instances_region] =
+            glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        for (int i = 0; i < INSTANCE_REGIONS; i++) {
+            instances_wait(i);
+        }
+        instances_allocate(2 * instances_capacity);
+    }
+
+    return &instances[instances_region * instances_capacity
+                      + instances_len ++];
+}
+
+
+
+/////////////////
+// GLYPH ATLAS //
+/////////////////
+
+
+
+/*
+  Rasterizing a glyph with stb_truetype and uploading it to the GPU is by far
+  the most expensive thing we do when rendering a cell, and the same handful of
+  glyphs are rendered over and over again. So instead of doing it every time we
+  rasterize every (glyph, size, style) once and pack the bitmap into one big
+  texture, the "atlas". Rendering a cell then amounts to telling the shader
+  where in the atlas the cell's glyph is.
+
+  The glyphs are packed using "shelves": we fill the atlas from left to right
+  with glyphs, and when a glyph doesn't fit on the current row (shelf) we start
+  a new shelf right above the tallest glyph on the current one. Since all of
+  our glyphs are roughly the same size this wastes very little space.
+
+  On the CPU side we keep a hash table (open addressing, linear probing) from
+  (glyph, size, style) to where in the atlas the bitmap is. If either the atlas
+  or the table fills up we simply throw everything away and start over, the
+  glyphs that are needed will be rasterized again the next time they're
+  rendered.
+ */
+
+#define ATLAS_WIDTH 1024
+#define ATLAS_HEIGHT 1024
+#define ATLAS_PADDING 1
+// Must be a power of two.
+#define ATLAS_TABLE_SIZE 4096
+// We start over when the table is this full, to keep the probe sequences short.
+#define ATLAS_TABLE_MAX_LOAD (ATLAS_TABLE_SIZE / 2)
+
+// The cell flags that (potentially) change how a glyph is rasterized. We only
+// have one font face right now so these don't actually make a difference, but
+// the cache is keyed on them so that bold and italic faces can be added later.
+#define ATLAS_STYLE_MASK (FLAG_BOLD | FLAG_ITALIC)
+
+struct atlas_entry {
+    bool     occupied;
+    uint32_t glyph_index;
+    uint16_t size;         // The pixel height the glyph was rasterized at.
+    uint16_t style;        // See ATLAS_STYLE_MASK.
+    // Where in the atlas the bitmap is.
+    int      x;
+    int      y;
+    // The same things that stbtt_GetGlyphBitmap gives us.
+    int      width;
+    int      height;
+    int      xoffset;
+    int      yoffset;
+};
+
+static struct atlas_entry atlas_table[ATLAS_TABLE_SIZE];
+static int atlas_table_count;
+
+// The shelf we're currently filling.
+static int atlas_shelf_x;
+static int atlas_shelf_y;
+static int atlas_shelf_height;
+
+static void atlas_reset(void) {
+    memset(atlas_table, 0, sizeof(atlas_table));
+    atlas_table_count = 0;
+    atlas_shelf_x = 0;
+    atlas_shelf_y = 0;
+    atlas_shelf_height = 0;
+}
+
+static uint32_t atlas_hash(uint32_t glyph_index, uint16_t size, uint16_t style) {
+    // FNV-1a like mixing of the three parts of the key.
+    uint32_t h = 2166136261u;
+    h = (h ^ glyph_index) * 16777619u;
+    h = (h ^ size) * 16777619u;
+    h = (h ^ style) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+// Finds a place in the atlas for a bitmap of the given size, returns false if
+// there is no room left.
+static bool atlas_pack(int width, int height, int *x_ret, int *y_ret) {
+    assert(width + ATLAS_PADDING <= ATLAS_WIDTH);
+    assert(height + ATLAS_PADDING <= ATLAS_HEIGHT);
+
+    // Doesn't fit on the current shelf, start a new one.
+    if (atlas_shelf_x + width + ATLAS_PADDING > ATLAS_WIDTH) {
+        atlas_shelf_x = 0;
+        atlas_shelf_y += atlas_shelf_height;
+        atlas_shelf_height = 0;
+    }
+
+    if (atlas_shelf_y + height + ATLAS_PADDING > ATLAS_HEIGHT) {
+        return false;
+    }
+
+    *x_ret = atlas_shelf_x;
+    *y_ret = atlas_shelf_y;
+
+    atlas_shelf_x += width + ATLAS_PADDING;
+    if (height + ATLAS_PADDING > atlas_shelf_height) {
+        atlas_shelf_height = height + ATLAS_PADDING;
+    }
+    return true;
+}
+
+// Look up a glyph in the atlas, rasterizing and uploading it if it isn't there
+// already.
+static struct atlas_entry *atlas_get(uint32_t glyph_index, uint16_t style) {
+    const uint16_t size = cell_height;
+    style &= ATLAS_STYLE_MASK;
+
+    uint32_t i = atlas_hash(glyph_index, size, style) & (ATLAS_TABLE_SIZE - 1);
+    while (atlas_table[i].occupied) {
+        struct atlas_entry *e = atlas_table + i;
+        if (e->glyph_index == glyph_index
+            && e->size == size
+            && e->style == style) {
+            return e;
+        }
+        i = (i + 1) & (ATLAS_TABLE_SIZE - 1);
+    }
+
+    // It's not in the atlas, so rasterize it.
+
+    if (stbtt_IsGlyphEmpty(&font_info, glyph_index) != 0) {
+        assert(false);
+    }
+
+    int width, height, xoffset, yoffset;
+    unsigned char *bitmap = stbtt_GetGlyphBitmap(&font_info,
+                                                 font_scale,
+                                                 font_scale,
+                                                 glyph_index,
+                                                 &width,
+                                                 &height,
+                                                 &xoffset,
+                                                 &yoffset);
+    if (bitmap == NULL) {
+        assert(false);
+    }
+
+    int x, y;
+    if (atlas_table_count >= ATLAS_TABLE_MAX_LOAD
+        || !atlas_pack(width, height, &x, &y)) {
+        // We're full, start over. The cells we've batched up so far refer to
+        // glyphs in the atlas as it looks right now so draw them first, or
+        // with the grid renderer look them up again before the next frame.
+        // Since we reset the table the slot we found above isn't necessarily
+        // the right one anymore.
+        if (grid_mode) {
+            grid_atlas_reset = true;
+        } else {
+            rendering_flush();
+        }
+        atlas_reset();
+        stbtt_FreeBitmap(bitmap, NULL);
+        return atlas_get(glyph_index, style);
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D,    // target
+                    0,                // level
+                    x,                // xoffset
+                    y,                // yoffset
+                    width,            // width
+                    height,           // height
+                    GL_RED,           // format
+                    GL_UNSIGNED_BYTE, // type
+                    bitmap);          // data
+
+    stbtt_FreeBitmap(bitmap, NULL);
+
+    atlas_table[i] = (struct atlas_entry) {
+        .occupied = true,
+        .glyph_index = glyph_index,
+        .size = size,
+        .style = style,
+        .x = x,
+        .y = y,
+        .width = width,
+        .height = height,
+        .xoffset = xoffset,
+        .yoffset = yoffset,
+    };
+    atlas_table_count ++;
+
+    return atlas_table + i;
+}
+
+
+
+///////////////////
+// SHAPING CACHE //
+///////////////////
+
+
+
+/*
+  Every cell holds a single codepoint, so all that shaping it with harfbuzz
+  does for us is map the codepoint to a glyph index in the font. That mapping
+  never changes for a given font, yet setting up the buffer and calling
+  hb_shape for every cell on every frame costs more than everything else we do
+  for a cell. So we remember what each codepoint shaped to.
+
+  ASCII and Latin-1, which is what most cells are, go in a table indexed
+  directly by the codepoint. Everything else goes in a hash table (open
+  addressing, linear probing) which, like the atlas table, is thrown away when
+  it gets too full. Glyph indices don't depend on the size of the font, so
+  both tables are only cleared when the font changes.
+ */
+
+#define SHAPING_DIRECT_SIZE 256
+// Must be a power of two.
+#define SHAPING_TABLE_SIZE 4096
+#define SHAPING_TABLE_MAX_LOAD (SHAPING_TABLE_SIZE / 2)
+
+// The glyph index plus one, 0 for codepoints that haven't been shaped yet.
+static uint32_t shaping_direct[SHAPING_DIRECT_SIZE];
+
+struct shaping_entry {
+    uint32_t codepoint;    // 0 if the entry is free, 0 is in the direct table.
+    uint32_t glyph_index;
+};
+
+static struct shaping_entry shaping_table[SHAPING_TABLE_SIZE];
+static int shaping_table_count;
+
+static void shaping_reset(void) {
+    memset(shaping_direct, 0, sizeof(shaping_direct));
+    memset(shaping_table, 0, sizeof(shaping_table));
+    shaping_table_count = 0;
+}
+
+// The codepoint of the `len` bytes long UTF-8 sequence in `utf8`.
+static uint32_t shaping_decode(const uint8_t *utf8, int len) {
+    switch (len) {
+    case 1:
+        return utf8[0];
+    case 2:
+        return (utf8[0] & 0x1F) << 6 | (utf8[1] & 0x3F);
+    case 3:
+        return (utf8[0] & 0x0F) << 12 | (utf8[1] & 0x3F) << 6
+            | (utf8[2] & 0x3F);
+    default:
+        return (utf8[0] & 0x07) << 18 | (utf8[1] & 0x3F) << 12
+            | (utf8[2] & 0x3F) << 6 | (utf8[3] & 0x3F);
+    }
+}
+
+static uint32_t shaping_hash(uint32_t codepoint) {
+    // Knuth's multiplicative hashing, codepoints that are close together are
+    // common and shouldn't end up next to each other.
+    return (codepoint * 2654435761u) >> 20 & (SHAPING_TABLE_SIZE - 1);
+}
+
+// Actually shape the `len` bytes long UTF-8 sequence in `utf8`.
+static uint32_t shape(const uint8_t *utf8, int len) {
+    // Hardcode the direction, script and language.
+    hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
+    hb_buffer_set_script(buf, HB_SCRIPT_LATIN);
+    hb_buffer_set_language(buf, hb_language_from_string("en", -1));
+
+    hb_buffer_add_utf8(buf, (const char *) utf8, len, 0, len);
+
+    hb_shape(font, buf, NULL, 0);
+
+    assert(hb_buffer_get_length(buf) == 1);
+
+    hb_glyph_info_t *info = hb_buffer_get_glyph_infos(buf, NULL);
+    uint32_t glyph_index = info->codepoint;
+    hb_buffer_clear_contents(buf);
+
+    return glyph_index;
+}
+
+// Look up the glyph index of the `len` bytes long UTF-8 sequence in `utf8`,
+// shaping it if we haven't already.
+static uint32_t shaping_get(const uint8_t *utf8, int len) {
+    uint32_t codepoint = shaping_decode(utf8, len);
+
+    if (codepoint < SHAPING_DIRECT_SIZE) {
+        if (shaping_direct[codepoint] == 0) {
+            shaping_direct[codepoint] = shape(utf8, len) + 1;
+        }
+        return shaping_direct[codepoint] - 1;
+    }
+
+    uint32_t i = shaping_hash(codepoint);
+    while (shaping_table[i].codepoint != 0) {
+        if (shaping_table[i].codepoint == codepoint) {
+            return shaping_table[i].glyph_index;
+        }
+        i = (i + 1) & (SHAPING_TABLE_SIZE - 1);
+    }
+
+    uint32_t glyph_index = shape(utf8, len);
+
+    // We're full, start over. The direct table can't fill up so it's kept.
+    if (shaping_table_count >= SHAPING_TABLE_MAX_LOAD) {
+        memset(shaping_table, 0, sizeof(shaping_table));
+        shaping_table_count = 0;
+        i = shaping_hash(codepoint);
+    }
+
+    shaping_table[i] = (struct shaping_entry) {
+        .codepoint = codepoint,
+        .glyph_index = glyph_index,
+    };
+    shaping_table_count ++;
+
+    return glyph_index;
+}
+
+
+
+/////////////////
+// ROW SHAPING //
+/////////////////
+
+
+
+/*
+  Shaping one cell at a time can't give us ligatures, for that harfbuzz has to
+  see the cells next to each other. So rows are shaped as a whole: the row is
+  broken up into runs of non-blank cells with the same style, and each run is
+  shaped with one call to hb_shape.
+
+  The glyphs that come out don't have to line up with the cells. A ligature
+  can be one wide glyph for several cells, and fonts like Fira Code instead
+  keep one glyph per cell but let them reach into the cells next to them. We
+  still draw one instance per cell, so each cell gets the glyph whose ink
+  covers the most of it, shifted so that the part of it that's over the cell
+  ends up there. A glyph that covers several cells is then drawn a slice at a
+  time, each slice in the colors of its own cell.
+
+  Shaping a whole row is a lot more work than looking up a codepoint in the
+  shaping cache, but most rows that are drawn have been drawn before. So the
+  layout of each row, which glyph each cell got and how it's shifted, is kept
+  in a cache keyed by a hash of what in the row affects shaping: the text and
+  the style, but not the colors. The cache is direct mapped, a row just
+  replaces whatever layout was in its slot. It's cleared when the font or its
+  size changes.
+ */
+
+// Must be a power of two.
+#define ROW_CACHE_SIZE 1024
+
+struct cell_glyph {
+    bool     empty;         // Nothing to draw but the background.
+    uint32_t glyph_index;
+    int16_t  shift;         // How far right of the cell the glyph's origin is.
+};
+
+struct row_layout {
+    uint64_t hash;
+    int ncells;             // -1 if the slot is free.
+    struct cell_glyph *glyphs;
+    int capacity;
+};
+
+static struct row_layout row_cache[ROW_CACHE_SIZE];
+
+// A run's text is put together here, along with which of its cells each byte
+// came from and the best overlap for each cell found so far.
+static uint8_t *run_text;
+static int *run_byte_cells;
+static int *run_overlaps;
+static int run_capacity;  // In cells.
+
+static void row_cache_reset(void) {
+    for (int i = 0; i < ROW_CACHE_SIZE; i++) {
+        row_cache[i].ncells = -1;
+    }
+}
+
+static bool is_blank(const struct termbuf_char *c) {
+    int len = c->flags & FLAG_LENGTH_MASK;
+    return len == 0 || (len == 1 && c->utf8_char[0] == ' ');
+}
+
+// The flags that matter for shaping, blanks break up runs but are never
+// shaped.
+static uint16_t shaping_flags(const struct termbuf_char *c) {
+    return c->flags & (FLAG_LENGTH_MASK | ATLAS_STYLE_MASK);
+}
+
+static uint64_t row_hash(const struct termbuf_char *cells, int ncells) {
+    // FNV-1a.
+    uint64_t h = 14695981039346656037u;
+    for (int i = 0; i < ncells; i++) {
+        uint16_t flags = is_blank(&cells[i]) ? 0 : shaping_flags(&cells[i]);
+        h = (h ^ (flags & 0xFF)) * 1099511628211u;
+        h = (h ^ (flags >> 8)) * 1099511628211u;
+        for (int j = 0; j < (flags & FLAG_LENGTH_MASK); j++) {
+            h = (h ^ cells[i].utf8_char[j]) * 1099511628211u;
+        }
+    }
+    return h;
+}
+
+// Lay out the run of cells `first` through `end - 1` into `glyphs`.
+static void layout_run(const struct termbuf_char *cells,
+                       int first,
+                       int end,
+                       struct cell_glyph *glyphs) {
+    // A cell on its own is laid out just like `rendering_render_cell` does.
+    if (end - first == 1) {
+        const struct termbuf_char *c = &cells[first];
+        uint32_t glyph_index = shaping_get(c->utf8_char,
+                                           c->flags & FLAG_LENGTH_MASK);
+        glyphs[first] = (struct cell_glyph) {
+            .empty = stbtt_IsGlyphEmpty(&font_info, glyph_index) != 0,
+            .glyph_index = glyph_index,
+            .shift = 0,
+        };
+        return;
+    }
+
+    if (end - first > run_capacity) {
+        run_capacity = end - first;
+        run_text = realloc(run_text, 4 * run_capacity);
+        run_byte_cells = realloc(run_byte_cells,
+                                 4 * run_capacity * sizeof(int));
+        run_overlaps = realloc(run_overlaps, run_capacity * sizeof(int));
+        if (run_text == NULL || run_byte_cells == NULL
+            || run_overlaps == NULL) {
+            assert(false);
+        }
+    }
+
+    int len = 0;
+    for (int i = first; i < end; i++) {
+        int n = cells[i].flags & FLAG_LENGTH_MASK;
+        memcpy(run_text + len, cells[i].utf8_char, n);
+        for (int j = 0; j < n; j++) {
+            run_byte_cells[len + j] = i;
+        }
+        len += n;
+
+        glyphs[i].empty = true;
+        run_overlaps[i - first] = 0;
+    }
+
+    // Hardcode the direction, script and language.
+    hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
+    hb_buffer_set_script(buf, HB_SCRIPT_LATIN);
+    hb_buffer_set_language(buf, hb_language_from_string("en", -1));
+
+    hb_buffer_add_utf8(buf, (const char *) run_text, len, 0, len);
+
+    hb_shape(font, buf, NULL, 0);
+
+    unsigned int nglyphs;
+    hb_glyph_info_t *info = hb_buffer_get_glyph_infos(buf, &nglyphs);
+    hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(buf, NULL);
+
+    // The pen starts over at the cell of each cluster, the advances of the
+    // font don't quite add up to our cell width.
+    float pen = 0;
+    int last_cluster = -1;
+    for (unsigned int k = 0; k < nglyphs; k++) {
+        int cell = run_byte_cells[info[k].cluster] - first;
+        if ((int) info[k].cluster != last_cluster) {
+            pen = cell * cell_width;
+            last_cluster = info[k].cluster;
+        }
+        int origin = (int) floorf(pen + pos[k].x_offset * font_scale);
+        pen += pos[k].x_advance * font_scale;
+
+        int x0, y0, x1, y1;
+        stbtt_GetGlyphBitmapBox(&font_info, info[k].codepoint, font_scale,
+                                font_scale, &x0, &y0, &x1, &y1);
+        if (x1 <= x0 || y1 <= y0) {
+            continue;
+        }
+
+        // Give it to the cells it covers more of than any glyph before it.
+        int left = origin + x0;
+        int right = origin + x1;
+        for (int i = left > 0 ? left / cell_width : 0;
+             i < end - first && i * cell_width < right;
+             i++) {
+            int from = left > i * cell_width ? left : i * cell_width;
+            int to = right < (i + 1) * cell_width
+                     ? right
+                     : (i + 1) * cell_width;
+            if (to - from > run_overlaps[i]) {
+                run_overlaps[i] = to - from;
+                glyphs[first + i] = (struct cell_glyph) {
+                    .empty = false,
+                    .glyph_index = info[k].codepoint,
+                    .shift = origin - i * cell_width,
+                };
+            }
+        }
+    }
+
+    hb_buffer_clear_contents(buf);
+}
+
+// Get the layout of a row of `ncells` cells, laying it out if it isn't in the
+// cache. Only valid until the next call.
+static const struct cell_glyph *row_layout_get(const struct termbuf_char *cells,
+                                               int ncells) {
+    uint64_t hash = row_hash(cells, ncells);
+    struct row_layout *layout = &row_cache[hash & (ROW_CACHE_SIZE - 1)];
+    if (layout->ncells == ncells && layout->hash == hash) {
+        return layout->glyphs;
+    }
+
+    if (ncells > layout->capacity) {
+        layout->capacity = ncells;
+        layout->glyphs = realloc(layout->glyphs,
+                                 ncells * sizeof(struct cell_glyph));
+        if (layout->glyphs == NULL) {
+            assert(false);
+        }
+    }
+    layout->hash = hash;
+    layout->ncells = ncells;
+
+    int first = 0;
+    while (first < ncells) {
+        if (is_blank(&cells[first])) {
+            layout->glyphs[first].empty = true;
+            first ++;
+            continue;
+        }
+
+        int end = first + 1;
+        uint16_t style = cells[first].flags & ATLAS_STYLE_MASK;
+        while (end < ncells && !is_blank(&cells[end])
+               && (cells[end].flags & ATLAS_STYLE_MASK) == style) {
+            end ++;
+        }
+        layout_run(cells, first, end, layout->glyphs);
+        first = end;
+    }
+
+    return layout->glyphs;
+}
+
+
+
+////////////////////
+// GRID RENDERING //
+////////////////////
+
+
+
+/*
+  The grid renderer, enabled with `rendering_initialize`, doesn't draw cells
+  as instances. The renderer instead keeps a copy of every cell on the screen
+  in `grid`, with what would have gone in its `struct cell_instance` minus the
+  position, and mirrors it into `gl_gridtexture`. That's an integer texture
+  with two texels per cell and one row of texels per row of cells. Every
+  frame is then a single quad covering the whole window, and the fragment
+  shader finds the cell under the pixel in the grid texture and the cell's
+  glyph in the atlas. Rendering a cell is just writing to `grid`, and only the
+  rows written to since the last frame are uploaded, with one
+  glTexSubImage2D.
+
+  The GPU does the same amount of work every frame no matter how much
+  changed, but it's a small amount of work, and it doesn't grow with the
+  number of cells the way a draw call with an instance per cell does.
+
+  The atlas positions in the grid have to stay valid for as long as the cells
+  are on the screen, which can be much longer than a frame. So when the atlas
+  is reset every cell in the grid is looked up in it again, that's why
+  `grid_glyphs` keeps the glyph of each cell.
+ */
+
+struct grid_cell {
+    // The first texel, the rectangle in the atlas.
+    GLint atlas_x;
+    GLint atlas_y;
     GLint bitmap_width;
     GLint bitmap_height;
+    // The second texel.
     GLint bitmap_xoffset;
     GLint bitmap_yoffset;
-    GLint descent;
-    GLint fg_color;
-    GLint bg_color;
-} uniform_locations;
+    GLint fg;  // 0xRRGGBB
+    GLint bg;
+};
+
+struct grid_glyph {
+    bool     empty;
+    uint32_t glyph_index;
+    uint16_t style;
+    int16_t  shift;
+};
+
+GLuint     gl_gridtexture;
+GLuint     gl_grid_vao;
+
+// `nrows * ncols` of each, row by row.
+static struct grid_cell *grid;
+static struct grid_glyph *grid_glyphs;
+// The rows that have changed since they were last uploaded, 0-indexed and
+// inclusive. `grid_dirty_first > grid_dirty_last` if none have.
+static int grid_dirty_first;
+static int grid_dirty_last;
+
+static void grid_set_atlas(struct grid_cell *cell,
+                           const struct atlas_entry *glyph,
+                           int shift) {
+    cell->atlas_x = glyph->x;
+    cell->atlas_y = glyph->y;
+    cell->bitmap_width = glyph->width;
+    cell->bitmap_height = glyph->height;
+    cell->bitmap_xoffset = glyph->xoffset + shift;
+    cell->bitmap_yoffset = glyph->yoffset;
+}
+
+// Put a cell in the grid, the grid renderer's `push_instance`.
+static void grid_put(int row,
+                     int col,
+                     const struct atlas_entry *glyph,
+                     int shift,
+                     const struct termbuf_char *c) {
+    // The cursor can be just outside of the screen.
+    if (row < 1 || row > nrows || col < 1 || col > ncols) {
+        return;
+    }
+
+    int i = (row - 1) * ncols + col - 1;
+    grid_set_atlas(&grid[i], glyph, shift);
+    grid[i].fg = c->fg.r << 16 | c->fg.g << 8 | c->fg.b;
+    grid[i].bg = c->bg.r << 16 | c->bg.g << 8 | c->bg.b;
+    grid_glyphs[i] = (struct grid_glyph) {
+        .empty = !glyph->occupied,
+        .glyph_index = glyph->glyph_index,
+        .style = glyph->style,
+        .shift = shift,
+    };
+
+    grid_dirty_first = row - 1 < grid_dirty_first ? row - 1 : grid_dirty_first;
+    grid_dirty_last = row - 1 > grid_dirty_last ? row - 1 : grid_dirty_last;
+}
+
+// Make room for a `nrows` by `ncols` grid, with all cells empty. The cells
+// are kept if the grid already is that size, since nothing redraws them.
+static void grid_resize(void) {
+    static int grid_nrows = 0;
+    static int grid_ncols = 0;
+    if (nrows == grid_nrows && ncols == grid_ncols) {
+        return;
+    }
+    grid_nrows = nrows;
+    grid_ncols = ncols;
+
+    grid = realloc(grid, nrows * ncols * sizeof(struct grid_cell));
+    grid_glyphs = realloc(grid_glyphs,
+                          nrows * ncols * sizeof(struct grid_glyph));
+    if (grid == NULL || grid_glyphs == NULL) {
+        assert(false);
+    }
+    memset(grid, 0, nrows * ncols * sizeof(struct grid_cell));
+    memset(grid_glyphs, 0, nrows * ncols * sizeof(struct grid_glyph));
+    grid_dirty_first = nrows;
+    grid_dirty_last = -1;
+
+    glActiveTexture(GL_TEXTURE1);
+    glTexImage2D(GL_TEXTURE_2D,       // target
+                 0,                   // level
+                 GL_RGBA32I,          // internal format
+                 2 * ncols,           // width
+                 nrows,               // height
+                 0,                   // border
+                 GL_RGBA_INTEGER,     // format
+                 GL_INT,              // type
+                 grid);               // data
+    glActiveTexture(GL_TEXTURE0);
+}
+
+static void grid_flush(void) {
+    // Looking the glyphs up again can fill the atlas up and reset it once
+    // more, leaving the cells before that pointing into the old one, so start
+    // over until they all fit. If the glyphs on the screen can't all be in the
+    // atlas at once some cells are wrong until they're drawn again, give up on
+    // those rather than going around forever.
+    for (int tries = 0;
+         grid_atlas_reset && tries < GRID_ATLAS_RESET_TRIES;
+         tries++) {
+        grid_atlas_reset = false;
+        for (int i = 0; i < nrows * ncols; i++) {
+            if (!grid_glyphs[i].empty) {
+                grid_set_atlas(&grid[i],
+                               atlas_get(grid_glyphs[i].glyph_index,
+                                         grid_glyphs[i].style),
+                               grid_glyphs[i].shift);
+            }
+        }
+        grid_dirty_first = 0;
+        grid_dirty_last = nrows - 1;
+    }
+    grid_atlas_reset = false;
+
+    if (grid_dirty_first <= grid_dirty_last) {
+        glActiveTexture(GL_TEXTURE1);
+        glTexSubImage2D(GL_TEXTURE_2D,                          // target
+                        0,                                      // level
+                        0,                                      // xoffset
+                        grid_dirty_first,                       // yoffset
+                        2 * ncols,                              // width
+                        grid_dirty_last - grid_dirty_first + 1, // height
+                        GL_RGBA_INTEGER,                        // format
+                        GL_INT,                                 // type
+                        grid + grid_dirty_first * ncols);       // data
+        glActiveTexture(GL_TEXTURE0);
+        grid_dirty_first = nrows;
+        grid_dirty_last = -1;
+    }
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+
+
+//////////////////
+// PRESENTATION //
+//////////////////
+
+
+
+/*
+  With a single buffered window we draw straight to the screen, which is what
+  lets us only redraw the damaged cells, but it also means that a frame shows
+  up half drawn and that there's no vsync to keep it from tearing. So we ask
+  for a double buffered window, see `main`, and swap buffers at the end of
+  every frame.
+
+  After a swap the contents of the back buffer are undefined though, so
+  instead of drawing to it directly we draw to `gl_framebuffer`, a
+  framebuffer object that is never touched by anyone else and so keeps the
+  previous frame. At the end of the frame it's copied to the back buffer with
+  glBlitFramebuffer, which is a small fixed cost compared to drawing the
+  cells, and the back buffer is swapped in. The grid renderer redraws
+  everything every frame anyway and draws straight to the back buffer.
+
+  If the window ended up single buffered after all we draw straight to it and
+  glFlush at the end of the frame, like before.
+ */
+
+static bool double_buffered;
+GLuint     gl_framebuffer;  // 0 unless we draw to it, see above.
+GLuint     gl_renderbuffer;
+static int framebuffer_width;
+static int framebuffer_height;
+
+static void presentation_initialize(void) {
+    GLboolean doublebuffer;
+    glGetBooleanv(GL_DOUBLEBUFFER, &doublebuffer);
+    double_buffered = doublebuffer == GL_TRUE;
+
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (!double_buffered || grid_mode) {
+        return;
+    }
+
+    // The storage is allocated once we know the size of the grid.
+    glGenRenderbuffers(1, &gl_renderbuffer);
+    glGenFramebuffers(1, &gl_framebuffer);
+}
+
+// Give `gl_framebuffer` room for the whole grid, or keep it as it is if it
+// already is that size.
+static void presentation_resize(void) {
+    if (gl_framebuffer == 0) {
+        return;
+    }
+
+    int width = ncols * cell_width;
+    int height = nrows * cell_height;
+    if (width == framebuffer_width && height == framebuffer_height) {
+        return;
+    }
+    framebuffer_width = width;
+    framebuffer_height = height;
+
+    glBindRenderbuffer(GL_RENDERBUFFER, gl_renderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindFramebuffer(GL_FRAMEBUFFER, gl_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                              GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER,
+                              gl_renderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        assert(false);
+    }
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+// Get the frame onto the screen.
+static void present(void) {
+    if (!double_buffered) {
+        glFlush();
+        return;
+    }
+
+    if (gl_framebuffer != 0) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, framebuffer_width, framebuffer_height,
+                          0, 0, framebuffer_width, framebuffer_height,
+                          GL_COLOR_BUFFER_BIT,
+                          GL_NEAREST);
+    }
+
+    glXSwapBuffers(x_display, x_window);
+
+    // The grid doesn't cover all of the window, clear what's left over in
+    // the new back buffer.
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (gl_framebuffer != 0) {
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gl_framebuffer);
+    }
+}
+
+
+
+//////////////////
+// REST OF CODE //
+//////////////////
+
+
+
+
+// Compile the shaders and link them together.
+static GLuint link_program(const char *vertexsource,
+                           const char *fragmentsource) {
+    GLint vertexshader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexshader, 1, (const GLchar**)&vertexsource, 0);
+    glCompileShader(vertexshader);
+
+    GLint fragmentshader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentshader, 1, (const GLchar**)&fragmentsource, 0);
+    glCompileShader(fragmentshader);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexshader);
+    glAttachShader(program, fragmentshader);
+    glLinkProgram(program);
+    return program;
+}
 
 void rendering_initialize(Display *display,
                           int window,
                           GLXContext context,
-                          const char *ttf_path) {
+                          const char *ttf_path,
+                          bool grid_renderer) {
 
     x_display = display;
     x_window = window;
     gl_context = context;
+    grid_mode = grid_renderer;
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
@@ -72,99 +1087,197 @@ void rendering_initialize(Display *display,
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+    // Allocate the glyph atlas, glyphs are uploaded into it with
+    // glTexSubImage2D as they're needed.
+    glTexImage2D(GL_TEXTURE_2D,    // target
+                 0,                // level
+                 GL_R8,            // internal format
+                 ATLAS_WIDTH,      // width
+                 ATLAS_HEIGHT,     // height
+                 0,                // border
+                 GL_RED,           // format
+                 GL_UNSIGNED_BYTE, // type
+                 NULL);            // data
+    atlas_reset();
+
     glGenVertexArrays(1, &gl_vao);
     glBindVertexArray(gl_vao);
 
-    const GLfloat vertices[16] = {
-        -1.0,   1.0, 0.0, 0.0,
-        -1.0,  -1.0, 0.0, 1.0,
-         1.0,   1.0, 1.0, 0.0,
-         1.0,  -1.0, 1.0, 1.0,
+    // The corners of a cell, as fractions of the cell's width and height
+    // counting from the top left corner. Every cell is drawn as an instance of
+    // this quad, see `struct cell_instance`.
+    const GLfloat vertices[8] = {
+        0.0, 0.0,
+        0.0, 1.0,
+        1.0, 0.0,
+        1.0, 1.0,
     };
 
     glGenBuffers(1, &gl_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, gl_vbo);
     glBufferData(GL_ARRAY_BUFFER,
-                 16 * sizeof(GLfloat),
+                 8 * sizeof(GLfloat),
                  vertices,
                  GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
     glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+
+    instances_allocate(INSTANCE_INITIAL_CAPACITY);
 
     char *vertexsource = "#version 460 \n\
-        layout (location = 0) in vec2 in_position; \n\
-        layout (location = 1) in vec2 in_tex_coord; \n\
+        layout (location = 0) in vec2 in_corner; \n\
+        layout (location = 1) in ivec2 in_cell; \n\
+        layout (location = 2) in ivec4 in_atlas_rect; \n\
+        layout (location = 3) in ivec2 in_bitmap_offset; \n\
+        layout (location = 4) in vec3 in_fg_color; \n\
+        layout (location = 5) in vec3 in_bg_color; \n\
+        \n\
+        uniform int cell_width; \n\
+        uniform int cell_height; \n\
+        uniform int nrows; \n\
+        uniform int ncols; \n\
         \n\
         out vec2 tex_coord; \n\
+        flat out ivec4 atlas_rect; \n\
+        flat out ivec2 bitmap_offset; \n\
+        flat out vec3 fg_color; \n\
+        flat out vec3 bg_color; \n\
         \n\
         void main(void) { \n\
-            gl_Position = vec4(in_position, 0.0, 1.0); \n\
+            // Pixel coordinates of the corner, with the origin in the \n\
+            // bottom left corner of the screen like OpenGL wants it. \n\
+            vec2 pixel = vec2( \n\
+                (in_cell.x - 1 + in_corner.x) * cell_width, \n\
+                (nrows - in_cell.y + 1 - in_corner.y) * cell_height); \n\
+            vec2 screen = vec2(ncols * cell_width, nrows * cell_height); \n\
+            gl_Position = vec4(pixel / screen * 2.0 - 1.0, 0.0, 1.0); \n\
             \n\
-            tex_coord = in_tex_coord; \n\
+            tex_coord = in_corner; \n\
+            atlas_rect = in_atlas_rect; \n\
+            bitmap_offset = in_bitmap_offset; \n\
+            fg_color = in_fg_color; \n\
+            bg_color = in_bg_color; \n\
         }\n";
 
-    GLint vertexshader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertexshader, 1, (const GLchar**)&vertexsource, 0);
-    glCompileShader(vertexshader);
-
     char *fragmentsource = "#version 460 \n\
         precision highp float; \n\
         precision highp sampler2D; \n\
         \n\
         in vec2 tex_coord; \n\
+        flat in ivec4 atlas_rect; \n\
+        flat in ivec2 bitmap_offset; \n\
+        flat in vec3 fg_color; \n\
+        flat in vec3 bg_color; \n\
         \n\
         uniform sampler2D tex; \n\
         uniform int cell_width; \n\
         uniform int cell_height; \n\
-        uniform int bitmap_width; \n\
-        uniform int bitmap_height; \n\
-        uniform int bitmap_xoffset; \n\
-        uniform int bitmap_yoffset; \n\
         uniform int descent; \n\
-        uniform vec3 fg_color; \n\
-        uniform vec3 bg_color; \n\
         \n\
         layout(location = 0) out vec4 frag_color; \n\
         \n\
         void main(void) { \n\
-            //float intensity = texture(tex, tex_coord).r; \n\
             ivec2 pixel_xy = ivec2( \n\
                 floor(tex_coord * ivec2(cell_width, cell_height)) \n\
-                - ivec2(bitmap_xoffset, cell_height + bitmap_yoffset + descent) \n\
+                - ivec2(bitmap_offset.x, \n\
+                        cell_height + bitmap_offset.y + descent) \n\
             ); \n\
-            float intensity = texelFetch(tex, pixel_xy, 0).r; \n\
+            // Only sample the atlas inside of the glyph's bitmap, outside of \n\
+            // it lives other glyphs. \n\
+            float intensity = 0.0; \n\
+            if (pixel_xy.x >= 0 && pixel_xy.x < atlas_rect.z \n\
+                && pixel_xy.y >= 0 && pixel_xy.y < atlas_rect.w) { \n\
+                intensity = texelFetch(tex, atlas_rect.xy + pixel_xy, 0).r; \n\
+            } \n\
             // Is this a propper way to blend to fg and bg colors? \n\
             frag_color = vec4(intensity * fg_color \n\
                                 + (1 - intensity) * bg_color, \n\
                               1.0); \n\
         }";
 
-    GLint fragmentshader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentshader, 1, (const GLchar**)&fragmentsource, 0);
-    glCompileShader(fragmentshader);
+    // The grid renderer's quad covers the whole window, so its corners are
+    // the same as a cell's, just scaled up.
+    char *grid_vertexsource = "#version 460 \n\
+        layout (location = 0) in vec2 in_corner; \n\
+        \n\
+        void main(void) { \n\
+            gl_Position = vec4(in_corner * 2.0 - 1.0, 0.0, 1.0); \n\
+        }\n";
 
-    shaderprogram = glCreateProgram();
-    glAttachShader(shaderprogram, vertexshader);
-    glAttachShader(shaderprogram, fragmentshader);
-    glLinkProgram(shaderprogram);
+    char *grid_fragmentsource = "#version 460 \n\
+        precision highp float; \n\
+        precision highp sampler2D; \n\
+        precision highp isampler2D; \n\
+        \n\
+        uniform sampler2D tex; \n\
+        uniform isampler2D grid; \n\
+        uniform int cell_width; \n\
+        uniform int cell_height; \n\
+        uniform int nrows; \n\
+        uniform int descent; \n\
+        \n\
+        layout(location = 0) out vec4 frag_color; \n\
+        \n\
+        vec3 unpack_color(int rgb) { \n\
+            return vec3((rgb >> 16) & 255, (rgb >> 8) & 255, rgb & 255) \n\
+                   / 255.0; \n\
+        } \n\
+        \n\
+        void main(void) { \n\
+            // Pixel coordinates counting from the top left corner. \n\
+            ivec2 pixel = ivec2(gl_FragCoord.x, \n\
+                                nrows * cell_height - gl_FragCoord.y); \n\
+            ivec2 cell = pixel / ivec2(cell_width, cell_height); \n\
+            ivec4 rect = texelFetch(grid, ivec2(2 * cell.x, cell.y), 0); \n\
+            ivec4 rest = texelFetch(grid, ivec2(2 * cell.x + 1, cell.y), 0); \n\
+            \n\
+            // From here on it's the same as the instanced renderer. \n\
+            ivec2 pixel_xy = pixel - cell * ivec2(cell_width, cell_height) \n\
+                - ivec2(rest.x, cell_height + rest.y + descent); \n\
+            float intensity = 0.0; \n\
+            if (pixel_xy.x >= 0 && pixel_xy.x < rect.z \n\
+                && pixel_xy.y >= 0 && pixel_xy.y < rect.w) { \n\
+                intensity = texelFetch(tex, rect.xy + pixel_xy, 0).r; \n\
+            } \n\
+            frag_color = vec4(intensity * unpack_color(rest.z) \n\
+                                + (1 - intensity) * unpack_color(rest.w), \n\
+                              1.0); \n\
+        }";
+
+    if (grid_mode) {
+        shaderprogram = link_program(grid_vertexsource, grid_fragmentsource);
+
+        // Just the corners, no instances.
+        glGenVertexArrays(1, &gl_grid_vao);
+        glBindVertexArray(gl_grid_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, gl_vbo);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat),
+                              0);
+        glEnableVertexAttribArray(0);
+
+        // The grid texture lives in texture unit 1, it's allocated once we
+        // know the size of the grid.
+        glGenTextures(1, &gl_gridtexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gl_gridtexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glActiveTexture(GL_TEXTURE0);
+    } else {
+        shaderprogram = link_program(vertexsource, fragmentsource);
+    }
     glUseProgram(shaderprogram);
 
-    glBindAttribLocation(shaderprogram, 0, "in_position");
     glUniform1i(glGetUniformLocation(shaderprogram, "tex"), 0);
+    glUniform1i(glGetUniformLocation(shaderprogram, "grid"), 1);
 
 
     uniform_locations = (struct s_uniform_locations) {
         .cell_width = glGetUniformLocation(shaderprogram, "cell_width"),
         .cell_height = glGetUniformLocation(shaderprogram, "cell_height"),
-        .bitmap_width = glGetUniformLocation(shaderprogram, "bitmap_width"),
-        .bitmap_height = glGetUniformLocation(shaderprogram, "bitmap_height"),
-        .bitmap_xoffset = glGetUniformLocation(shaderprogram, "bitmap_xoffset"),
-        .bitmap_yoffset = glGetUniformLocation(shaderprogram, "bitmap_yoffset"),
+        .nrows = glGetUniformLocation(shaderprogram, "nrows"),
+        .ncols = glGetUniformLocation(shaderprogram, "ncols"),
         .descent = glGetUniformLocation(shaderprogram, "descent"),
-        .fg_color = glGetUniformLocation(shaderprogram, "fg_color"),
-        .bg_color = glGetUniformLocation(shaderprogram, "bg_color"),
     };
 
     blob = hb_blob_create_from_file_or_fail(ttf_path);
@@ -180,6 +1293,10 @@ void rendering_initialize(Display *display,
     font = hb_font_create(face);
 
     buf = hb_buffer_create();
+    shaping_reset();
+    row_cache_reset();
+
+    presentation_initialize();
 
     int n_fonts = stbtt_GetNumberOfFonts(blob_data);
     assert(n_fonts == 1);
@@ -227,6 +1344,7 @@ void rendering_calculate_sizes(int screen_height,
 
     cell_height = char_height;
     cell_width = char_height * ratio;
+    row_cache_reset();
 
     // Now that we know the cell size we can calculate how many rows and
     // collumns will fit in the window.
@@ -236,13 +1354,50 @@ void rendering_calculate_sizes(int screen_height,
     *nrows_ret = nrows;
     *ncols_ret = ncols;
 
+    if (grid_mode) {
+        grid_resize();
+    }
+    presentation_resize();
+
     glUniform1i(uniform_locations.cell_width, cell_width);
     glUniform1i(uniform_locations.cell_height, cell_height);
+    glUniform1i(uniform_locations.nrows, nrows);
+    glUniform1i(uniform_locations.ncols, ncols);
+    glUniform1i(uniform_locations.descent, descent * font_scale);
+
+    // All cells are drawn in one go, so the viewport covers the whole grid.
+    glViewport(0, 0, ncols * cell_width, nrows * cell_height);
 
     printf("fs %f\n", font_scale);
     printf("descent %d\n", descent);
 }
 
+// Queue up a cell for `rendering_flush`, with `glyph`'s origin `shift`
+// pixels to the right of the cell.
+static void push_instance(int row,
+                          int col,
+                          const struct atlas_entry *glyph,
+                          int shift,
+                          const struct termbuf_char *c) {
+    if (grid_mode) {
+        grid_put(row, col, glyph, shift, c);
+        return;
+    }
+
+    *instances_next() = (struct cell_instance) {
+        .col = col,
+        .row = row,
+        .atlas_x = glyph->x,
+        .atlas_y = glyph->y,
+        .bitmap_width = glyph->width,
+        .bitmap_height = glyph->height,
+        .bitmap_xoffset = glyph->xoffset + shift,
+        .bitmap_yoffset = glyph->yoffset,
+        .fg = { c->fg.r, c->fg.g, c->fg.b },
+        .bg = { c->bg.r, c->bg.g, c->bg.b },
+    };
+}
+
 void rendering_render_rect(int srow, int scol, int nrows, int ncols,
                            struct termbuf_char *c, int stride) {
     for (int i = 0; i < nrows; i++) {
@@ -258,108 +1413,77 @@ void rendering_render_cell(int xoffset, int yoffset, int row, int col,
                            struct termbuf_char *c) {
     assert(xoffset == 0 && yoffset == 0);  // TOOD: Implement.
 
-    int bitmap_width, bitmap_height, bitmap_xoffset, bitmap_yoffset;
-    unsigned char *bitmap;
-
-    if ((c->flags & FLAG_LENGTH_MASK) == FLAG_LENGTH_0) {
-        bitmap_width = 0;
-        bitmap_height = 0;
-        bitmap_xoffset = 0;
-        bitmap_yoffset = 0;
-        bitmap = NULL;
-        goto do_the_render;
-    }
-
-    // Hardcode the direction, script and language.
-    hb_buffer_set_direction(buf, HB_DIRECTION_LTR);
-    hb_buffer_set_script(buf, HB_SCRIPT_LATIN);
-    hb_buffer_set_language(buf, hb_language_from_string("en", -1));
+    // An empty glyph, i.e. a cell with only a background.
+    static const struct atlas_entry EMPTY = { 0 };
+    const struct atlas_entry *glyph = &EMPTY;
 
     const short len = c->flags & FLAG_LENGTH_MASK;
 
-    assert(len > 0);
+    if (len == FLAG_LENGTH_0) {
+        goto do_the_render;
+    }
 
     if (len == 1 && *c->utf8_char == (uint8_t) ' ') {
-        bitmap_width = 0;
-        bitmap_height = 0;
-        bitmap_xoffset = 0;
-        bitmap_yoffset = 0;
-        bitmap = NULL;
         goto do_the_render;
     }
 
-    hb_buffer_add_utf8(buf,
-                       (char *) c->utf8_char,
-                       len,
-                       0,
-                       len);
-
-    hb_shape (font, buf, NULL, 0);
-
-    assert(hb_buffer_get_length(buf) == 1);
-
-    // Get glyph information and positions out of the buffer.
-    hb_glyph_info_t *info = hb_buffer_get_glyph_infos(buf, NULL);
-    //hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(buf, NULL);
-    hb_buffer_get_glyph_positions(buf, NULL);
-    hb_buffer_clear_contents(buf);
+    glyph = atlas_get(shaping_get(c->utf8_char, len), c->flags);
 
-    int glyph_index = info->codepoint;
-    //int glyph_index = stbtt_FindGlyphIndex(&font_info, 45);//info->codepoint);
-    //if (glyph_index == 0) {
-    //    assert(false);
-    //}
+ do_the_render:
+    push_instance(row, col, glyph, 0, c);
+}
 
-    if (stbtt_IsGlyphEmpty(&font_info, glyph_index) != 0) {
-        assert(false);
+/*
+  Render a whole row of `ncells` cells, shaping them together so that
+  ligatures work, see ROW SHAPING. Changing one cell can change the glyphs of
+  the cells around it, so the whole row has to be drawn.
+ */
+void rendering_render_row(int row,
+                          const struct termbuf_char *cells,
+                          int ncells) {
+    static const struct atlas_entry EMPTY = { 0 };
+
+    const struct cell_glyph *glyphs = row_layout_get(cells, ncells);
+    for (int i = 0; i < ncells; i++) {
+        const struct atlas_entry *glyph = &EMPTY;
+        if (!glyphs[i].empty) {
+            glyph = atlas_get(glyphs[i].glyph_index, cells[i].flags);
+        }
+        push_instance(row, i + 1, glyph, glyphs[i].shift, &cells[i]);
     }
+}
 
-    bitmap = stbtt_GetGlyphBitmap(
-        &font_info,
-        font_scale,
-        font_scale,
-        glyph_index,
-        &bitmap_width,
-        &bitmap_height,
-        &bitmap_xoffset,
-        &bitmap_yoffset);
-
-    if (bitmap == NULL) {
-        assert(false);
+void rendering_flush(void) {
+    if (grid_mode) {
+        grid_flush();
+        return;
     }
 
- do_the_render:
-
-    glTexImage2D(GL_TEXTURE_2D,    // target
-                 0,                // level
-                 GL_RED,           // internal format
-                 bitmap_width,     // width
-                 bitmap_height,    // height
-                 0,                // border
-                 GL_RED,           // format
-                 GL_UNSIGNED_BYTE, // type
-                 bitmap);          // data
-
-    stbtt_FreeBitmap(bitmap, NULL);
+    if (instances_drawn == instances_len) {
+        return;
+    }
 
-    glViewport((col - 1) * cell_width,
-               (nrows - row + 0) * cell_height,
-               cell_width,
-               cell_height);
+    glDrawArraysInstancedBaseInstance(
+        GL_TRIANGLE_STRIP,
+        0,
+        4,
+        instances_len - instances_drawn,
+        instances_region * instances_capacity + instances_drawn);
+    instances_drawn = instances_len;
+}
 
-    glUniform1i(uniform_locations.bitmap_width, bitmap_width);
-    glUniform1i(uniform_locations.bitmap_height, bitmap_height);
-    glUniform1i(uniform_locations.bitmap_xoffset, bitmap_xoffset);
-    glUniform1i(uniform_locations.bitmap_yoffset, bitmap_yoffset);
-    glUniform1i(uniform_locations.descent, descent * font_scale);
-    glUniform3f(uniform_locations.fg_color,
-                c->fg.r / 255.f,
-                c->fg.g / 255.f,
-                c->fg.b / 255.f);
-    glUniform3f(uniform_locations.bg_color,
-                c->bg.r / 255.f,
-                c->bg.g / 255.f,
-                c->bg.b / 255.f);
+void rendering_end_frame(void) {
+    rendering_flush();
+    present();
+    if (grid_mode || instances_len == 0) {
+        return;
+    }
 
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    // Move on to the next region, the GPU is still reading this one.
+    instances_fences[instances_region] =
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    instances_region = (instances_region + 1) % INSTANCE_REGIONS;
+    instances_len = 0;
+    instances_drawn = 0;
+    instances_region_ready = false;
 }
@@ -1,15 +1,19 @@
 #ifndef INCLUDED_RENDERING_H
 #define INCLUDED_RENDERING_H
 
+#include <stdbool.h>
 #include <harfbuzz/hb.h>
 #include <glad/glx.h>
 
 #include "./termbuf.h"
 
+// With `grid_renderer` the whole grid is drawn with a single quad, see GRID
+// RENDERING in rendering.c, otherwise every cell is an instance of one.
 void rendering_initialize(Display *display,
                           int window,
                           GLXContext context,
-                          const char *ttf_path);
+                          const char *ttf_path,
+                          bool grid_renderer);
 void rendering_calculate_sizes(int screen_height,
                                int screen_width,
                                int char_height,
@@ -19,6 +23,14 @@ void rendering_render_cell(int xoffset, int yoffset, int row, int col,
                            struct termbuf_char *c);
 void rendering_render_rect(int srow, int scol, int nrows, int ncols,
                            struct termbuf_char *c, int stride);
+// Like `rendering_render_rect` for a whole row, but with ligatures.
+void rendering_render_row(int row,
+                          const struct termbuf_char *cells,
+                          int ncells);
+// The render functions above only queue up cells, this draws all of them.
+void rendering_flush(void);
+// Draw what's queued up, and let the renderer know that the frame is done.
+void rendering_end_frame(void);
 
 
 #endif /* INCLUDED_RENDERING_H */
@@ -29,36 +29,33 @@ size_t get_page_size() {
     return page_size;
 }
 
-void ringbuf_initialize(enum ringbuf_capacity cap,
+void ringbuf_initialize(size_t cap,
                         bool continous_memory,
                         struct ringbuf *rb_ret) {
-    assert(cap == 1 << 2
-           || cap == 1 << 3
-           || cap == 1 << 4
-           || cap == 1 << 5
-           || cap == 1 << 6
-           || cap == 1 << 7
-           || cap == 1 << 8
-           || cap == 1 << 9
-           || cap == 1 << 10
-           || cap == 1 << 11
-           || cap == 1 << 12
-           || cap == 1 << 13
-           || cap == 1 << 14
-           || cap == 1 << 15
-           || cap == 1 << 16
-           || cap == 1 << 17
-           || cap == 1 << 18
-           || cap == 1 << 19
-           || cap == 1 << 20
-           || cap == 1 << 21
-           || cap == 1 << 22
-           || cap == 1 << 23
-           || cap == 1 << 24);
+    ringbuf_initialize_with_margin(cap,
+                                   continous_memory ? get_page_size() : 0,
+                                   continous_memory,
+                                   rb_ret);
+}
+
+void ringbuf_initialize_with_margin(size_t cap,
+                                    size_t margin,
+                                    bool continous_memory,
+                                    struct ringbuf *rb_ret) {
+    // Has to be a power of two, see `ringbuf_write`.
+    assert(cap >= 1 << 2 && cap <= 1 << 30 && (cap & (cap - 1)) == 0);
 
     if (continous_memory) {
         const size_t page_size = get_page_size();
 
+        // The margin maps the start of the buffer again, so it can't be larger
+        // than the buffer.
+        margin = ((margin + page_size - 1) / page_size) * page_size;
+        margin = max(margin, page_size);
+        while (cap < margin) {
+            cap *= 2;
+        }
+
         // Align capacity uppwards to the nearest page bondary.
         size_t aligned_capacity =
             ((cap + page_size - 1) / page_size) * page_size;
@@ -78,7 +75,7 @@ void ringbuf_initialize(enum ringbuf_capacity cap,
         // Have the Kernel allocate a big enough block of virtual memory not
         // backed by anything.
         uint8_t *buf = mmap(NULL,
-                            aligned_capacity + page_size,
+                            aligned_capacity + margin,
                             PROT_NONE,
                             MAP_PRIVATE | MAP_ANONYMOUS,
                             -1,
@@ -100,7 +97,7 @@ void ringbuf_initialize(enum ringbuf_capacity cap,
 
         // Map the margin region of byf to the same `fd`.
         uint8_t *margin_region = mmap(buf + aligned_capacity,
-                                      page_size,
+                                      margin,
                                       PROT_READ | PROT_WRITE,
                                       MAP_SHARED | MAP_FIXED,
                                       fd,
@@ -109,20 +106,17 @@ void ringbuf_initialize(enum ringbuf_capacity cap,
             assert(false);
         }
 
-        ret = close(fd);
-        if (ret == -1) {
-            assert(false);
-        }
-
         // Check that we did our math correctly..
         assert(main_region == buf);
         assert(margin_region == main_region + aligned_capacity);
 
         rb_ret->buf = buf;
         rb_ret->continous_memory = true;
+        rb_ret->fd = fd;  // Kept open for `ringbuf_resize`.
         rb_ret->cursor = 0;
         rb_ret->size = 0;
         rb_ret->capacity = aligned_capacity;
+        rb_ret->margin = margin;
     } else {
         uint8_t *buf = calloc(cap, 1);
         if (buf == NULL) {
@@ -132,15 +126,22 @@ void ringbuf_initialize(enum ringbuf_capacity cap,
 
         rb_ret->buf = buf;
         rb_ret->continous_memory = false;
+        rb_ret->fd = -1;
         rb_ret->cursor = 0;
         rb_ret->size = 0;
         rb_ret->capacity = cap;
+        rb_ret->margin = 0;
     }
 }
 
 void ringbuf_free(struct ringbuf *rb) {
     if (rb->continous_memory) {
-        int ret = munmap(rb->buf, 1);
+        // The main region and the margin.
+        int ret = munmap(rb->buf, rb->capacity + rb->margin);
+        if (ret == -1) {
+            assert(false);
+        }
+        ret = close(rb->fd);
         if (ret == -1) {
             assert(false);
         }
@@ -149,6 +150,96 @@ void ringbuf_free(struct ringbuf *rb) {
     }
 }
 
+bool ringbuf_resize(struct ringbuf *rb, size_t cap) {
+    assert(rb->continous_memory);
+    assert((cap & (cap - 1)) == 0);
+
+    // Still has to be a power of two with room for the margin.
+    while (cap < rb->margin) {
+        cap *= 2;
+    }
+
+    if (cap == rb->capacity) {
+        return true;
+    }
+
+    // When the buffer is exactly full the data starts at 0 and ends at
+    // `capacity`, `cursor` just happens to have wrapped back to 0.
+    size_t end = rb->cursor;
+    if (end == 0 && rb->size == rb->capacity) {
+        end = rb->capacity;
+    }
+
+    // The data wraps around, growing would leave a gap in the middle of it and
+    // shrinking would cut it in half.
+    if (rb->size > end) {
+        return false;
+    }
+
+    // Doesn't fit.
+    if (end > cap) {
+        return false;
+    }
+
+    // Make the memfd big enough for both before and after.
+    int ret = ftruncate(rb->fd, max(cap, rb->capacity));
+    if (ret == -1) {
+        assert(false);
+    }
+
+    // Same layout as in `ringbuf_initialize`, a main region and a margin
+    // region mapping the start of the buffer again.
+    uint8_t *buf = mmap(NULL,
+                        cap + rb->margin,
+                        PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1,
+                        0);
+    if (buf == MAP_FAILED) {
+        assert(false);
+    }
+
+    // Move the old main region over to the new place and resize it. It's
+    // backed by the memfd so only the page tables change, nothing is copied.
+    uint8_t *main_region = mremap(rb->buf,
+                                  rb->capacity,
+                                  cap,
+                                  MREMAP_MAYMOVE | MREMAP_FIXED,
+                                  buf);
+    if (main_region == MAP_FAILED) {
+        assert(false);
+    }
+
+    ret = munmap((uint8_t *) rb->buf + rb->capacity, rb->margin);
+    if (ret == -1) {
+        assert(false);
+    }
+
+    uint8_t *margin_region = mmap(buf + cap,
+                                  rb->margin,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_FIXED,
+                                  rb->fd,
+                                  0);
+    if (margin_region == MAP_FAILED) {
+        assert(false);
+    }
+
+    assert(main_region == buf);
+    assert(margin_region == main_region + cap);
+
+    // Give the memory back when shrinking.
+    ret = ftruncate(rb->fd, cap);
+    if (ret == -1) {
+        assert(false);
+    }
+
+    rb->buf = buf;
+    rb->cursor = end & (cap - 1);
+    rb->capacity = cap;
+    return true;
+}
+
 void ringbuf_write(struct ringbuf *rb, void *data, size_t len) {
     // Say you wan't to write "Hello, World!", and the ring buffer is like
     // this:
@@ -216,7 +307,7 @@ enum offset_result ringbuf_getp(struct ringbuf *rb,
         return RINGBUF_DISCONTINOUS_MEMORY;
     }
 
-    if (len > get_page_size()) {
+    if (len > rb->margin) {
         return RINGBUF_TOO_LARGE;
     }
 
@@ -238,7 +329,7 @@ enum offset_result ringbuf_writep(struct ringbuf *rb,
         return RINGBUF_DISCONTINOUS_MEMORY;
     }
 
-    if (len > get_page_size()) {
+    if (len > rb->margin) {
         return RINGBUF_TOO_LARGE;
     }
 
@@ -282,7 +373,7 @@ void test_ringbuf_writep_empty(CuTest *tc) {
     struct ringbuf rb;
     ringbuf_initialize(4, true, &rb);
 
-    void *data;
+    void *data = NULL;
     enum offset_result ret = ringbuf_writep(&rb, 0, &data);
 
     CuAssertIntEquals(tc, RINGBUF_SUCCESS, ret);
@@ -319,7 +410,7 @@ void test_ringbuf_writep_single(CuTest *tc) {
     struct ringbuf rb;
     ringbuf_initialize(4, true, &rb);
 
-    uint8_t *data;
+    uint8_t *data = NULL;
     enum offset_result ret = ringbuf_writep(&rb, 1, (void **) &data);
     *data = '#';
 
@@ -360,7 +451,7 @@ void test_ringbuf_writep_nowrap(CuTest *tc) {
 
     const char *DATA = "0123456789abcdefghijklmnopqrstuvwxys";
 
-    uint8_t *writeptr;
+    uint8_t *writeptr = NULL;
     enum offset_result ret = ringbuf_writep(&rb,
                                             strlen(DATA),
                                             (void **) &writeptr);
@@ -408,7 +499,7 @@ void test_ringbuf_writep_wrap_around(CuTest *tc) {
     rb.cursor = rb.capacity - 4;
     rb.size = rb.capacity - 4;
 
-    char *writeptr;
+    char *writeptr = NULL;
     enum offset_result ret = ringbuf_writep(&rb,
                                             strlen(DATA),
                                             (void **) &writeptr);
@@ -451,7 +542,7 @@ void test_ringbuf_writep_capacity(CuTest *tc) {
     ringbuf_initialize(64, true, &rb);
 
 
-    uint8_t *writeptr;
+    uint8_t *writeptr = NULL;
     enum offset_result ret = ringbuf_writep(&rb,
                                             rb.capacity,
                                             (void **) &writeptr);
@@ -566,6 +657,158 @@ void test_ringbuf_continous_memory(CuTest *tc) {
     free(data);
 }
 
+// Growing keeps the data where it was, and the margin follows the new end.
+void test_ringbuf_resize_grow(CuTest *tc) {
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+
+    struct ringbuf rb;
+    ringbuf_initialize(page_size, true, &rb);
+
+    char *data = malloc(page_size);
+    for (long i = 0; i < page_size; i++) {
+        data[i] = i % 251;
+    }
+    ringbuf_write(&rb, data, page_size);
+    CuAssertIntEquals(tc, 0, rb.cursor);
+
+    CuAssertTrue(tc, ringbuf_resize(&rb, 4 * page_size));
+    CuAssertIntEquals(tc, 4 * page_size, rb.capacity);
+    CuAssertIntEquals(tc, page_size, rb.cursor);
+    CuAssertIntEquals(tc, page_size, rb.size);
+    CuAssertBytesEquals(tc, (uint8_t *) data, rb.buf, page_size);
+
+    // Fill it up and wrap around the new end.
+    for (int i = 0; i < 3; i++) {
+        ringbuf_write(&rb, data, page_size);
+    }
+    ringbuf_write(&rb, "0123456789", 10);
+
+    char *result = NULL;
+    enum offset_result ret = ringbuf_getp(&rb, 10, 10, (void **) &result);
+    CuAssertIntEquals(tc, RINGBUF_SUCCESS, ret);
+    CuAssertBytesEquals(tc, (uint8_t *) "0123456789", (uint8_t *) result, 10);
+
+    // Can't grow any more now that the data wraps around.
+    CuAssertTrue(tc, !ringbuf_resize(&rb, 8 * page_size));
+
+    ringbuf_free(&rb);
+    free(data);
+}
+
+void test_ringbuf_resize_shrink(CuTest *tc) {
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+
+    struct ringbuf rb;
+    ringbuf_initialize(4 * page_size, true, &rb);
+    ringbuf_write(&rb, "0123456789", 10);
+
+    CuAssertTrue(tc, ringbuf_resize(&rb, page_size));
+    CuAssertIntEquals(tc, page_size, rb.capacity);
+    CuAssertBytesEquals(tc, (uint8_t *) "0123456789", rb.buf, 10);
+
+    // Too much data to shrink.
+    struct ringbuf rb2;
+    ringbuf_initialize(4 * page_size, true, &rb2);
+    char *data = calloc(2 * page_size, 1);
+    ringbuf_write(&rb2, data, 2 * page_size);
+    CuAssertTrue(tc, !ringbuf_resize(&rb2, page_size));
+    CuAssertTrue(tc, ringbuf_resize(&rb2, 2 * page_size));
+    CuAssertIntEquals(tc, 0, rb2.cursor);
+
+    ringbuf_free(&rb);
+    ringbuf_free(&rb2);
+    free(data);
+}
+
+// Records larger than a page are contiguous too with a larger margin.
+void test_ringbuf_large_margin(CuTest *tc) {
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+
+    struct ringbuf rb;
+    ringbuf_initialize_with_margin(8 * page_size, 3 * page_size, true, &rb);
+    CuAssertIntEquals(tc, 8 * page_size, rb.capacity);
+    CuAssertIntEquals(tc, 3 * page_size, rb.margin);
+
+    char *record = malloc(3 * page_size);
+    for (long i = 0; i < 3 * page_size; i++) {
+        record[i] = i % 251;
+    }
+
+    // Start the record a page before the end of the buffer.
+    rb.cursor = 7 * page_size;
+    rb.size = 7 * page_size;
+
+    char *writeptr = NULL;
+    enum offset_result ret = ringbuf_writep(&rb,
+                                            3 * page_size,
+                                            (void **) &writeptr);
+    CuAssertIntEquals(tc, RINGBUF_SUCCESS, ret);
+    memcpy(writeptr, record, 3 * page_size);
+    CuAssertIntEquals(tc, 2 * page_size, rb.cursor);
+
+    char *result = NULL;
+    ret = ringbuf_getp(&rb, 3 * page_size, 3 * page_size, (void **) &result);
+    CuAssertIntEquals(tc, RINGBUF_SUCCESS, ret);
+    CuAssertBytesEquals(tc,
+                        (uint8_t *) record,
+                        (uint8_t *) result,
+                        3 * page_size);
+    // The part past the end really did end up at the start.
+    CuAssertBytesEquals(tc,
+                        (uint8_t *) record + page_size,
+                        rb.buf,
+                        2 * page_size);
+
+    ret = ringbuf_writep(&rb, 3 * page_size + 1, (void **) &writeptr);
+    CuAssertIntEquals(tc, RINGBUF_TOO_LARGE, ret);
+
+    // The margin survives resizing.
+    rb.cursor = 0;
+    rb.size = 0;
+    CuAssertTrue(tc, ringbuf_resize(&rb, 16 * page_size));
+    CuAssertIntEquals(tc, 3 * page_size, rb.margin);
+    rb.cursor = 15 * page_size;
+    rb.size = 15 * page_size;
+    ret = ringbuf_writep(&rb, 3 * page_size, (void **) &writeptr);
+    CuAssertIntEquals(tc, RINGBUF_SUCCESS, ret);
+    memcpy(writeptr, record, 3 * page_size);
+    CuAssertBytesEquals(tc,
+                        (uint8_t *) record + page_size,
+                        rb.buf,
+                        2 * page_size);
+
+    ringbuf_free(&rb);
+    free(record);
+}
+
+// Shrinking below a margin that isn't a power of two keeps the capacity a
+// power of two.
+void test_ringbuf_resize_large_margin(CuTest *tc) {
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+
+    struct ringbuf rb;
+    ringbuf_initialize_with_margin(8 * page_size, 3 * page_size, true, &rb);
+
+    CuAssertTrue(tc, ringbuf_resize(&rb, page_size));
+    CuAssertIntEquals(tc, 4 * page_size, rb.capacity);
+    CuAssertIntEquals(tc, 3 * page_size, rb.margin);
+
+    // Wraps around at the new end.
+    char *data = calloc(4 * page_size, 1);
+    ringbuf_write(&rb, data, 4 * page_size);
+    ringbuf_write(&rb, "0123456789", 10);
+    CuAssertIntEquals(tc, 10, rb.cursor);
+    CuAssertBytesEquals(tc, (uint8_t *) "0123456789", rb.buf, 10);
+
+    char *result = NULL;
+    enum offset_result ret = ringbuf_getp(&rb, 10, 10, (void **) &result);
+    CuAssertIntEquals(tc, RINGBUF_SUCCESS, ret);
+    CuAssertBytesEquals(tc, (uint8_t *) "0123456789", (uint8_t *) result, 10);
+
+    ringbuf_free(&rb);
+    free(data);
+}
+
 CuSuite *ringbuf_test_suite() {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_ringbuf_write_empty);
@@ -582,5 +825,9 @@ CuSuite *ringbuf_test_suite() {
     SUITE_ADD_TEST(suite, test_ringbuf_get_wrap_around);
     SUITE_ADD_TEST(suite, test_ringbuf_page_aligned);
     SUITE_ADD_TEST(suite, test_ringbuf_continous_memory);
+    SUITE_ADD_TEST(suite, test_ringbuf_resize_grow);
+    SUITE_ADD_TEST(suite, test_ringbuf_resize_shrink);
+    SUITE_ADD_TEST(suite, test_ringbuf_large_margin);
+    SUITE_ADD_TEST(suite, test_ringbuf_resize_large_margin);
     return suite;
 }
@@ -10,9 +10,14 @@
 struct ringbuf {
     void *buf;
     bool continous_memory;
+    int fd;  // The memfd backing `buf` when `continous_memory` is set.
     size_t cursor;
     size_t size;
     size_t capacity;
+    // With continous memory this many bytes from the start of the buffer are
+    // mapped again right after its end, so that any record up to this size can
+    // be read and written as one piece even if it wraps around.
+    size_t margin;
 };
 
 enum ringbuf_capacity {
@@ -42,10 +47,24 @@ enum offset_result {
     RINGBUF_DISCONTINOUS_MEMORY = 3,
 };
 
-void ringbuf_initialize(enum ringbuf_capacity cap,
+size_t min(size_t x, size_t y);
+size_t max(size_t x, size_t y);
+
+void ringbuf_initialize(size_t cap,
                         bool continous_memory,
                         struct ringbuf *rb_ret);
+// Same as `ringbuf_initialize` but with a margin of `margin` bytes rounded up
+// to whole pages, rather than one page. The capacity is at least the margin.
+void ringbuf_initialize_with_margin(size_t cap,
+                                    size_t margin,
+                                    bool continous_memory,
+                                    struct ringbuf *rb_ret);
 void ringbuf_free(struct ringbuf *rb);
+// Change the capacity of a continous memory ringbuf without copying anything,
+// `cap` has to be a power of two. This only works as long as the data doesn't
+// wrap around the end of the buffer and fits in the new capacity, returns
+// false otherwise.
+bool ringbuf_resize(struct ringbuf *rb, size_t cap);
 void ringbuf_write(struct ringbuf *rb, void *data, size_t len);
 uint8_t ringbuf_get(struct ringbuf *rb, size_t offset);
 enum offset_result ringbuf_getp(struct ringbuf *rb,
@@ -0,0 +1,752 @@
+#include "./scrollback.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "./ringbuf.h"
+#include "./compress.h"
+#include "./CuTest.h"
+
+void scrollback_initialize(size_t max_rows,
+                           size_t max_bytes,
+                           struct scrollback *sb_ret) {
+    assert(max_rows > 0);
+
+    // The ringbuf needs a power of two.
+    size_t capacity = 1;
+    while (capacity * 2 <= max_bytes) {
+        capacity *= 2;
+    }
+
+    sb_ret->max_capacity = capacity;
+    ringbuf_initialize_with_margin(min(capacity, SCROLLBACK_INITIAL_BYTES),
+                                   SCROLLBACK_MAX_ROW_BYTES,
+                                   true,
+                                   &sb_ret->data);
+    sb_ret->max_capacity = max(sb_ret->max_capacity, sb_ret->data.capacity);
+
+    sb_ret->index_capacity = min(max_rows, SCROLLBACK_INITIAL_INDEX_CAPACITY);
+    sb_ret->index = malloc(sb_ret->index_capacity
+                           * sizeof(struct scrollback_entry));
+    if (sb_ret->index == NULL) {
+        assert(false);
+    }
+    sb_ret->max_rows = max_rows;
+
+    // The rows can straddle one more block at each end.
+    sb_ret->nblocks = max_rows / SCROLLBACK_BLOCK_ROWS + 2;
+    sb_ret->blocks = malloc(sb_ret->nblocks * sizeof(struct scrollback_block));
+    if (sb_ret->blocks == NULL) {
+        assert(false);
+    }
+
+    sb_ret->first = 0;
+    sb_ret->memory_first = 0;
+    sb_ret->end = 0;
+    sb_ret->written = 0;
+
+    sb_ret->spill_fd = -1;
+    sb_ret->spill_size = 0;
+    sb_ret->spill_map = NULL;
+    sb_ret->spill_map_len = 0;
+    sb_ret->spill_buf = NULL;
+    sb_ret->spill_buf_capacity = 0;
+    sb_ret->spill_cache = NULL;
+    sb_ret->spill_cache_capacity = 0;
+    sb_ret->spill_cache_block = UINT64_MAX;
+}
+
+static void unmap_spill(struct scrollback *sb) {
+    if (sb->spill_map != NULL) {
+        munmap((void *) sb->spill_map, sb->spill_map_len);
+        sb->spill_map = NULL;
+        sb->spill_map_len = 0;
+    }
+}
+
+void scrollback_free(struct scrollback *sb) {
+    ringbuf_free(&sb->data);
+    free(sb->index);
+    free(sb->blocks);
+
+    unmap_spill(sb);
+    if (sb->spill_fd != -1) {
+        close(sb->spill_fd);
+    }
+    free(sb->spill_buf);
+    free(sb->spill_cache);
+}
+
+bool scrollback_enable_spill(struct scrollback *sb) {
+    assert(sb->spill_fd == -1);
+
+    const char *dir = getenv("TMPDIR");
+    if (dir == NULL || dir[0] == '\0') {
+        dir = "/tmp";
+    }
+
+    // A file without a name that goes away together with us. A memfd would
+    // have been simpler but it lives in memory, which defeats the purpose.
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        // Not every file system supports O_TMPFILE.
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/min-terminal-scrollback-XXXXXX", dir);
+        fd = mkostemp(path, O_CLOEXEC);
+        if (fd == -1) {
+            return false;
+        }
+        unlink(path);
+    }
+
+    sb->spill_fd = fd;
+    return true;
+}
+
+void scrollback_clear(struct scrollback *sb) {
+    sb->first = sb->end;
+    sb->memory_first = sb->end;
+
+    if (sb->spill_fd != -1) {
+        unmap_spill(sb);
+        int ret = ftruncate(sb->spill_fd, 0);
+        assert(ret == 0);
+        sb->spill_size = 0;
+        sb->spill_cache_block = UINT64_MAX;
+    }
+
+    // Start over with a small buffer.
+    sb->written = 0;
+    sb->data.cursor = 0;
+    sb->data.size = 0;
+    bool ok = ringbuf_resize(&sb->data, SCROLLBACK_INITIAL_BYTES);
+    assert(ok);
+}
+
+size_t scrollback_nrows(struct scrollback *sb) {
+    return sb->end - sb->first;
+}
+
+// Double the capacity of `index`, which only happens while it's full so every
+// entry is in use.
+static void grow_index(struct scrollback *sb) {
+    size_t capacity = min(2 * sb->index_capacity, sb->max_rows);
+    struct scrollback_entry *index =
+        malloc(capacity * sizeof(struct scrollback_entry));
+    if (index == NULL) {
+        assert(false);
+    }
+
+    for (uint64_t id = sb->memory_first; id < sb->end; id++) {
+        index[id % capacity] = sb->index[id % sb->index_capacity];
+    }
+
+    free(sb->index);
+    sb->index = index;
+    sb->index_capacity = capacity;
+}
+
+// Forget about the rows before `id`, spilled or not. Spilled blocks that are
+// entirely gone give their disk space back.
+static void drop_rows(struct scrollback *sb, uint64_t id) {
+    for (uint64_t b = sb->first / SCROLLBACK_BLOCK_ROWS;
+         b < id / SCROLLBACK_BLOCK_ROWS;
+         b++) {
+        struct scrollback_block *block = &sb->blocks[b % sb->nblocks];
+        if (block->spill_len > 0) {
+            // If it fails the file just doesn't shrink.
+            fallocate(sb->spill_fd,
+                      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      block->spill_offset,
+                      block->spill_len);
+            block->spill_len = 0;
+        }
+    }
+
+    sb->first = id;
+    sb->memory_first = max(sb->memory_first, id);
+}
+
+// Compress the rows `from` through `to - 1`, the end of a block, and append
+// them to the spill file. Returns false if they couldn't be written.
+static bool spill_block(struct scrollback *sb, uint64_t from, uint64_t to) {
+    uint32_t nrows = to - from;
+    size_t len = (1 + nrows) * sizeof(uint32_t);
+    for (uint64_t id = from; id < to; id++) {
+        len += sb->index[id % sb->index_capacity].len;
+    }
+
+    // The uncompressed block followed by the compressed one.
+    size_t capacity = len + compress_bound(len);
+    if (capacity > sb->spill_buf_capacity) {
+        sb->spill_buf = realloc(sb->spill_buf, capacity);
+        if (sb->spill_buf == NULL) {
+            assert(false);
+        }
+        sb->spill_buf_capacity = capacity;
+    }
+
+    uint8_t *raw = sb->spill_buf;
+    memcpy(raw, &nrows, sizeof(nrows));
+    uint8_t *rows = raw + (1 + nrows) * sizeof(uint32_t);
+    for (uint64_t id = from; id < to; id++) {
+        const struct scrollback_entry *entry =
+            &sb->index[id % sb->index_capacity];
+        assert(entry->id == id);
+
+        void *data;
+        enum offset_result ret = ringbuf_getp(&sb->data,
+                                              sb->written - entry->position,
+                                              entry->len,
+                                              &data);
+        assert(ret == RINGBUF_SUCCESS);
+
+        memcpy(raw + (1 + id - from) * sizeof(uint32_t),
+               &entry->len,
+               sizeof(uint32_t));
+        memcpy(rows, data, entry->len);
+        rows += entry->len;
+    }
+
+    uint8_t *compressed = raw + len;
+    size_t compressed_len = compress(raw, len, compressed);
+
+    size_t did_write = 0;
+    while (did_write < compressed_len) {
+        ssize_t n = pwrite(sb->spill_fd,
+                           compressed + did_write,
+                           compressed_len - did_write,
+                           sb->spill_size + did_write);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return false;
+        }
+        did_write += n;
+    }
+
+    struct scrollback_block *block =
+        &sb->blocks[(from / SCROLLBACK_BLOCK_ROWS) % sb->nblocks];
+    block->spill_offset = sb->spill_size;
+    block->spill_len = compressed_len;
+    sb->spill_size += compressed_len;
+    return true;
+}
+
+// Make room in `data` by getting rid of the oldest row in memory, by either
+// spilling its block or dropping it.
+static void evict_from_memory(struct scrollback *sb) {
+    uint64_t block_end =
+        (sb->memory_first / SCROLLBACK_BLOCK_ROWS + 1) * SCROLLBACK_BLOCK_ROWS;
+
+    if (sb->spill_fd == -1 || block_end > sb->end) {
+        drop_rows(sb, sb->memory_first + 1);
+        return;
+    }
+
+    // Most likely the disk is full, drop the whole block so that we don't try
+    // again for every row.
+    if (!spill_block(sb, sb->memory_first, block_end)) {
+        drop_rows(sb, block_end);
+        return;
+    }
+
+    sb->memory_first = block_end;
+}
+
+void *scrollback_push(struct scrollback *sb, size_t len) {
+    assert(len <= SCROLLBACK_MAX_ROW_BYTES);
+
+    // Until `data` has grown to its full size nothing has been overwritten, so
+    // the data starts at 0 and the ringbuf can be resized.
+    while (sb->written + len > sb->data.capacity
+           && sb->data.capacity < sb->max_capacity) {
+        bool ok = ringbuf_resize(&sb->data, 2 * sb->data.capacity);
+        assert(ok);
+    }
+
+    // Make room for one more row.
+    if (sb->end - sb->first == sb->max_rows) {
+        drop_rows(sb, sb->first + 1);
+    }
+    if (sb->end - sb->memory_first == sb->index_capacity) {
+        grow_index(sb);
+    }
+
+    // Get rid of the rows that are about to be overwritten.
+    while (sb->memory_first < sb->end
+           && sb->index[sb->memory_first % sb->index_capacity].position
+              + sb->data.capacity < sb->written + len) {
+        evict_from_memory(sb);
+    }
+
+    void *writeptr;
+    enum offset_result ret = ringbuf_writep(&sb->data, len, &writeptr);
+    if (ret != RINGBUF_SUCCESS) {
+        fprintf(stderr, "ret: %d\n", ret);
+        assert(false);
+    }
+
+    sb->index[sb->end % sb->index_capacity] = (struct scrollback_entry) {
+        .id = sb->end,
+        .position = sb->written,
+        .len = len,
+    };
+
+    struct scrollback_block *block =
+        &sb->blocks[(sb->end / SCROLLBACK_BLOCK_ROWS) % sb->nblocks];
+    if (sb->end % SCROLLBACK_BLOCK_ROWS == 0) {
+        *block = (struct scrollback_block) {
+            .id = sb->end / SCROLLBACK_BLOCK_ROWS,
+            .position = sb->written,
+            .bytes = 0,
+            .nrows = 0,
+            .max_len = 0,
+            .spill_offset = 0,
+            .spill_len = 0,
+        };
+    }
+    block->bytes += len;
+    block->nrows ++;
+    block->max_len = max(block->max_len, len);
+
+    sb->end ++;
+    sb->written += len;
+
+    return writeptr;
+}
+
+uint64_t scrollback_id(struct scrollback *sb, size_t n) {
+    return sb->end - n;
+}
+
+bool scrollback_get(struct scrollback *sb,
+                    size_t n,
+                    const void **data_ret,
+                    size_t *len_ret) {
+    if (n < 1 || n > scrollback_nrows(sb)) {
+        return false;
+    }
+    return scrollback_get_id(sb, scrollback_id(sb, n), data_ret, len_ret);
+}
+
+// Decompress a spilled block into `spill_cache`.
+static void load_spilled_block(struct scrollback *sb,
+                               const struct scrollback_block *block) {
+    // Map the file again if it has grown past what's mapped.
+    if (block->spill_offset + block->spill_len > sb->spill_map_len) {
+        unmap_spill(sb);
+        void *map = mmap(NULL,
+                         sb->spill_size,
+                         PROT_READ,
+                         MAP_SHARED,
+                         sb->spill_fd,
+                         0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Could not map scrollback: %s\n", strerror(errno));
+            assert(false);
+        }
+        sb->spill_map = map;
+        sb->spill_map_len = sb->spill_size;
+    }
+
+    size_t capacity =
+        (1 + SCROLLBACK_BLOCK_ROWS) * sizeof(uint32_t) + block->bytes;
+    if (capacity > sb->spill_cache_capacity) {
+        sb->spill_cache = realloc(sb->spill_cache, capacity);
+        if (sb->spill_cache == NULL) {
+            assert(false);
+        }
+        sb->spill_cache_capacity = capacity;
+    }
+
+    size_t len = decompress(sb->spill_map + block->spill_offset,
+                            block->spill_len,
+                            sb->spill_cache,
+                            sb->spill_cache_capacity);
+    assert(len != (size_t) -1);
+    sb->spill_cache_block = block->id;
+}
+
+static void get_spilled(struct scrollback *sb,
+                        uint64_t id,
+                        const void **data_ret,
+                        size_t *len_ret) {
+    const struct scrollback_block *block =
+        &sb->blocks[(id / SCROLLBACK_BLOCK_ROWS) % sb->nblocks];
+    assert(block->id == id / SCROLLBACK_BLOCK_ROWS);
+    assert(block->spill_len > 0);
+
+    if (sb->spill_cache_block != block->id) {
+        load_spilled_block(sb, block);
+    }
+
+    // The block holds its last `nrows` rows.
+    uint32_t nrows;
+    memcpy(&nrows, sb->spill_cache, sizeof(nrows));
+    uint64_t block_first = (block->id + 1) * SCROLLBACK_BLOCK_ROWS - nrows;
+    assert(id >= block_first);
+
+    const uint8_t *lens = sb->spill_cache + sizeof(uint32_t);
+    size_t offset = (1 + nrows) * sizeof(uint32_t);
+    uint32_t len;
+    for (uint64_t i = block_first; i < id; i++) {
+        memcpy(&len, lens + (i - block_first) * sizeof(uint32_t), sizeof(len));
+        offset += len;
+    }
+    memcpy(&len, lens + (id - block_first) * sizeof(uint32_t), sizeof(len));
+
+    *data_ret = sb->spill_cache + offset;
+    *len_ret = len;
+}
+
+bool scrollback_get_id(struct scrollback *sb,
+                       uint64_t id,
+                       const void **data_ret,
+                       size_t *len_ret) {
+    if (id < sb->first || id >= sb->end) {
+        return false;
+    }
+
+    if (id < sb->memory_first) {
+        get_spilled(sb, id, data_ret, len_ret);
+        return true;
+    }
+
+    const struct scrollback_entry *entry =
+        &sb->index[id % sb->index_capacity];
+    assert(entry->id == id);
+
+    void *data;
+    enum offset_result ret = ringbuf_getp(&sb->data,
+                                          sb->written - entry->position,
+                                          entry->len,
+                                          &data);
+    if (ret != RINGBUF_SUCCESS) {
+        fprintf(stderr, "ret: %d\n", ret);
+        assert(false);
+    }
+
+    *data_ret = data;
+    *len_ret = entry->len;
+    return true;
+}
+
+bool scrollback_get_block(struct scrollback *sb,
+                          uint64_t id,
+                          struct scrollback_block *block_ret) {
+    if (sb->first == sb->end
+        || id < sb->first / SCROLLBACK_BLOCK_ROWS
+        || id > (sb->end - 1) / SCROLLBACK_BLOCK_ROWS) {
+        return false;
+    }
+
+    const struct scrollback_block *block = &sb->blocks[id % sb->nblocks];
+    assert(block->id == id);
+    *block_ret = *block;
+    return true;
+}
+
+
+
+////////////////
+// UNIT TESTS //
+////////////////
+
+
+
+void push_string(struct scrollback *sb, const char *s) {
+    memcpy(scrollback_push(sb, strlen(s)), s, strlen(s));
+}
+
+void cu_assert_row_equals(CuTest *tc,
+                          struct scrollback *sb,
+                          size_t n,
+                          const char *expected) {
+    const void *data = NULL;
+    size_t len = 0;
+    CuAssertTrue(tc, scrollback_get(sb, n, &data, &len));
+    CuAssertIntEquals(tc, strlen(expected), len);
+    CuAssertBytesEquals(tc, (unsigned char *) expected, data, len);
+}
+
+void test_scrollback_push_get(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(10, 4096, &sb);
+
+    push_string(&sb, "first");
+    push_string(&sb, "");
+    push_string(&sb, "third row");
+
+    CuAssertIntEquals(tc, 3, scrollback_nrows(&sb));
+    cu_assert_row_equals(tc, &sb, 1, "third row");
+    cu_assert_row_equals(tc, &sb, 2, "");
+    cu_assert_row_equals(tc, &sb, 3, "first");
+
+    const void *data;
+    size_t len;
+    CuAssertTrue(tc, !scrollback_get(&sb, 0, &data, &len));
+    CuAssertTrue(tc, !scrollback_get(&sb, 4, &data, &len));
+
+    scrollback_free(&sb);
+}
+
+// Only the `max_rows` most recent rows are kept.
+void test_scrollback_max_rows(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(3, 4096, &sb);
+
+    push_string(&sb, "0");
+    push_string(&sb, "1");
+    push_string(&sb, "2");
+    push_string(&sb, "3");
+    push_string(&sb, "4");
+
+    CuAssertIntEquals(tc, 3, scrollback_nrows(&sb));
+    cu_assert_row_equals(tc, &sb, 1, "4");
+    cu_assert_row_equals(tc, &sb, 2, "3");
+    cu_assert_row_equals(tc, &sb, 3, "2");
+
+    scrollback_free(&sb);
+}
+
+// Rows are evicted once we run out of memory, and rows that wrap around the
+// end of the ringbuf still read back as a whole.
+void test_scrollback_max_bytes(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(1000, 65536, &sb);
+    CuAssertIntEquals(tc, 65536, sb.data.capacity);
+
+    char row[1001];
+    for (int i = 0; i < 100; i++) {
+        memset(row, 'a' + i % 26, 1000);
+        row[1000] = '\0';
+        push_string(&sb, row);
+    }
+
+    // 65 rows of 1000 bytes fit in 65536 bytes.
+    CuAssertIntEquals(tc, 65, scrollback_nrows(&sb));
+    for (int n = 1; n <= 65; n++) {
+        memset(row, 'a' + (100 - n) % 26, 1000);
+        cu_assert_row_equals(tc, &sb, n, row);
+    }
+
+    scrollback_free(&sb);
+}
+
+// The buffer starts small and grows as rows are pushed.
+void test_scrollback_grow(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(100000, 4 * SCROLLBACK_INITIAL_BYTES, &sb);
+    CuAssertIntEquals(tc, SCROLLBACK_INITIAL_BYTES, sb.data.capacity);
+
+    // Rows of 99 bytes.
+    char row[100];
+    for (int i = 0; i < 3 * SCROLLBACK_INITIAL_BYTES / 100; i++) {
+        snprintf(row, sizeof(row), "row %-95d", i);
+        push_string(&sb, row);
+    }
+
+    CuAssertIntEquals(tc, 4 * SCROLLBACK_INITIAL_BYTES, sb.data.capacity);
+    CuAssertIntEquals(tc, 3 * SCROLLBACK_INITIAL_BYTES / 100,
+                      scrollback_nrows(&sb));
+    snprintf(row, sizeof(row), "row %-95d", 0);
+    cu_assert_row_equals(tc, &sb, scrollback_nrows(&sb), row);
+    snprintf(row, sizeof(row), "row %-95d",
+             3 * SCROLLBACK_INITIAL_BYTES / 100 - 1);
+    cu_assert_row_equals(tc, &sb, 1, row);
+
+    scrollback_clear(&sb);
+    CuAssertIntEquals(tc, SCROLLBACK_INITIAL_BYTES, sb.data.capacity);
+
+    scrollback_free(&sb);
+}
+
+// Rows can be looked up by id, and evicted rows are detected.
+void test_scrollback_ids(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(2000, 65536, &sb);
+
+    char row[32];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(row, sizeof(row), "%d", i);
+        push_string(&sb, row);
+    }
+
+    CuAssertIntEquals(tc, 2000, scrollback_nrows(&sb));
+    CuAssertIntEquals(tc, 2000, sb.index_capacity);
+    CuAssertIntEquals(tc, 4999, scrollback_id(&sb, 1));
+    CuAssertIntEquals(tc, 3000, scrollback_id(&sb, 2000));
+
+    const void *data;
+    size_t len;
+    CuAssertTrue(tc, !scrollback_get_id(&sb, 2999, &data, &len));
+    CuAssertTrue(tc, !scrollback_get_id(&sb, 5000, &data, &len));
+    CuAssertTrue(tc, scrollback_get_id(&sb, 3000, &data, &len));
+    CuAssertIntEquals(tc, 4, len);
+    CuAssertBytesEquals(tc, (unsigned char *) "3000", data, 4);
+    CuAssertTrue(tc, scrollback_get_id(&sb, 4321, &data, &len));
+    CuAssertBytesEquals(tc, (unsigned char *) "4321", data, 4);
+
+    scrollback_free(&sb);
+}
+
+void test_scrollback_blocks(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(1000, 65536, &sb);
+
+    char row[32];
+    for (int i = 0; i < 2 * SCROLLBACK_BLOCK_ROWS + 10; i++) {
+        memset(row, 'x', i % 20);
+        row[i % 20] = '\0';
+        push_string(&sb, row);
+    }
+
+    struct scrollback_block block = { 0 };
+    CuAssertTrue(tc, scrollback_get_block(&sb, 1, &block));
+    CuAssertIntEquals(tc, 1, block.id);
+    CuAssertIntEquals(tc, SCROLLBACK_BLOCK_ROWS, block.nrows);
+    size_t bytes = 0;
+    for (int i = SCROLLBACK_BLOCK_ROWS; i < 2 * SCROLLBACK_BLOCK_ROWS; i++) {
+        bytes += i % 20;
+    }
+    CuAssertIntEquals(tc, bytes, block.bytes);
+    CuAssertIntEquals(tc, 19, block.max_len);
+
+    CuAssertTrue(tc, scrollback_get_block(&sb, 2, &block));
+    CuAssertIntEquals(tc, 10, block.nrows);
+    CuAssertTrue(tc, !scrollback_get_block(&sb, 3, &block));
+
+    scrollback_free(&sb);
+}
+
+void test_scrollback_clear(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(10, 4096, &sb);
+
+    push_string(&sb, "gone");
+    scrollback_clear(&sb);
+    CuAssertIntEquals(tc, 0, scrollback_nrows(&sb));
+
+    push_string(&sb, "new");
+    CuAssertIntEquals(tc, 1, scrollback_nrows(&sb));
+    cu_assert_row_equals(tc, &sb, 1, "new");
+
+    scrollback_free(&sb);
+}
+
+// Rows of about 50 bytes that are easy to check.
+void spill_row(char *row, size_t size, int i) {
+    snprintf(row, size, "%d: some output that compresses well %d", i, i % 7);
+}
+
+// Rows that don't fit in memory are spilled and can still be read back, both
+// in order and out of order.
+void test_scrollback_spill(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(100000, 65536, &sb);
+    CuAssertTrue(tc, scrollback_enable_spill(&sb));
+
+    char row[64];
+    size_t bytes = 0;
+    for (int i = 0; i < 10000; i++) {
+        spill_row(row, sizeof(row), i);
+        push_string(&sb, row);
+        bytes += strlen(row);
+    }
+
+    CuAssertIntEquals(tc, 10000, scrollback_nrows(&sb));
+    CuAssertTrue(tc, sb.memory_first > 0);
+    CuAssertTrue(tc, sb.memory_first % SCROLLBACK_BLOCK_ROWS == 0);
+    CuAssertTrue(tc, sb.spill_size > 0);
+    CuAssertTrue(tc, sb.spill_size < bytes / 2);
+    CuAssertIntEquals(tc, 65536, sb.data.capacity);
+
+    for (int n = 1; n <= 10000; n++) {
+        spill_row(row, sizeof(row), 10000 - n);
+        cu_assert_row_equals(tc, &sb, n, row);
+    }
+    for (int i = 0; i < 10000; i += 997) {
+        spill_row(row, sizeof(row), i);
+        cu_assert_row_equals(tc, &sb, 10000 - i, row);
+    }
+
+    scrollback_free(&sb);
+}
+
+// `max_rows` still limits how many rows are kept when spilling.
+void test_scrollback_spill_max_rows(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(3000, 65536, &sb);
+    CuAssertTrue(tc, scrollback_enable_spill(&sb));
+
+    char row[64];
+    for (int i = 0; i < 10000; i++) {
+        spill_row(row, sizeof(row), i);
+        push_string(&sb, row);
+    }
+
+    CuAssertIntEquals(tc, 3000, scrollback_nrows(&sb));
+    CuAssertIntEquals(tc, 7000, scrollback_id(&sb, 3000));
+    CuAssertTrue(tc, sb.memory_first > sb.first);
+    for (int n = 1; n <= 3000; n++) {
+        spill_row(row, sizeof(row), 10000 - n);
+        cu_assert_row_equals(tc, &sb, n, row);
+    }
+
+    const void *data;
+    size_t len;
+    CuAssertTrue(tc, !scrollback_get_id(&sb, 6999, &data, &len));
+
+    scrollback_clear(&sb);
+    CuAssertIntEquals(tc, 0, scrollback_nrows(&sb));
+    CuAssertIntEquals(tc, 0, sb.spill_size);
+    push_string(&sb, "new");
+    cu_assert_row_equals(tc, &sb, 1, "new");
+
+    scrollback_free(&sb);
+}
+
+// A block that's larger than the whole buffer can never be spilled, so rows
+// are dropped like without spilling.
+void test_scrollback_spill_large_rows(CuTest *tc) {
+    struct scrollback sb;
+    scrollback_initialize(1000, 65536, &sb);
+    CuAssertTrue(tc, scrollback_enable_spill(&sb));
+
+    char row[1001];
+    for (int i = 0; i < 100; i++) {
+        memset(row, 'a' + i % 26, 1000);
+        row[1000] = '\0';
+        push_string(&sb, row);
+    }
+
+    CuAssertIntEquals(tc, 65, scrollback_nrows(&sb));
+    CuAssertIntEquals(tc, 0, sb.spill_size);
+    memset(row, 'a' + 99 % 26, 1000);
+    cu_assert_row_equals(tc, &sb, 1, row);
+
+    scrollback_free(&sb);
+}
+
+CuSuite *scrollback_test_suite() {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_scrollback_push_get);
+    SUITE_ADD_TEST(suite, test_scrollback_max_rows);
+    SUITE_ADD_TEST(suite, test_scrollback_max_bytes);
+    SUITE_ADD_TEST(suite, test_scrollback_grow);
+    SUITE_ADD_TEST(suite, test_scrollback_ids);
+    SUITE_ADD_TEST(suite, test_scrollback_blocks);
+    SUITE_ADD_TEST(suite, test_scrollback_clear);
+    SUITE_ADD_TEST(suite, test_scrollback_spill);
+    SUITE_ADD_TEST(suite, test_scrollback_spill_max_rows);
+    SUITE_ADD_TEST(suite, test_scrollback_spill_large_rows);
+    return suite;
+}
@@ -0,0 +1,162 @@
+#ifndef INCLUDED_SCROLLBACK_H
+#define INCLUDED_SCROLLBACK_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "./ringbuf.h"
+
+#include "./CuTest.h"
+
+/*
+  The scrollback buffer stores rows that have scrolled off the top of the
+  screen. This module doesn't care what a row is, to it a row is just a
+  variable length blob of bytes, see termbuf.c for how rows are encoded.
+
+  There are two limits to how much is stored: `max_rows` and `max_bytes`.
+  Whenever pushing a new row would exceed either of them, the oldest rows are
+  evicted until it doesn't.
+
+  Rows are stored back to back in a continous memory ringbuf. Every row gets an
+  id when it's pushed, the first row ever pushed has id 0, the one after that id
+  1 and so on. The rows still stored are the ids `first` through `end - 1`, so
+  anyone holding on to an id can tell if the row has been evicted since.
+
+  `index` is a ring that keeps track of where each row starts, the entry for
+  row `id` is `index[id % index_capacity]`. Each entry also records which id it
+  belongs to, as a safety net against reading an entry that has been reused.
+  Looking up a row is constant time no matter how much history there is.
+
+  Rows are also grouped into blocks of SCROLLBACK_BLOCK_ROWS rows, block `b`
+  being the rows with ids `b * SCROLLBACK_BLOCK_ROWS` and up. A block keeps a
+  summary of its rows, so that code that walks through the whole history can
+  skip a block at a time.
+
+  The ringbuf starts out small and doubles in size every time it fills up
+  until it reaches `max_bytes`, so a terminal that never prints much never uses
+  much memory.
+
+  SPILLING
+
+  With spilling enabled, see `scrollback_enable_spill`, rows that no longer fit
+  in memory aren't evicted right away. Instead the oldest block is compressed,
+  see compress.h, and appended to an unlinked temporary file, after which its
+  rows can be overwritten in the ringbuf. Then only `max_rows` limits how much
+  history is kept, while the memory used stays the same.
+
+  The rows `first` through `memory_first - 1` are spilled and the rows
+  `memory_first` through `end - 1` are in memory, without spilling the two are
+  the same. `index` only covers the rows in memory. A spilled block records
+  where in the file it is, and looking up a spilled row maps the file and
+  decompresses the whole block into `spill_cache`, which is where the next
+  row looked up is most likely to be anyway.
+
+  A block can only be spilled once all of its rows have been pushed. If the
+  memory runs out before that, which takes very large rows or a very small
+  `max_bytes`, the spilled rows are dropped together with the rows that are
+  overwritten, so that the rows stored are always consecutive.
+
+  A spilled block looks like this uncompressed:
+
+      uint32_t  nrows;
+      uint32_t  lens[nrows];
+      uint8_t   rows[];
+
+  If some of the block's rows were gone before it was spilled, `nrows` is less
+  than SCROLLBACK_BLOCK_ROWS and the block holds its last `nrows` rows.
+ */
+
+#define SCROLLBACK_DEFAULT_MAX_ROWS 100000
+#define SCROLLBACK_DEFAULT_MAX_BYTES (32 * 1024 * 1024)
+#define SCROLLBACK_INITIAL_BYTES (64 * 1024)
+// Rows larger than this can't be pushed.
+#define SCROLLBACK_MAX_ROW_BYTES (64 * 1024)
+#define SCROLLBACK_BLOCK_ROWS 256
+#define SCROLLBACK_INITIAL_INDEX_CAPACITY 1024
+
+struct scrollback_entry {
+    uint64_t id;
+    uint64_t position;  // Where the row starts, see `written`.
+    uint32_t len;
+};
+
+struct scrollback_block {
+    uint64_t id;
+    uint64_t position;  // Where its first row starts, see `written`.
+    uint64_t bytes;     // The size of all of its rows together.
+    uint32_t nrows;     // The number of rows pushed to it so far.
+    uint32_t max_len;   // The size of its largest row.
+    // Where in the spill file it is, `spill_len` is 0 unless it's spilled.
+    uint64_t spill_offset;
+    uint32_t spill_len;
+};
+
+struct scrollback {
+    struct ringbuf data;
+    size_t max_capacity;  // What `data` is allowed to grow to.
+    // Grows up to `max_rows` entries as rows are pushed.
+    struct scrollback_entry *index;
+    size_t index_capacity;
+    size_t max_rows;
+    // Enough blocks to cover `max_rows` rows.
+    struct scrollback_block *blocks;
+    size_t nblocks;
+    uint64_t first;
+    uint64_t memory_first;
+    uint64_t end;
+    // The total number of bytes written to `data` since it was last cleared.
+    uint64_t written;
+
+    // Spilling, `spill_fd` is -1 unless it's enabled.
+    int spill_fd;
+    uint64_t spill_size;     // The number of bytes appended to the file.
+    const uint8_t *spill_map;  // The file mapped read only, or NULL.
+    size_t spill_map_len;
+    // Blocks are put together and compressed here before they're spilled.
+    uint8_t *spill_buf;
+    size_t spill_buf_capacity;
+    // The last spilled block that was looked at, decompressed.
+    uint8_t *spill_cache;
+    size_t spill_cache_capacity;
+    uint64_t spill_cache_block;  // UINT64_MAX if there is none.
+};
+
+void scrollback_initialize(size_t max_rows,
+                           size_t max_bytes,
+                           struct scrollback *sb_ret);
+void scrollback_free(struct scrollback *sb);
+// Spill rows to a temporary file in $TMPDIR, or /tmp, instead of evicting
+// them, see SPILLING above. Returns false if the file couldn't be created.
+bool scrollback_enable_spill(struct scrollback *sb);
+// Remove all rows.
+void scrollback_clear(struct scrollback *sb);
+// The number of rows currently stored.
+size_t scrollback_nrows(struct scrollback *sb);
+// Push a new row of `len` bytes, returns a pointer to where the caller should
+// write the row.
+void *scrollback_push(struct scrollback *sb, size_t len);
+// Get row `n` counting from the most recently pushed row, which is row 1.
+// Returns false if there is no such row.
+bool scrollback_get(struct scrollback *sb,
+                    size_t n,
+                    const void **data_ret,
+                    size_t *len_ret);
+// The id of row `n` counting from the most recently pushed row.
+uint64_t scrollback_id(struct scrollback *sb, size_t n);
+// Get the row with id `id`, returns false if it has been evicted or hasn't
+// been pushed yet. The row is only valid until the next push or get.
+bool scrollback_get_id(struct scrollback *sb,
+                       uint64_t id,
+                       const void **data_ret,
+                       size_t *len_ret);
+// Get the summary of the block with id `id`, returns false if none of its rows
+// are stored. The summary covers all rows pushed to the block, including ones
+// that have since been evicted.
+bool scrollback_get_block(struct scrollback *sb,
+                          uint64_t id,
+                          struct scrollback_block *block_ret);
+
+CuSuite *scrollback_test_suite();
+
+#endif /* INCLUDED_SCROLLBACK_H */
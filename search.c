@@ -0,0 +1,408 @@
+#include "./search.h"
+
+#include <string.h>
+#include <assert.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "./scrollback.h"
+#include "./CuTest.h"
+
+// How many buckets are pruned every time a new block is started, all of them
+// are pruned once every SCROLLBACK_BLOCK_ROWS blocks.
+#define PRUNE_PER_BLOCK (SEARCH_BUCKETS / SCROLLBACK_BLOCK_ROWS)
+
+static uint8_t fold(uint8_t c) {
+    if (c == '\0') {
+        return ' ';
+    }
+    if ('A' <= c && c <= 'Z') {
+        return c - 'A' + 'a';
+    }
+    return c;
+}
+
+static uint32_t bucket(uint8_t a, uint8_t b, uint8_t c) {
+    uint32_t trigram = fold(a) | fold(b) << 8 | fold(c) << 16;
+    return (trigram * 2654435761u) >> 16;
+}
+
+void search_index_initialize(struct search_index *ix_ret) {
+    ix_ret->postings = calloc(SEARCH_BUCKETS, sizeof(struct search_postings));
+    ix_ret->seen = calloc(SEARCH_BUCKETS / 8, 1);
+    if (ix_ret->postings == NULL || ix_ret->seen == NULL) {
+        assert(false);
+    }
+    ix_ret->block = 0;
+    ix_ret->first_block = 0;
+    ix_ret->prune_next = 0;
+}
+
+void search_index_free(struct search_index *ix) {
+    for (size_t i = 0; i < SEARCH_BUCKETS; i++) {
+        free(ix->postings[i].blocks);
+    }
+    free(ix->postings);
+    free(ix->seen);
+}
+
+void search_index_clear(struct search_index *ix) {
+    for (size_t i = 0; i < SEARCH_BUCKETS; i++) {
+        ix->postings[i].start = 0;
+        ix->postings[i].len = 0;
+    }
+    memset(ix->seen, 0, SEARCH_BUCKETS / 8);
+}
+
+// Drop the entries before `first_block` from a posting list.
+static void prune(struct search_postings *p, uint64_t first_block) {
+    while (p->start < p->len && p->blocks[p->start] < first_block) {
+        p->start ++;
+    }
+
+    // Move what's left to the front once most of the list is stale.
+    if (p->start > 0 && p->start >= p->len / 2) {
+        memmove(p->blocks,
+                p->blocks + p->start,
+                (p->len - p->start) * sizeof(uint32_t));
+        p->len -= p->start;
+        p->start = 0;
+    }
+}
+
+static void append(struct search_postings *p, uint32_t block) {
+    if (p->len == p->capacity) {
+        p->capacity = p->capacity == 0 ? 4 : 2 * p->capacity;
+        p->blocks = realloc(p->blocks, p->capacity * sizeof(uint32_t));
+        if (p->blocks == NULL) {
+            assert(false);
+        }
+    }
+    p->blocks[p->len++] = block;
+}
+
+void search_index_add(struct search_index *ix,
+                      uint64_t id,
+                      uint64_t first_id,
+                      const uint8_t *text,
+                      size_t len) {
+    uint64_t block = id / SCROLLBACK_BLOCK_ROWS;
+    assert(block >= ix->block && block < UINT32_MAX);
+    ix->first_block = first_id / SCROLLBACK_BLOCK_ROWS;
+
+    if (block != ix->block) {
+        ix->block = block;
+        memset(ix->seen, 0, SEARCH_BUCKETS / 8);
+
+        for (size_t i = 0; i < PRUNE_PER_BLOCK; i++) {
+            prune(&ix->postings[ix->prune_next], ix->first_block);
+            ix->prune_next = (ix->prune_next + 1) % SEARCH_BUCKETS;
+        }
+    }
+
+    if (len < 3) {
+        return;
+    }
+
+    // This runs for every row pushed, so the trigram is rolled along rather
+    // than put together from scratch every time.
+    uint32_t trigram = fold(text[0]) << 8 | fold(text[1]) << 16;
+    for (size_t i = 2; i < len; i++) {
+        trigram = trigram >> 8 | fold(text[i]) << 16;
+        uint32_t b = (trigram * 2654435761u) >> 16;
+        if (ix->seen[b / 8] & (1 << (b % 8))) {
+            continue;
+        }
+        ix->seen[b / 8] |= 1 << (b % 8);
+        append(&ix->postings[b], block);
+    }
+}
+
+void search_query_initialize(const uint8_t *text,
+                             size_t len,
+                             struct search_query *q_ret) {
+    q_ret->nbuckets = 0;
+    for (size_t i = 0;
+         i + 2 < len && q_ret->nbuckets < SEARCH_MAX_TRIGRAMS;
+         i++) {
+        uint32_t b = bucket(text[i], text[i + 1], text[i + 2]);
+
+        bool duplicate = false;
+        for (size_t j = 0; j < q_ret->nbuckets; j++) {
+            duplicate |= q_ret->buckets[j] == b;
+        }
+        if (!duplicate) {
+            q_ret->buckets[q_ret->nbuckets++] = b;
+        }
+    }
+}
+
+// The index of the first entry in the list that is at least `block`.
+static uint32_t lower_bound(const struct search_postings *p, uint64_t block) {
+    uint32_t lo = p->start;
+    uint32_t hi = p->len;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (p->blocks[mid] < block) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+  Both of these look for a block that's in every posting list of the query by
+  leapfrogging: The candidate is moved to the closest entry of each list in
+  turn, until it stops moving.
+ */
+
+bool search_index_prev_block(struct search_index *ix,
+                             const struct search_query *q,
+                             uint64_t block,
+                             uint64_t *block_ret) {
+    uint64_t candidate = block;
+
+    for (size_t agreed = 0, i = 0; agreed < q->nbuckets; ) {
+        const struct search_postings *p = &ix->postings[q->buckets[i]];
+
+        // The last entry no newer than the candidate.
+        uint32_t k = lower_bound(p, candidate + 1);
+        if (k == p->start || p->blocks[k - 1] < ix->first_block) {
+            return false;
+        }
+
+        if (p->blocks[k - 1] == candidate) {
+            agreed ++;
+        } else {
+            candidate = p->blocks[k - 1];
+            agreed = 1;
+        }
+        i = (i + 1) % q->nbuckets;
+    }
+
+    if (candidate < ix->first_block) {
+        return false;
+    }
+    *block_ret = candidate;
+    return true;
+}
+
+bool search_index_next_block(struct search_index *ix,
+                             const struct search_query *q,
+                             uint64_t block,
+                             uint64_t *block_ret) {
+    uint64_t candidate = block < ix->first_block ? ix->first_block : block;
+
+    for (size_t agreed = 0, i = 0; agreed < q->nbuckets; ) {
+        const struct search_postings *p = &ix->postings[q->buckets[i]];
+
+        uint32_t k = lower_bound(p, candidate);
+        if (k == p->len) {
+            return false;
+        }
+
+        if (p->blocks[k] == candidate) {
+            agreed ++;
+        } else {
+            candidate = p->blocks[k];
+            agreed = 1;
+        }
+        i = (i + 1) % q->nbuckets;
+    }
+
+    *block_ret = candidate;
+    return true;
+}
+
+/*
+  The idea is from http://0x80.pl/articles/simd-strfind.html: Compare the first
+  and the last byte of the needle against 16 positions of the haystack at once,
+  and only compare the rest of the needle where both of them matched.
+ */
+const uint8_t *search_memmem(const uint8_t *haystack,
+                             size_t haystack_len,
+                             const uint8_t *needle,
+                             size_t needle_len) {
+    if (needle_len == 0) {
+        return haystack;
+    }
+    if (needle_len > haystack_len) {
+        return NULL;
+    }
+
+    size_t i = 0;
+    size_t last = needle_len - 1;
+
+#ifdef __SSE2__
+    const __m128i first_byte = _mm_set1_epi8(needle[0]);
+    const __m128i last_byte = _mm_set1_epi8(needle[last]);
+
+    for (; i + last + 16 <= haystack_len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (haystack + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (haystack + i + last));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first_byte),
+                          _mm_cmpeq_epi8(b, last_byte)));
+
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(haystack + i + bit, needle, needle_len) == 0) {
+                return haystack + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i + needle_len <= haystack_len; i++) {
+        if (haystack[i] == needle[0]
+            && memcmp(haystack + i, needle, needle_len) == 0) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+
+
+////////////////
+// UNIT TESTS //
+////////////////
+
+
+
+static void index_row(struct search_index *ix,
+                      uint64_t id,
+                      uint64_t first_id,
+                      const char *text) {
+    search_index_add(ix, id, first_id, (const uint8_t *) text, strlen(text));
+}
+
+static void query(const char *text, struct search_query *q) {
+    search_query_initialize((const uint8_t *) text, strlen(text), q);
+}
+
+void test_search_index(CuTest *tc) {
+    struct search_index ix;
+    search_index_initialize(&ix);
+
+    // Block 0 says hello, block 1 says goodbye and block 2 says both.
+    for (uint64_t id = 0; id < 3 * SCROLLBACK_BLOCK_ROWS; id++) {
+        const char *text = "nothing";
+        if (id == 10 || id == 2 * SCROLLBACK_BLOCK_ROWS + 5) {
+            text = "Hello World";
+        }
+        if (id == SCROLLBACK_BLOCK_ROWS + 7
+            || id == 3 * SCROLLBACK_BLOCK_ROWS - 1) {
+            text = "goodbye world";
+        }
+        index_row(&ix, id, 0, text);
+    }
+
+    struct search_query q;
+    uint64_t block = 0;
+
+    query("hello", &q);
+    CuAssertTrue(tc, search_index_prev_block(&ix, &q, 2, &block));
+    CuAssertIntEquals(tc, 2, block);
+    CuAssertTrue(tc, search_index_prev_block(&ix, &q, 1, &block));
+    CuAssertIntEquals(tc, 0, block);
+    CuAssertTrue(tc, search_index_next_block(&ix, &q, 1, &block));
+    CuAssertIntEquals(tc, 2, block);
+    CuAssertTrue(tc, !search_index_next_block(&ix, &q, 3, &block));
+
+    // Case insensitive.
+    query("WORLD", &q);
+    CuAssertTrue(tc, search_index_prev_block(&ix, &q, 1, &block));
+    CuAssertIntEquals(tc, 1, block);
+
+    query("goodbye", &q);
+    CuAssertTrue(tc, !search_index_prev_block(&ix, &q, 0, &block));
+
+    query("not there", &q);
+    CuAssertTrue(tc, !search_index_prev_block(&ix, &q, 2, &block));
+    CuAssertTrue(tc, !search_index_next_block(&ix, &q, 0, &block));
+
+    // Too short to say anything.
+    query("zz", &q);
+    CuAssertTrue(tc, search_index_prev_block(&ix, &q, 1, &block));
+    CuAssertIntEquals(tc, 1, block);
+
+    search_index_free(&ix);
+}
+
+// Evicted blocks are never returned, and are eventually pruned.
+void test_search_index_prune(CuTest *tc) {
+    struct search_index ix;
+    search_index_initialize(&ix);
+
+    index_row(&ix, 0, 0, "needle");
+    for (uint64_t block = 1; block <= SCROLLBACK_BLOCK_ROWS + 1; block++) {
+        index_row(&ix,
+                  block * SCROLLBACK_BLOCK_ROWS,
+                  block * SCROLLBACK_BLOCK_ROWS,
+                  "hay");
+    }
+
+    struct search_query q;
+    uint64_t block;
+    query("needle", &q);
+    CuAssertTrue(tc, !search_index_prev_block(&ix, &q, 100, &block));
+    CuAssertTrue(tc, !search_index_next_block(&ix, &q, 0, &block));
+    for (size_t i = 0; i < q.nbuckets; i++) {
+        const struct search_postings *p = &ix.postings[q.buckets[i]];
+        CuAssertIntEquals(tc, p->start, p->len);
+    }
+
+    search_index_free(&ix);
+}
+
+void test_search_memmem(CuTest *tc) {
+    char haystack[200];
+    for (size_t i = 0; i < sizeof(haystack); i++) {
+        haystack[i] = 'a' + i % 7;
+    }
+
+    // Compare against the obvious implementation, for needles of every length
+    // and at every position, so both the SSE2 loop and the tail are covered.
+    for (size_t len = 1; len < 20; len++) {
+        for (size_t pos = 0; pos + len <= sizeof(haystack); pos += 3) {
+            const char *needle = haystack + pos;
+            const uint8_t *expected = NULL;
+            for (size_t i = 0; i + len <= sizeof(haystack); i++) {
+                if (memcmp(haystack + i, needle, len) == 0) {
+                    expected = (uint8_t *) haystack + i;
+                    break;
+                }
+            }
+            const uint8_t *found = search_memmem((uint8_t *) haystack,
+                                                 sizeof(haystack),
+                                                 (uint8_t *) needle,
+                                                 len);
+            CuAssertPtrEquals(tc, (void *) expected, (void *) found);
+        }
+    }
+
+    CuAssertPtrEquals(tc,
+                      NULL,
+                      (void *) search_memmem((uint8_t *) haystack,
+                                             sizeof(haystack),
+                                             (uint8_t *) "xyz",
+                                             3));
+    CuAssertPtrEquals(tc,
+                      NULL,
+                      (void *) search_memmem((uint8_t *) "ab", 2,
+                                             (uint8_t *) "abc", 3));
+}
+
+CuSuite *search_test_suite() {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, test_search_index);
+    SUITE_ADD_TEST(suite, test_search_index_prune);
+    SUITE_ADD_TEST(suite, test_search_memmem);
+    return suite;
+}
@@ -0,0 +1,94 @@
+#ifndef INCLUDED_SEARCH_H
+#define INCLUDED_SEARCH_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "./CuTest.h"
+
+/*
+  A trigram index over the text of the rows in the scrollback buffer, so that
+  searching a long history only has to look at the rows that could possibly
+  match, see `termbuf_search` for the search itself.
+
+  Rows are indexed in the same blocks of SCROLLBACK_BLOCK_ROWS rows as in
+  scrollback.h, what the index can tell is which blocks have every trigram
+  (three consecutive bytes) of the text searched for in them. Those blocks are
+  then checked row by row. Per block rather than per row keeps the index small,
+  and a spilled block only has to be decompressed once.
+
+  Trigrams are hashed into SEARCH_BUCKETS buckets and each bucket has a posting
+  list, the ids of the blocks that have any of its trigrams, in increasing
+  order. Since rows are always added to the newest block, a block is appended
+  to a list at most once, which `seen` keeps track of.
+
+  The index is case insensitive, ASCII letters are folded to lower case, and
+  empty cells ('\0' in the text) count as spaces. Hash collisions and folding
+  only mean that some blocks are checked for no reason.
+
+  Blocks that are evicted from the scrollback buffer are pruned from the
+  posting lists a few buckets at a time, every time a new block is started.
+ */
+
+#define SEARCH_BUCKETS (1 << 16)
+// Longer queries only use their first few trigrams, it's enough to narrow
+// things down.
+#define SEARCH_MAX_TRIGRAMS 32
+
+struct search_postings {
+    uint32_t *blocks;
+    uint32_t start;  // Entries before this have been pruned.
+    uint32_t len;
+    uint32_t capacity;
+};
+
+struct search_index {
+    struct search_postings *postings;
+    uint8_t *seen;  // A bit for each bucket, set if `block` is in its list.
+    uint64_t block;
+    uint64_t first_block;  // Entries before this are stale.
+    size_t prune_next;
+};
+
+struct search_query {
+    uint32_t buckets[SEARCH_MAX_TRIGRAMS];
+    size_t nbuckets;
+};
+
+void search_index_initialize(struct search_index *ix_ret);
+void search_index_free(struct search_index *ix);
+void search_index_clear(struct search_index *ix);
+// Add the text of the row with id `id`, `first_id` is the oldest row that's
+// still stored. Rows have to be added in order.
+void search_index_add(struct search_index *ix,
+                      uint64_t id,
+                      uint64_t first_id,
+                      const uint8_t *text,
+                      size_t len);
+
+void search_query_initialize(const uint8_t *text,
+                             size_t len,
+                             struct search_query *q_ret);
+// The newest block no newer than `block` that might contain the query, returns
+// false if there is none. A query shorter than a trigram matches every block.
+bool search_index_prev_block(struct search_index *ix,
+                             const struct search_query *q,
+                             uint64_t block,
+                             uint64_t *block_ret);
+// The oldest block no older than `block` that might contain the query.
+bool search_index_next_block(struct search_index *ix,
+                             const struct search_query *q,
+                             uint64_t block,
+                             uint64_t *block_ret);
+
+// Like memmem(3), but compares 16 positions at a time with SSE2 when it's
+// available.
+const uint8_t *search_memmem(const uint8_t *haystack,
+                             size_t haystack_len,
+                             const uint8_t *needle,
+                             size_t needle_len);
+
+CuSuite *search_test_suite();
+
+#endif /* INCLUDED_SEARCH_H */
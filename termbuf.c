@@ -4,8 +4,12 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
 #include <assert.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "./min-terminal.h"
 #include "./diagnostics.h"
@@ -14,7 +18,6 @@
 
 #include "./termbuf.h"
 #include "./handlers.h"
-#include "./rendering.h"
 
 
 
@@ -344,18 +347,17 @@ void assert_in_bounds(struct termbuf *tb, struct pair_s xy, struct pair_s wh) {
 }
 
 /*
-  Goven a row-col pair, calculate what inded into memory the one-dimenional
-  termbuf_char buffer it corresponds to.
+  Given a row-col pair, get the termbuf_char it corresponds to.
  */
-int pair_to_offset(struct termbuf *tb,
-                   struct pair_s p) {
-    return (p.y - 1) * tb->ncols + p.x - 1;
+struct termbuf_char *pair_to_cell(struct termbuf *tb,
+                                  struct pair_s p) {
+    return termbuf_row(tb, p.y) + p.x - 1;
 }
 
 /*
   Given a row-col pair `dest` and a height-width pair `count`, clear out all the
   cells in that rectangle by setting the termbuf_char's `flag` variable to
-  `FLAG_LENGTH_0`.
+  `FLAG_LENGTH_0`. Rows erased up to the last column no longer wrap around.
  */
 void termbuf_memzero(struct termbuf *tb,
                     struct pair_s dest,
@@ -367,15 +369,19 @@ void termbuf_memzero(struct termbuf *tb,
 
             // This makes the terminal display the memzero'ed area in red, good
             // for debugging.
-            // tb->buf[pair_to_offset(tb, pair(row, col))] =
+            // *pair_to_cell(tb, pair(row, col)) =
             //     (struct termbuf_char) {
             //     .flags = FLAG_LENGTH_1,
             //     .utf8_char = { ' ', 0, 0, 0 },
             //     .bg.r = 255,
             // };
 
-            tb->buf[(row - 1) * tb->ncols + col - 1].flags = FLAG_LENGTH_0;
+            termbuf_row(tb, row)[col - 1].flags = FLAG_LENGTH_0;
         }
+        if (dest.x + count.x - 1 == tb->ncols) {
+            *termbuf_row_wrapped(tb, row) = false;
+        }
+        termbuf_damage_span(tb, row, dest.x, dest.x + count.x - 1);
     }
 }
 
@@ -402,7 +408,7 @@ void termbuf_memmove(struct termbuf *tb,
     struct termbuf_char *p = temp;
     for (int row = src.y; row < src.y + count.y; row ++) {
         for (int col = src.x ; col < src.x + count.x; col++) {
-            *p = tb->buf[pair_to_offset(tb, pair(row, col))];
+            *p = *pair_to_cell(tb, pair(row, col));
             p++;
         }
     }
@@ -411,9 +417,10 @@ void termbuf_memmove(struct termbuf *tb,
     p = temp;
     for (int row = dest.y; row < dest.y + count.y; row ++) {
         for (int col = dest.x ; col < dest.x + count.x; col++) {
-            tb->buf[pair_to_offset(tb, pair(row, col))] = *p;
+            *pair_to_cell(tb, pair(row, col)) = *p;
             p++;
         }
+        termbuf_damage_span(tb, row, dest.x, dest.x + count.x - 1);
     }
 
     free(temp);
@@ -421,6 +428,208 @@ void termbuf_memmove(struct termbuf *tb,
 
 
 
+/*
+  Get the slot in the `rows` ring that holds the pointer to `row`.
+ */
+struct termbuf_char **row_slot(struct termbuf *tb, int row) {
+    int i = tb->row_head + row - 1;
+    if (i >= tb->nrows) {
+        i -= tb->nrows;
+    }
+    return tb->rows + i;
+}
+
+/*
+  Reverse the order of the rows `srow` through `erow` (inclusive) by swapping
+  the row pointers, leaving the cells themselves where they are.
+ */
+void reverse_rows(struct termbuf *tb, int srow, int erow) {
+    while (srow < erow) {
+        struct termbuf_char **a = row_slot(tb, srow);
+        struct termbuf_char **b = row_slot(tb, erow);
+        struct termbuf_char *tmp = *a;
+        *a = *b;
+        *b = tmp;
+        srow ++;
+        erow --;
+    }
+}
+
+/*
+  Rotate the rows `srow` through `erow` (inclusive) up `n` steps, so that the
+  `n` topmost rows end up at the bottom. This is the classic three reversals
+  trick, so it needs no temporary memory and touches each row pointer at most
+  twice.
+ */
+void rotate_rows_up(struct termbuf *tb, int srow, int erow, int n) {
+    assert(1 <= srow && srow <= erow && erow <= tb->nrows);
+    assert(0 <= n && n <= erow - srow + 1);
+
+    if (n == 0 || n == erow - srow + 1) {
+        return;
+    }
+
+    // The whole screen, this we can do by just moving the head.
+    if (srow == 1 && erow == tb->nrows) {
+        tb->row_head = (tb->row_head + n) % tb->nrows;
+        return;
+    }
+
+    reverse_rows(tb, srow, srow + n - 1);
+    reverse_rows(tb, srow + n, erow);
+    reverse_rows(tb, srow, erow);
+}
+
+/*
+  Get the cells, the row pointers and the soft wrap flags for a `nrows` by
+  `ncols` screen, all cleared. The rows are laid out one after the other from
+  the start of `buf`, in order.
+
+  Resizing needs somewhere to put the new screen while the old one is still
+  around, and dragging the edge of the window resizes a lot. So the storage
+  that the old screen leaves behind is kept as `spare`, see `give_rows`, and
+  is taken here the next time if it's large enough. New storage gets some room
+  to grow as well, so that growing the window a little at a time doesn't
+  allocate every time either.
+ */
+static void take_rows(struct termbuf *tb,
+                      int nrows,
+                      int ncols,
+                      struct termbuf_storage *storage_ret) {
+    struct termbuf_storage *spare = &tb->spare;
+    if (spare->buf != NULL
+        && spare->rows_capacity >= nrows
+        && spare->cells_capacity >= nrows * ncols) {
+        *storage_ret = *spare;
+        spare->buf = NULL;
+        memset(storage_ret->buf,
+               0,
+               nrows * ncols * sizeof(struct termbuf_char));
+        memset(storage_ret->wrapped, 0, nrows * sizeof(bool));
+    } else {
+        storage_ret->rows_capacity = nrows + nrows / 4;
+        storage_ret->cells_capacity = storage_ret->rows_capacity
+                                      * (ncols + ncols / 4);
+
+        storage_ret->buf = calloc(storage_ret->cells_capacity,
+                                  sizeof(struct termbuf_char));
+        if (storage_ret->buf == NULL) {
+            assert(false);
+        }
+
+        storage_ret->wrapped = calloc(storage_ret->rows_capacity,
+                                      sizeof(bool));
+        if (storage_ret->wrapped == NULL) {
+            assert(false);
+        }
+
+        storage_ret->rows = malloc(storage_ret->rows_capacity
+                                   * sizeof(struct termbuf_char *));
+        if (storage_ret->rows == NULL) {
+            assert(false);
+        }
+    }
+
+    for (int i = 0; i < nrows; i++) {
+        storage_ret->rows[i] = storage_ret->buf + i * ncols;
+    }
+}
+
+static void free_rows(struct termbuf_storage *storage) {
+    if (storage->buf == NULL) {
+        return;
+    }
+    free(storage->buf);
+    free(storage->rows);
+    free(storage->wrapped);
+}
+
+// Hand back `storage` once it's no longer used. It's kept as the spare unless
+// the spare we have is larger.
+static void give_rows(struct termbuf *tb, struct termbuf_storage *storage) {
+    if (tb->spare.buf != NULL
+        && tb->spare.cells_capacity >= storage->cells_capacity) {
+        free_rows(storage);
+        return;
+    }
+    free_rows(&tb->spare);
+    tb->spare = *storage;
+}
+
+// The storage of the buffer in use.
+static struct termbuf_storage current_rows(struct termbuf *tb) {
+    return (struct termbuf_storage) {
+        .buf = tb->buf,
+        .rows = tb->rows,
+        .wrapped = tb->wrapped,
+        .rows_capacity = tb->rows_capacity,
+        .cells_capacity = tb->cells_capacity,
+    };
+}
+
+// Use `storage` for the buffer in use, with its first row at the top.
+static void use_rows(struct termbuf *tb,
+                     const struct termbuf_storage *storage) {
+    tb->buf = storage->buf;
+    tb->rows = storage->rows;
+    tb->wrapped = storage->wrapped;
+    tb->rows_capacity = storage->rows_capacity;
+    tb->cells_capacity = storage->cells_capacity;
+    tb->row_head = 0;
+}
+
+
+
+/////////////////////
+// DAMAGE TRACKING //
+/////////////////////
+
+
+
+/*
+  Re-drawing every cell on every frame is wasteful when, say, the shell just
+  echoed a single character back to us. So everything that modifies `buf` also
+  records which cells it touched in `damage`, and the renderer only re-draws
+  the damaged cells, keeping the rest of the previous frame as it is.
+
+  We only keep one span per row, if two disjoint parts of a row are damaged we
+  record the smallest span covering both of them. In practice it's rare for
+  this to cover many more cells than needed.
+ */
+
+void termbuf_damage_span(struct termbuf *tb, int row, int scol, int ecol) {
+    assert(1 <= row && row <= tb->nrows);
+    assert(scol <= ecol);
+
+    struct termbuf_damage *d = &tb->damage[row - 1];
+    d->start = scol < d->start ? scol : d->start;
+    d->end   = ecol > d->end   ? ecol : d->end;
+}
+
+void termbuf_damage_rows(struct termbuf *tb, int srow, int erow) {
+    for (int row = srow; row <= erow; row++) {
+        tb->damage[row - 1] = (struct termbuf_damage) {
+            .start = 1,
+            .end = tb->ncols,
+        };
+    }
+}
+
+void termbuf_damage_all(struct termbuf *tb) {
+    termbuf_damage_rows(tb, 1, tb->nrows);
+}
+
+void termbuf_damage_clear(struct termbuf *tb) {
+    for (int row = 1; row <= tb->nrows; row++) {
+        tb->damage[row - 1] = (struct termbuf_damage) {
+            .start = tb->ncols + 1,
+            .end = 0,
+        };
+    }
+}
+
+
+
 //////////////////
 // REST OF CODE //
 //////////////////
@@ -458,13 +667,23 @@ void termbuf_initialize(int nrows,
 
     tb_ret->p_state = P_STATE_GROUND;
 
-    tb_ret->buf = calloc(nrows * ncols, sizeof(struct termbuf_char));
-    if (tb_ret->buf == NULL) {
-        assert(false);
-    }
+    tb_ret->spare.buf = NULL;
+    struct termbuf_storage storage;
+    take_rows(tb_ret, nrows, ncols, &storage);
+    use_rows(tb_ret, &storage);
+    tb_ret->scroll_top = 1;
+    tb_ret->scroll_bottom = nrows;
 
     tabstops_initialize(&tb_ret->tabstops);
-    ringbuf_initialize(RINGBUF_CAPACITY_1KiB, true, &tb_ret->scrollback);
+    scrollback_initialize(SCROLLBACK_DEFAULT_MAX_ROWS,
+                          SCROLLBACK_DEFAULT_MAX_BYTES,
+                          &tb_ret->scrollback);
+    tb_ret->scrollback_cells = NULL;
+    tb_ret->scrollback_cells_capacity = 0;
+    tb_ret->view.ncols = 0;
+    search_index_initialize(&tb_ret->search_index);
+    tb_ret->search_text = NULL;
+    tb_ret->search_text_capacity = 0;
 
     tb_ret->palette = malloc(256 * 3);
     if (tb_ret->palette == NULL) {
@@ -473,15 +692,33 @@ void termbuf_initialize(int nrows,
     memcpy(tb_ret->palette, default_palette, 256 * 3);
 
     tb_ret->mainbuf = NULL;
+    tb_ret->mainrows = NULL;
+    tb_ret->mainwrapped = NULL;
+
+    tb_ret->damage = malloc(nrows * sizeof(struct termbuf_damage));
+    if (tb_ret->damage == NULL) {
+        assert(false);
+    }
+    tb_ret->damage_capacity = nrows;
+    termbuf_damage_all(tb_ret);
 }
 
 void termbuf_free(struct termbuf *tb) {
     free(tb->buf);
-    ringbuf_free(&tb->scrollback);
+    free(tb->rows);
+    free(tb->wrapped);
+    free_rows(&tb->spare);
+    scrollback_free(&tb->scrollback);
+    free(tb->scrollback_cells);
+    search_index_free(&tb->search_index);
+    free(tb->search_text);
     free(tb->palette);
     if (tb->mainbuf != NULL) {
         free(tb->mainbuf);
+        free(tb->mainrows);
+        free(tb->mainwrapped);
     }
+    free(tb->damage);
 }
 
 void swap_saved_cursors(struct termbuf *tb) {
@@ -495,182 +732,1432 @@ void swap_saved_cursors(struct termbuf *tb) {
     tb->alt_saved_col = tmp;
 }
 
+// Swap the current buffer with the one stored in `mainbuf`.
+void swap_buffers(struct termbuf *tb) {
+    struct termbuf_char *tmp_buf = tb->buf;
+    tb->buf = tb->mainbuf;
+    tb->mainbuf = tmp_buf;
+
+    struct termbuf_char **tmp_rows = tb->rows;
+    tb->rows = tb->mainrows;
+    tb->mainrows = tmp_rows;
+
+    bool *tmp_wrapped = tb->wrapped;
+    tb->wrapped = tb->mainwrapped;
+    tb->mainwrapped = tmp_wrapped;
+
+    int tmp_head = tb->row_head;
+    tb->row_head = tb->main_row_head;
+    tb->main_row_head = tmp_head;
+
+    int tmp_capacity = tb->rows_capacity;
+    tb->rows_capacity = tb->main_rows_capacity;
+    tb->main_rows_capacity = tmp_capacity;
+
+    tmp_capacity = tb->cells_capacity;
+    tb->cells_capacity = tb->main_cells_capacity;
+    tb->main_cells_capacity = tmp_capacity;
+}
+
 void termbuf_use_alternate_buffer(struct termbuf *tb) {
     assert(tb->mainbuf == NULL);
 
     tb->mainbuf = tb->buf;
-    tb->buf = calloc(tb->nrows * tb->ncols, sizeof(struct termbuf_char));
-    assert(tb->buf != NULL);
+    tb->mainrows = tb->rows;
+    tb->mainwrapped = tb->wrapped;
+    tb->main_row_head = tb->row_head;
+    tb->main_rows_capacity = tb->rows_capacity;
+    tb->main_cells_capacity = tb->cells_capacity;
+    struct termbuf_storage storage;
+    take_rows(tb, tb->nrows, tb->ncols, &storage);
+    use_rows(tb, &storage);
 
     swap_saved_cursors(tb);
+    termbuf_damage_all(tb);
 }
 
 void termbuf_use_main_buffer(struct termbuf *tb) {
     assert(tb->mainbuf != NULL);
 
-    free(tb->buf);
-    tb->buf = tb->mainbuf;
+    struct termbuf_storage alternate = current_rows(tb);
+    swap_buffers(tb);
+    give_rows(tb, &alternate);
     tb->mainbuf = NULL;
+    tb->mainrows = NULL;
+    tb->mainwrapped = NULL;
 
     swap_saved_cursors(tb);
+    termbuf_damage_all(tb);
+}
+
+/*
+  Called when we're about to write a character but the cursor is past the last
+  column. Moves the cursor to the start of the next line if wrapping is
+  enabled, and returns false if the character should be dropped.
+ */
+bool wrap_cursor(struct termbuf *tb) {
+    // Check if we should wrap text or not?
+    if ((tb->flags & FLAG_DECAWM) == 0) {
+        // If no wrapping we let this all be a no-op.
+        // If this the way it should be? I don't know but I think it's
+        // consistent with how st does it.
+        return false;
+    }
+
+    // The text goes on in the next row, remember that for when the row is
+    // searched, see `termbuf_search_regex`.
+    *termbuf_row_wrapped(tb, tb->row) = true;
+
+    tb->col = 1;
+    if (tb->row == tb->scroll_bottom) {
+        termbuf_shift(tb);
+    } else if (tb->row < tb->nrows) {
+        tb->row ++;
+    }
+    return true;
 }
 
 void termbuf_insert(struct termbuf *tb, const uint8_t *utf8_char, int len) {
     assert(len > 0);
     assert(len <= 4);
 
-    if (tb->col > tb->ncols) {
-        // Check if we should wrap text or not?
-        if ((tb->flags & FLAG_DECAWM) == 0) {
-            // If no wrapping we let this all be a no-op.
-            // If this the way it should be? I don't know but I think it's
-            // consistent with how st does it.
-            return;
-        } else { // AAAAH look at all this spagethi ;-;
-            tb->col = 1;
-            tb->row ++;
-            if (tb->row > tb->nrows) {
-                tb->row = tb->nrows;
-                termbuf_shift(tb);
-            }
-        }
+    if (tb->col > tb->ncols && !wrap_cursor(tb)) {
+        return;
+    }
+    // Text written from the start of a row replaces what was there, it only
+    // wraps around again if it reaches the end.
+    if (tb->col == 1) {
+        *termbuf_row_wrapped(tb, tb->row) = false;
     }
 
-    size_t index = (tb->row - 1) * tb->ncols + (tb->col - 1);
-    memcpy(tb->buf[index].utf8_char, utf8_char, len);
+    struct termbuf_char *c = termbuf_row(tb, tb->row) + tb->col - 1;
+    memcpy(c->utf8_char, utf8_char, len);
     tb->flags = (tb->flags & ~FLAG_LENGTH_MASK) | len;
 
     if ((tb->flags & FLAG_INVERT_COLORS) == 0) {
-        tb->buf[index].flags = tb->flags;
-        tb->buf[index].fg.r = tb->fg.r;
-        tb->buf[index].fg.g = tb->fg.g;
-        tb->buf[index].fg.b = tb->fg.b;
-        tb->buf[index].bg.r = tb->bg.r;
-        tb->buf[index].bg.g = tb->bg.g;
-        tb->buf[index].bg.b = tb->bg.b;
+        c->flags = tb->flags;
+        c->fg.r = tb->fg.r;
+        c->fg.g = tb->fg.g;
+        c->fg.b = tb->fg.b;
+        c->bg.r = tb->bg.r;
+        c->bg.g = tb->bg.g;
+        c->bg.b = tb->bg.b;
     } else { // When the FLAG_INVERT_COLORS is set we set the fg to the bg and
              // vice-versa.
-        tb->buf[index].flags = tb->flags;
-        tb->buf[index].fg.r = tb->bg.r;
-        tb->buf[index].fg.g = tb->bg.g;
-        tb->buf[index].fg.b = tb->bg.b;
-        tb->buf[index].bg.r = tb->fg.r;
-        tb->buf[index].bg.g = tb->fg.g;
-        tb->buf[index].bg.b = tb->fg.b;
+        c->flags = tb->flags;
+        c->fg.r = tb->bg.r;
+        c->fg.g = tb->bg.g;
+        c->fg.b = tb->bg.b;
+        c->bg.r = tb->fg.r;
+        c->bg.g = tb->fg.g;
+        c->bg.b = tb->fg.b;
     }
 
+    termbuf_damage_span(tb, tb->row, tb->col, tb->col);
+
     // NB. Here we might end up setting the cursor just outside of the view,
     //     hence the check at the begining of this function.
     tb->col ++;
 }
 
+void termbuf_insert_run(struct termbuf *tb, const uint8_t *ascii, size_t len) {
+    tb->flags = (tb->flags & ~FLAG_LENGTH_MASK) | FLAG_LENGTH_1;
+
+    // All the cells look the same except for the character itself.
+    struct termbuf_char template = {
+        .utf8_char = { 0, 0, 0, 0 },
+        .flags = tb->flags,
+        .fg = tb->fg,
+        .bg = tb->bg,
+    };
+    if (tb->flags & FLAG_INVERT_COLORS) {
+        template.fg = tb->bg;
+        template.bg = tb->fg;
+    }
+
+    while (len > 0) {
+        if (tb->col > tb->ncols && !wrap_cursor(tb)) {
+            return;
+        }
+        // See `termbuf_insert`.
+        if (tb->col == 1) {
+            *termbuf_row_wrapped(tb, tb->row) = false;
+        }
+
+        // Fill up as much of the current row as we can in one go.
+        size_t n = tb->ncols - tb->col + 1;
+        n = len < n ? len : n;
+
+        struct termbuf_char *c = termbuf_row(tb, tb->row) + tb->col - 1;
+        for (size_t i = 0; i < n; i++) {
+            c[i] = template;
+            c[i].utf8_char[0] = ascii[i];
+        }
+
+        termbuf_damage_span(tb, tb->row, tb->col, tb->col + n - 1);
+
+        tb->col += n;
+        ascii += n;
+        len -= n;
+    }
+}
+
 void termbuf_shift(struct termbuf *tb) {
-    size_t bytes_per_row = tb->ncols * sizeof(struct termbuf_char);
+    termbuf_scroll_up(tb, tb->scroll_top, tb->scroll_bottom, 1);
+}
 
-    // Copy the top line in the buffer into the scrollback buffer
-    termbuf_scrollback_push_row(tb, tb->buf, tb->ncols);
+/*
+  Scroll the rows `srow` through `erow` up `n` rows, if `to_scrollback` is set
+  the rows that are scrolled out are pushed into the scrollback buffer.
+ */
+void scroll_rows_up(struct termbuf *tb,
+                    int srow,
+                    int erow,
+                    int n,
+                    bool to_scrollback) {
+    assert(1 <= srow && srow <= erow && erow <= tb->nrows);
+
+    n = n > erow - srow + 1 ? erow - srow + 1 : n;
+
+    if (to_scrollback) {
+        for (int row = 1; row <= n; row++) {
+            termbuf_scrollback_push_row(tb,
+                                        termbuf_row(tb, row),
+                                        tb->ncols,
+                                        *termbuf_row_wrapped(tb, row));
+        }
+    }
+
+    rotate_rows_up(tb, srow, erow, n);
 
-    memmove(tb->buf,
-            tb->buf + tb->ncols,
-            (tb->nrows - 1) * bytes_per_row);
-    memset(tb->buf + (tb->nrows - 1) * tb->ncols, 0, bytes_per_row);
+    for (int row = erow - n + 1; row <= erow; row++) {
+        memset(termbuf_row(tb, row), 0, tb->ncols * sizeof(struct termbuf_char));
+        *termbuf_row_wrapped(tb, row) = false;
+    }
+
+    // Every row in the region moved.
+    termbuf_damage_rows(tb, srow, erow);
 }
 
-void termbuf_resize(struct termbuf *tb, int nnrows, int nncols) {
-    assert(nnrows > 0);
-    assert(nncols > 0);
+void termbuf_scroll_up(struct termbuf *tb, int srow, int erow, int n) {
+    // Only the rows leaving the top of the screen go into the scrollback
+    // buffer.
+    scroll_rows_up(tb, srow, erow, n, srow == 1);
+}
+
+void termbuf_scroll_down(struct termbuf *tb, int srow, int erow, int n) {
+    assert(1 <= srow && srow <= erow && erow <= tb->nrows);
 
-    struct termbuf_char *new_buf = calloc(nnrows * nncols,
-                                          sizeof(struct termbuf_char));
+    n = n > erow - srow + 1 ? erow - srow + 1 : n;
+
+    // Rotating down n steps is the same as rotating up by the rest.
+    rotate_rows_up(tb, srow, erow, (erow - srow + 1) - n);
+
+    for (int row = srow; row < srow + n; row++) {
+        memset(termbuf_row(tb, row), 0, tb->ncols * sizeof(struct termbuf_char));
+        *termbuf_row_wrapped(tb, row) = false;
+    }
+
+    termbuf_damage_rows(tb, srow, erow);
+}
+
+/*
+  Resize the buffer currently in use, keeping the top left corner of it's
+  contents. Used for the alternate buffer, the programs that use it redraw
+  everything when they're resized anyway.
+ */
+void resize_rows(struct termbuf *tb, int nnrows, int nncols) {
+    struct termbuf_storage storage;
+    take_rows(tb, nnrows, nncols, &storage);
+    struct termbuf_char **new_rows = storage.rows;
+    bool *new_wrapped = storage.wrapped;
 
     int rows = nnrows < tb->nrows ? nnrows : tb->nrows;
     int cols = nncols < tb->ncols ? nncols : tb->ncols;
     for (int row = 1; row <= rows; row++) {
-        for (int col = 1; col <= cols; col++) {
-            new_buf[col - 1 + (row - 1) * nncols] =
-                tb->buf[col - 1 + (row - 1) * tb->ncols];
+        memcpy(new_rows[row - 1],
+               termbuf_row(tb, row),
+               cols * sizeof(struct termbuf_char));
+        // Cutting a wrapped row short would glue the wrong text together.
+        new_wrapped[row - 1] = nncols == tb->ncols
+                               && *termbuf_row_wrapped(tb, row);
+    }
+
+    struct termbuf_storage old = current_rows(tb);
+    use_rows(tb, &storage);
+    give_rows(tb, &old);
+}
+
+// The cells that get dropped at the end of a row in the scrollback buffer,
+// they look the same as the empty cells we draw past the end of a row.
+static bool is_blank(const struct termbuf_char *c) {
+    int len = c->flags & FLAG_LENGTH_MASK;
+    return (len == 0 || (len == 1 && c->utf8_char[0] == ' '))
+        && c->bg.r == 0 && c->bg.g == 0 && c->bg.b == 0;
+}
+
+// The cells in `row` that aren't trailing blanks.
+static int row_length(struct termbuf *tb, int row) {
+    const struct termbuf_char *cells = termbuf_row(tb, row);
+    int length = tb->ncols;
+    while (length > 0 && is_blank(&cells[length - 1])) {
+        length --;
+    }
+    return length;
+}
+
+// A line on the screen, the rows `first` through `last` where all but the
+// last one wrapped around into the next one.
+struct reflow_line {
+    int first;
+    int last;
+    int ncells;
+    int nrows;  // The number of rows at the new width.
+    // Where the cursor goes, counting from the first row of the line, if it's
+    // in the line. `cursor_row` is 0 if it isn't.
+    int cursor_row;
+    int cursor_col;
+};
+
+/*
+  Find the line after `line`, and how it's wrapped around at `nncols` columns.
+  If the cursor at `*row`, `*col` is in it, the line gets as many rows as it
+  takes to hold the cursor too.
+ */
+static bool next_reflow_line(struct termbuf *tb,
+                             int nncols,
+                             const int *row,
+                             const int *col,
+                             struct reflow_line *line) {
+    line->first = line->last + 1;
+    if (line->first > tb->nrows) {
+        return false;
+    }
+    line->last = line->first;
+    while (line->last < tb->nrows && *termbuf_row_wrapped(tb, line->last)) {
+        line->last ++;
+    }
+    line->ncells = (line->last - line->first) * tb->ncols
+                   + row_length(tb, line->last);
+    line->nrows = line->ncells == 0 ? 1 : (line->ncells + nncols - 1) / nncols;
+
+    line->cursor_row = 0;
+    if (row != NULL && line->first <= *row && *row <= line->last) {
+        int offset = (*row - line->first) * tb->ncols + *col - 1;
+        int r = offset / nncols;
+        line->cursor_col = offset % nncols + 1;
+        // Keep it just outside of the row if it was, rather than moving it to
+        // the next one.
+        if (*col > tb->ncols && line->cursor_col == 1 && r > 0) {
+            r --;
+            line->cursor_col = nncols + 1;
+        }
+        line->cursor_row = r + 1;
+        line->nrows = r + 1 > line->nrows ? r + 1 : line->nrows;
+    }
+    return true;
+}
+
+/*
+  Resize the buffer currently in use, reflowing the text: The rows that
+  wrapped around into the next one are put back together into lines, which
+  are then wrapped around at the new width. The cursor at `*row`, `*col`, if
+  `row` isn't NULL, stays where it is in the text.
+
+  If the text doesn't fit the oldest rows are pushed into the scrollback
+  buffer, as if they had been scrolled out. Only the rows on the screen are
+  reflowed here, the scrollback buffer is reflowed lazily when it's looked at,
+  see REFLOWING THE SCROLLBACK.
+ */
+static void reflow_rows(struct termbuf *tb,
+                        int nnrows,
+                        int nncols,
+                        int *row,
+                        int *col) {
+    // First find out how many rows we end up with, and where the cursor goes.
+    int used = 0;   // Up to the last row with text in it, or the cursor.
+    int nrows = 0;
+    int cursor_row = 0;
+    int cursor_col = 1;
+    struct reflow_line line = { .last = 0 };
+    while (next_reflow_line(tb, nncols, row, col, &line)) {
+        if (line.cursor_row > 0) {
+            cursor_row = nrows + line.cursor_row;
+            cursor_col = line.cursor_col;
+            used = cursor_row > used ? cursor_row : used;
+        }
+        if (line.ncells > 0) {
+            used = nrows + line.nrows > used ? nrows + line.nrows : used;
+        }
+        nrows += line.nrows;
+    }
+
+    // Scroll out what doesn't fit, but never the cursor.
+    int drop = used > nnrows ? used - nnrows : 0;
+    if (row != NULL && drop > cursor_row - 1) {
+        drop = cursor_row - 1;
+    }
+
+    struct termbuf_storage storage;
+    take_rows(tb, nnrows, nncols, &storage);
+    struct termbuf_char **new_rows = storage.rows;
+    bool *new_wrapped = storage.wrapped;
+    struct termbuf_char *scratch = malloc(nncols * sizeof(struct termbuf_char));
+    if (scratch == NULL) {
+        assert(false);
+    }
+
+    int new_row = 0;
+    line.last = 0;
+    while (next_reflow_line(tb, nncols, row, col, &line)
+           && new_row - drop < nnrows) {
+        for (int i = 0; i < line.nrows && new_row - drop < nnrows; i++) {
+            struct termbuf_char *cells = new_row < drop
+                                         ? scratch
+                                         : new_rows[new_row - drop];
+            memset(cells, 0, nncols * sizeof(struct termbuf_char));
+
+            // The cells `i * nncols` and on in the line, taken from as many
+            // of the old rows as needed.
+            int start = i * nncols;
+            int end = start + nncols < line.ncells
+                      ? start + nncols
+                      : line.ncells;
+            for (int j = start; j < end; ) {
+                int old_row = line.first + j / tb->ncols;
+                int old_col = j % tb->ncols;
+                int n = tb->ncols - old_col < end - j
+                        ? tb->ncols - old_col
+                        : end - j;
+                memcpy(cells + j - start,
+                       termbuf_row(tb, old_row) + old_col,
+                       n * sizeof(struct termbuf_char));
+                j += n;
+            }
+
+            bool wrapped = start + nncols < line.ncells;
+            if (new_row < drop) {
+                termbuf_scrollback_push_row(tb, scratch, nncols, wrapped);
+            } else {
+                new_wrapped[new_row - drop] = wrapped;
+            }
+            new_row ++;
+        }
+    }
+    free(scratch);
+
+    struct termbuf_storage old = current_rows(tb);
+    use_rows(tb, &storage);
+    give_rows(tb, &old);
+
+    if (row != NULL) {
+        *row = cursor_row - drop;
+        *col = cursor_col;
+    }
+}
+
+void termbuf_resize(struct termbuf *tb, int nnrows, int nncols) {
+    assert(nnrows > 0);
+    assert(nncols > 0);
+
+    // The main buffer has to have the same dimensions as the alternate one for
+    // when we switch back to it. Only the main buffer is reflowed, the
+    // cursor belongs to the alternate one though.
+    if (tb->mainbuf != NULL) {
+        resize_rows(tb, nnrows, nncols);
+        swap_buffers(tb);
+        reflow_rows(tb, nnrows, nncols, NULL, NULL);
+        swap_buffers(tb);
+
+        tb->row = tb->row < nnrows ? tb->row : nnrows;
+        tb->col = tb->col < nncols ? tb->col : nncols;
+    } else {
+        reflow_rows(tb, nnrows, nncols, &tb->row, &tb->col);
+    }
+
+    // The saved cursor isn't reflowed, it just has to stay on the screen.
+    tb->saved_row = tb->saved_row < nnrows ? tb->saved_row : nnrows;
+    tb->saved_col = tb->saved_col < nncols ? tb->saved_col : nncols;
+
+    // Rows in the scrollback buffer are shown as a different number of rows
+    // now, so where we had scrolled to doesn't mean much anymore.
+    if (nncols != tb->ncols) {
+        tb->scroll_position = 0;
+    }
+
+    tb->nrows = nnrows;
+    tb->ncols = nncols;
+
+    tb->scroll_top = 1;
+    tb->scroll_bottom = nnrows;
+
+    if (nnrows > tb->damage_capacity) {
+        tb->damage = realloc(tb->damage,
+                             nnrows * sizeof(struct termbuf_damage));
+        if (tb->damage == NULL) {
+            assert(false);
+        }
+        tb->damage_capacity = nnrows;
+    }
+    termbuf_damage_all(tb);
+}
+
+
+
+////////////////////////////////////////////////////////
+// PUSING AND POPPING ROWS FROM THE SCROLLBACK BUFFER //
+////////////////////////////////////////////////////////
+
+
+void termbuf_configure_scrollback(struct termbuf *tb,
+                                  size_t max_rows,
+                                  size_t max_bytes) {
+    scrollback_free(&tb->scrollback);
+    scrollback_initialize(max_rows, max_bytes, &tb->scrollback);
+    search_index_clear(&tb->search_index);
+    tb->view.ncols = 0;
+    tb->scroll_position = 0;
+}
+
+/*
+  Rows are stored in the scrollback buffer run-length encoded, since a row
+  usually consists of a handful of runs of cells that look the same. A row looks
+  like this:
+
+      struct scrollback_row_header  header;
+      struct scrollback_run         runs[header.nruns];
+      uint8_t                       text[];
+
+  The runs say how the cells look, and `text` has the UTF-8 encoded characters
+  of the cells back to back. The length of each character is given by its first
+  byte, with '\0' standing in for an empty cell (FLAG_LENGTH_0).
+
+  Trailing blank cells are dropped, see `is_blank`, so a row can have fewer
+  cells than there are columns. Unless the row wrapped around to the next one
+  (SCROLLBACK_ROW_WRAPPED), then the blanks are part of the text. Rows are only
+  decoded again when they're looked at, see `termbuf_scrollback_get_row`.
+ */
+#define SCROLLBACK_ROW_WRAPPED 1
+
+struct __attribute__((packed)) scrollback_row_header {
+    uint16_t ncells;
+    uint16_t nruns;
+    uint16_t flags;
+};
+
+struct __attribute__((packed)) scrollback_run {
+    uint16_t ncells;
+    uint16_t flags;  // Without the FLAG_LENGTH_* bits.
+    struct color fg;
+    struct color bg;
+};
+
+static bool same_style(const struct termbuf_char *a,
+                       const struct termbuf_char *b) {
+    return (a->flags & ~FLAG_LENGTH_MASK) == (b->flags & ~FLAG_LENGTH_MASK)
+        && memcmp(&a->fg, &b->fg, sizeof(struct color)) == 0
+        && memcmp(&a->bg, &b->bg, sizeof(struct color)) == 0;
+}
+
+static int utf8_length(uint8_t lead) {
+    if (lead < 0x80) {
+        return 1;
+    }
+    if (lead < 0xE0) {
+        return 2;
+    }
+    if (lead < 0xF0) {
+        return 3;
+    }
+    return 4;
+}
+
+void termbuf_scrollback_push_row(struct termbuf *tb,
+                                 struct termbuf_char *data,
+                                 int length,
+                                 bool wrapped) {
+    // Absurdly wide rows are cut short, at worst a cell takes up a run and
+    // four bytes of text.
+    const int max_length = (SCROLLBACK_MAX_ROW_BYTES
+                            - sizeof(struct scrollback_row_header))
+                           / (sizeof(struct scrollback_run) + 4);
+
+    if (length > max_length) {
+        length = max_length;
+    }
+
+    while (!wrapped && length > 0 && is_blank(&data[length - 1])) {
+        length --;
+    }
+
+    // First count the runs and the text so we know how much space we need.
+    int nruns = 0;
+    size_t text_len = 0;
+    for (int i = 0; i < length; i++) {
+        if (i == 0 || !same_style(&data[i - 1], &data[i])) {
+            nruns ++;
+        }
+        int len = data[i].flags & FLAG_LENGTH_MASK;
+        text_len += len == 0 ? 1 : len;
+    }
+
+    struct scrollback_row_header header = {
+        .ncells = length,
+        .nruns = nruns,
+        .flags = wrapped ? SCROLLBACK_ROW_WRAPPED : 0,
+    };
+
+    uint8_t *p = scrollback_push(&tb->scrollback,
+                                 sizeof(header)
+                                 + nruns * sizeof(struct scrollback_run)
+                                 + text_len);
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+
+    uint8_t *text = p + nruns * sizeof(struct scrollback_run);
+    const uint8_t *text_start = text;
+
+    struct scrollback_run run;
+    for (int i = 0; i < length; i++) {
+        if (i == 0 || !same_style(&data[i - 1], &data[i])) {
+            if (i != 0) {
+                memcpy(p, &run, sizeof(run));
+                p += sizeof(run);
+            }
+            run.ncells = 0;
+            run.flags = data[i].flags & ~FLAG_LENGTH_MASK;
+            run.fg = data[i].fg;
+            run.bg = data[i].bg;
+        }
+        run.ncells ++;
+
+        int len = data[i].flags & FLAG_LENGTH_MASK;
+        if (len == 0) {
+            *text++ = '\0';
+        } else {
+            memcpy(text, data[i].utf8_char, len);
+            text += len;
+        }
+    }
+    if (length > 0) {
+        memcpy(p, &run, sizeof(run));
+    }
+
+    search_index_add(&tb->search_index,
+                     tb->scrollback.end - 1,
+                     tb->scrollback.first,
+                     text_start,
+                     text_len);
+}
+
+// Decode the cells of a row in the scrollback buffer into `cells`.
+static void decode_scrollback_row(const uint8_t *p,
+                                  size_t len,
+                                  struct termbuf_char *cells) {
+    const uint8_t *end = p + len;
+
+    struct scrollback_row_header header;
+    memcpy(&header, p, sizeof(header));
+    p += sizeof(header);
+
+    const uint8_t *text = p + header.nruns * sizeof(struct scrollback_run);
+    struct termbuf_char *c = cells;
+
+    for (int i = 0; i < header.nruns; i++) {
+        struct scrollback_run run;
+        memcpy(&run, p, sizeof(run));
+        p += sizeof(run);
+
+        for (int j = 0; j < run.ncells; j++) {
+            assert(text < end);
+            memset(c->utf8_char, 0, 4);
+            c->fg = run.fg;
+            c->bg = run.bg;
+
+            if (*text == '\0') {
+                c->flags = run.flags | FLAG_LENGTH_0;
+                text ++;
+            } else {
+                int len = utf8_length(*text);
+                memcpy(c->utf8_char, text, len);
+                c->flags = run.flags | len;
+                text += len;
+            }
+            c ++;
+        }
+    }
+    assert(text == end);
+}
+
+/*
+  REFLOWING THE SCROLLBACK
+
+  Rows in the scrollback buffer keep the width they had when they were pushed,
+  but they're shown at the current width: A line, a row together with the rows
+  it wrapped around into, is wrapped again at the current width. So a row can
+  be shown as several rows, or several rows as one.
+
+  Laying out all of the scrollback buffer every time the window is resized
+  would take a long time with a lot of history, so it's done lazily instead.
+  Rows are numbered from the bottom of the scrollback buffer, the way
+  `scroll_position` counts them, and `view` remembers the line that was looked
+  at last and which rows it's shown as. Looking at a row close to it, which is
+  what happens when drawing the rows in view, only means stepping a few lines
+  up or down from there. Only the headers of the rows stepped over are read,
+  see `termbuf_scrollback_push_row`.
+
+  When new rows are pushed the rows are numbered from a new bottom, so `view`
+  also remembers which line was the newest one and how many rows it was shown
+  as. Then only the lines pushed since need to be laid out to know how much
+  everything moved up.
+
+  Lines are broken up after TERMBUF_MAX_WRAPPED_ROWS rows so that laying out a
+  single line doesn't take long either, see `starts_line`.
+ */
+
+// Read the header of row `id`, returns false if there is no such row.
+static bool read_row_header(struct termbuf *tb,
+                            uint64_t id,
+                            struct scrollback_row_header *header_ret) {
+    const void *p;
+    size_t len;
+    if (!scrollback_get_id(&tb->scrollback, id, &p, &len)) {
+        return false;
+    }
+    memcpy(header_ret, p, sizeof(*header_ret));
+    return true;
+}
+
+static bool line_wrapped(struct termbuf *tb, uint64_t line) {
+    if (line >= tb->scrollback.end) {
+        if (line - tb->scrollback.end >= (uint64_t) tb->nrows) {
+            return false;
+        }
+        return *termbuf_row_wrapped(tb, line - tb->scrollback.end + 1);
+    }
+
+    struct scrollback_row_header header;
+    return read_row_header(tb, line, &header)
+           && (header.flags & SCROLLBACK_ROW_WRAPPED);
+}
+
+// Whether `line` is the first row of a line, rather than a row that the line
+// before wrapped around into.
+static bool starts_line(struct termbuf *tb, uint64_t line) {
+    return line <= tb->scrollback.first
+           || line % TERMBUF_MAX_WRAPPED_ROWS == 0
+           || !line_wrapped(tb, line - 1);
+}
+
+static int view_nrows(struct termbuf *tb, int ncells) {
+    return ncells == 0 ? 1 : (ncells + tb->ncols - 1) / tb->ncols;
+}
+
+// Make the line starting with row `first` the one in `view`, except for `n`.
+static void view_load(struct termbuf *tb, uint64_t first) {
+    struct termbuf_view *v = &tb->view;
+    v->first = first;
+    v->end_line = first;
+    v->ncells = 0;
+    v->decoded = false;
+
+    int i = 0;
+    struct scrollback_row_header header;
+    do {
+        bool found = read_row_header(tb, v->end_line, &header);
+        assert(found);
+        v->row_cells[i++] = header.ncells;
+        v->ncells += header.ncells;
+        v->end_line ++;
+    } while ((header.flags & SCROLLBACK_ROW_WRAPPED)
+             && v->end_line < tb->scrollback.end
+             && !starts_line(tb, v->end_line));
+
+    v->nrows = view_nrows(tb, v->ncells);
+}
+
+// The first row of the line that `line` is part of.
+static uint64_t line_start(struct termbuf *tb, uint64_t line) {
+    while (!starts_line(tb, line)) {
+        line --;
+    }
+    return line;
+}
+
+// Start over from the newest line.
+static void view_reset(struct termbuf *tb) {
+    struct termbuf_view *v = &tb->view;
+    view_load(tb, line_start(tb, tb->scrollback.end - 1));
+    v->n = 1;
+    v->ncols = tb->ncols;
+    v->end = tb->scrollback.end;
+    v->tail_first = v->first;
+    v->tail_nrows = v->nrows;
+}
+
+static bool view_older(struct termbuf *tb) {
+    struct termbuf_view *v = &tb->view;
+    if (v->first <= tb->scrollback.first) {
+        return false;
+    }
+    size_t n = v->n + v->nrows;
+    view_load(tb, line_start(tb, v->first - 1));
+    v->n = n;
+    return true;
+}
+
+static bool view_newer(struct termbuf *tb) {
+    struct termbuf_view *v = &tb->view;
+    if (v->end_line >= tb->scrollback.end) {
+        return false;
+    }
+    view_load(tb, v->end_line);
+    v->n -= v->nrows;
+    return true;
+}
+
+// Make sure `view` is up to date with the scrollback buffer. Returns false if
+// the scrollback buffer is empty.
+static bool view_update(struct termbuf *tb) {
+    struct termbuf_view *v = &tb->view;
+    struct scrollback *sb = &tb->scrollback;
+
+    if (sb->first == sb->end) {
+        v->ncols = 0;
+        return false;
+    }
+    if (v->ncols != tb->ncols || v->first < sb->first || v->end > sb->end
+        || (v->end != sb->end && v->first == v->tail_first)) {
+        view_reset(tb);
+        return true;
+    }
+    if (v->end == sb->end) {
+        return true;
+    }
+
+    // Lay out the lines from the old newest line onwards, everything before
+    // it moved up by however many more rows that is.
+    struct termbuf_view old = *v;
+    view_reset(tb);
+    size_t nrows = v->nrows;
+    while (v->first > old.tail_first && view_older(tb)) {
+        nrows += v->nrows;
+    }
+    struct termbuf_view tail = *v;
+
+    *v = old;
+    v->n += nrows - old.tail_nrows;
+    v->decoded = false;
+    v->end = sb->end;
+    v->tail_first = tail.tail_first;
+    v->tail_nrows = tail.tail_nrows;
+    return true;
+}
+
+// Make row `n` one of the rows of the line in `view`.
+static bool view_seek(struct termbuf *tb, int n) {
+    struct termbuf_view *v = &tb->view;
+    if (n < 1 || !view_update(tb)) {
+        return false;
+    }
+    while ((size_t) n < v->n) {
+        if (!view_newer(tb)) {
+            return false;
+        }
+    }
+    while ((size_t) n >= v->n + v->nrows) {
+        if (!view_older(tb)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The offset of the first cell of row `n`, in the line in `view`.
+static int view_offset(struct termbuf *tb, int n) {
+    struct termbuf_view *v = &tb->view;
+    return (v->n + v->nrows - 1 - n) * tb->ncols;
+}
+
+bool termbuf_scrollback_has_row(struct termbuf *tb, int n) {
+    return view_seek(tb, n);
+}
+
+bool termbuf_scrollback_get_row(struct termbuf *tb,
+                                int n,
+                                const struct termbuf_char **cells_ret,
+                                int *length_ret) {
+    if (!view_seek(tb, n)) {
+        return false;
+    }
+    struct termbuf_view *v = &tb->view;
+
+    if (!v->decoded) {
+        if (v->ncells > tb->scrollback_cells_capacity) {
+            tb->scrollback_cells = realloc(tb->scrollback_cells,
+                                           v->ncells
+                                           * sizeof(struct termbuf_char));
+            if (tb->scrollback_cells == NULL) {
+                assert(false);
+            }
+            tb->scrollback_cells_capacity = v->ncells;
+        }
+
+        struct termbuf_char *cells = tb->scrollback_cells;
+        for (uint64_t id = v->first; id < v->end_line; id++) {
+            const void *p;
+            size_t len;
+            bool found = scrollback_get_id(&tb->scrollback, id, &p, &len);
+            assert(found);
+            decode_scrollback_row(p, len, cells);
+            cells += v->row_cells[id - v->first];
+        }
+        v->decoded = true;
+    }
+
+    int offset = view_offset(tb, n);
+    int length = v->ncells - offset;
+    *cells_ret = tb->scrollback_cells + offset;
+    *length_ret = length < tb->ncols ? length : tb->ncols;
+    return true;
+}
+
+uint64_t termbuf_scrollback_line(struct termbuf *tb, int n) {
+    if (!view_seek(tb, n)) {
+        return tb->scrollback.first;
+    }
+    struct termbuf_view *v = &tb->view;
+
+    int offset = view_offset(tb, n);
+    uint64_t line = v->first;
+    while (line + 1 < v->end_line && offset >= v->row_cells[line - v->first]) {
+        offset -= v->row_cells[line - v->first];
+        line ++;
+    }
+    return line;
+}
+
+// The offset of column `col` of `line` in the line in `view`, clamped to the
+// line.
+static int view_line_offset(struct termbuf *tb, uint64_t line, int col) {
+    struct termbuf_view *v = &tb->view;
+    if (line < v->first) {
+        return 0;
+    }
+    if (line >= v->end_line) {
+        return v->ncells;
+    }
+
+    int offset = col - 1;
+    for (uint64_t l = v->first; l < line; l++) {
+        offset += v->row_cells[l - v->first];
+    }
+    return offset;
+}
+
+int termbuf_scrollback_row_of(struct termbuf *tb, uint64_t line, int col) {
+    struct termbuf_view *v = &tb->view;
+    if (line < tb->scrollback.first || line >= tb->scrollback.end
+        || !view_update(tb)) {
+        return 0;
+    }
+
+    while (line < v->first) {
+        view_older(tb);
+    }
+    while (line >= v->end_line) {
+        view_newer(tb);
+    }
+
+    int row = view_line_offset(tb, line, col) / tb->ncols;
+    row = row < v->nrows ? row : v->nrows - 1;
+    return v->n + v->nrows - 1 - row;
+}
+
+
+
+/////////////////////////////////////////
+// SEARCHING THE SCROLLBACK AND SCREEN //
+/////////////////////////////////////////
+
+
+
+uint64_t termbuf_line(struct termbuf *tb, int row) {
+    return tb->scrollback.end + row - 1;
+}
+
+bool termbuf_row_match_cols(struct termbuf *tb,
+                            int row,
+                            const struct termbuf_match *match,
+                            int *start_ret,
+                            int *end_ret) {
+    uint64_t line = termbuf_line(tb, row);
+    if (line < match->line || line > match->end_line) {
+        return false;
+    }
+    *start_ret = line == match->line ? match->col : 1;
+    *end_ret = line == match->end_line ? match->end_col : tb->ncols;
+    return *start_ret <= *end_ret;
+}
+
+bool termbuf_scrollback_match_cols(struct termbuf *tb,
+                                   int n,
+                                   const struct termbuf_match *match,
+                                   int *start_ret,
+                                   int *end_ret) {
+    if (!view_seek(tb, n)) {
+        return false;
+    }
+    struct termbuf_view *v = &tb->view;
+    if (match->end_line < v->first || match->line >= v->end_line) {
+        return false;
+    }
+
+    // Where the match is in the line, and where the row is.
+    int start = view_line_offset(tb, match->line, match->col);
+    int end = view_line_offset(tb, match->end_line, match->end_col);
+    int offset = view_offset(tb, n);
+
+    *start_ret = (start > offset ? start : offset) - offset + 1;
+    *end_ret = end - offset + 1;
+    *end_ret = *end_ret < tb->ncols ? *end_ret : tb->ncols;
+    return *start_ret <= *end_ret;
+}
+
+// Make sure `search_text` has room for `len` bytes.
+static void reserve_search_text(struct termbuf *tb, size_t len) {
+    if (len > tb->search_text_capacity) {
+        tb->search_text = realloc(tb->search_text, len);
+        if (tb->search_text == NULL) {
+            assert(false);
+        }
+        tb->search_text_capacity = len;
+    }
+}
+
+static uint8_t search_fold(uint8_t c, bool ignore_case) {
+    if (c == '\0') {
+        return ' ';
+    }
+    if (ignore_case && 'A' <= c && c <= 'Z') {
+        return c - 'A' + 'a';
+    }
+    return c;
+}
+
+/*
+  Put the text of `line` in `search_text`, at `offset`, the way it's searched:
+  With empty cells as spaces, and folded to lower case if we're ignoring case.
+  Trailing blanks are left out the same way as in the scrollback buffer.
+  Returns false if the line doesn't exist.
+ */
+static bool search_line_text(struct termbuf *tb,
+                             uint64_t line,
+                             bool ignore_case,
+                             size_t offset,
+                             size_t *len_ret) {
+    if (line >= tb->scrollback.end) {
+        if (line - tb->scrollback.end >= (uint64_t) tb->nrows) {
+            return false;
+        }
+        int row = line - tb->scrollback.end + 1;
+        const struct termbuf_char *cells = termbuf_row(tb, row);
+
+        int ncells = tb->ncols;
+        while (!*termbuf_row_wrapped(tb, row) && ncells > 0
+               && is_blank(&cells[ncells - 1])) {
+            ncells --;
+        }
+
+        reserve_search_text(tb, offset + 4 * ncells);
+        uint8_t *text = tb->search_text + offset;
+        size_t len = 0;
+        for (int i = 0; i < ncells; i++) {
+            int n = cells[i].flags & FLAG_LENGTH_MASK;
+            if (n == 0) {
+                text[len++] = ' ';
+            }
+            for (int j = 0; j < n; j++) {
+                text[len++] = search_fold(cells[i].utf8_char[j], ignore_case);
+            }
+        }
+        *len_ret = len;
+        return true;
+    }
+
+    const uint8_t *p;
+    size_t len;
+    if (!scrollback_get_id(&tb->scrollback, line, (const void **) &p, &len)) {
+        return false;
+    }
+
+    struct scrollback_row_header header;
+    memcpy(&header, p, sizeof(header));
+    size_t skip = sizeof(header) + header.nruns * sizeof(struct scrollback_run);
+
+    reserve_search_text(tb, offset + len - skip);
+    uint8_t *text = tb->search_text + offset;
+    for (size_t i = skip; i < len; i++) {
+        text[i - skip] = search_fold(p[i], ignore_case);
+    }
+    *len_ret = len - skip;
+    return true;
+}
+
+/*
+  Look for `needle` in the text of `line`. If `older` is set this finds the
+  last match, otherwise the first. On `start_line`, where the search started,
+  only matches before resp. after column `col` count.
+ */
+static bool search_line(struct termbuf *tb,
+                        uint64_t line,
+                        const uint8_t *needle,
+                        size_t needle_len,
+                        bool ignore_case,
+                        uint64_t start_line,
+                        int col,
+                        bool older,
+                        struct termbuf_match *match_ret) {
+    if (line != start_line) {
+        col = older ? INT_MAX : 0;
+    }
+
+    size_t len;
+    if (!search_line_text(tb, line, ignore_case, 0, &len)) {
+        return false;
+    }
+    const uint8_t *text = tb->search_text;
+
+    bool found = false;
+    int match_col = 1;  // The column of `text + offset`.
+    size_t offset = 0;
+
+    const uint8_t *m;
+    while ((m = search_memmem(text + offset,
+                              len - offset,
+                              needle,
+                              needle_len)) != NULL) {
+        // Count the characters up to the match, each one is a cell.
+        for (; text + offset < m; offset++) {
+            match_col += (text[offset] & 0xC0) != 0x80;
+        }
+
+        if (older && match_col >= col) {
+            break;
+        }
+        if (older || match_col > col) {
+            int ncells = 0;
+            for (size_t i = 0; i < needle_len; i++) {
+                ncells += (needle[i] & 0xC0) != 0x80;
+            }
+            *match_ret = (struct termbuf_match) {
+                .line = line,
+                .col = match_col,
+                .end_line = line,
+                .end_col = match_col + ncells - 1,
+            };
+            found = true;
+            if (!older) {
+                break;
+            }
+        }
+
+        // Overlapping matches count too.
+        match_col ++;
+        offset ++;
+        while (offset < len && (text[offset] & 0xC0) == 0x80) {
+            offset ++;
+        }
+    }
+
+    return found;
+}
+
+/*
+  Lines on the screen are searched one by one, there aren't many of them. In
+  the scrollback buffer we ask the search index which blocks might have a
+  match and only search the lines in those, see search.h.
+ */
+bool termbuf_search(struct termbuf *tb,
+                    const uint8_t *query,
+                    size_t len,
+                    uint64_t line,
+                    int col,
+                    bool older,
+                    struct termbuf_match *match_ret) {
+    if (len == 0) {
+        return false;
+    }
+
+    bool ignore_case = true;
+    for (size_t i = 0; i < len; i++) {
+        ignore_case &= !('A' <= query[i] && query[i] <= 'Z');
+    }
+
+    struct search_query q;
+    search_query_initialize(query, len, &q);
+
+    const uint64_t first = tb->scrollback.first;
+    const uint64_t end = tb->scrollback.end;
+    const uint64_t screen_end = end + tb->nrows;
+    if (line < first) {
+        line = first;
+        col = older ? 1 : 0;
+    }
+    if (line >= screen_end) {
+        line = screen_end - 1;
+        col = older ? INT_MAX : tb->ncols + 1;
+    }
+
+    if (older) {
+        for (uint64_t l = line; l >= end && l < screen_end; l--) {
+            if (search_line(tb, l, query, len, ignore_case, line, col, true,
+                            match_ret)) {
+                return true;
+            }
+        }
+
+        uint64_t l = line < end ? line : end - 1;
+        while (l >= first && l < end) {
+            uint64_t block;
+            if (!search_index_prev_block(&tb->search_index,
+                                         &q,
+                                         l / SCROLLBACK_BLOCK_ROWS,
+                                         &block)) {
+                return false;
+            }
+            if (block < l / SCROLLBACK_BLOCK_ROWS) {
+                l = (block + 1) * SCROLLBACK_BLOCK_ROWS - 1;
+            }
+
+            uint64_t block_first = block * SCROLLBACK_BLOCK_ROWS;
+            for (; l >= first && l >= block_first; l--) {
+                if (search_line(tb, l, query, len, ignore_case, line, col,
+                                true, match_ret)) {
+                    return true;
+                }
+                if (l == 0) {
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+
+    for (uint64_t l = line; l < end; ) {
+        uint64_t block;
+        if (!search_index_next_block(&tb->search_index,
+                                     &q,
+                                     l / SCROLLBACK_BLOCK_ROWS,
+                                     &block)) {
+            break;
+        }
+        if (block > l / SCROLLBACK_BLOCK_ROWS) {
+            l = block * SCROLLBACK_BLOCK_ROWS;
+        }
+
+        uint64_t block_end = (block + 1) * SCROLLBACK_BLOCK_ROWS;
+        for (; l < end && l < block_end; l++) {
+            if (search_line(tb, l, query, len, ignore_case, line, col, false,
+                            match_ret)) {
+                return true;
+            }
+        }
+    }
+
+    for (uint64_t l = line > end ? line : end; l < screen_end; l++) {
+        if (search_line(tb, l, query, len, ignore_case, line, col, false,
+                        match_ret)) {
+            return true;
         }
     }
 
-    // TODO: What about saved cursor?
-    tb->saved_row = 1;
-    tb->saved_col = 1;
-
-    // TODO: fix.
-    tb->row = 1;
-    tb->col = 1;
-
-    free(tb->buf);
-    tb->buf = new_buf;
-    tb->nrows = nnrows;
-    tb->ncols = nncols;
+    return false;
 }
 
+/*
+  REGEX SEARCH
 
+  A regular expression is matched against logical lines rather than rows: A
+  row that wrapped around into the next one, see `termbuf_row_wrapped` and
+  SCROLLBACK_ROW_WRAPPED, is searched together with the next one, so a match
+  can go on over several rows. Very long logical lines are cut into pieces, see
+  TERMBUF_MAX_WRAPPED_ROWS, and a match across two pieces isn't found.
 
-////////////////////////////////////////////////////////
-// PUSING AND POPPING ROWS FROM THE SCROLLBACK BUFFER //
-////////////////////////////////////////////////////////
+  There's no index that helps here, every line is decoded and run through the
+  DFA, see regex.h. Only one logical line is put in `search_text` at a time so
+  the memory used doesn't depend on how much history there is.
+ */
+struct logical_line {
+    uint64_t first;  // The line of its first row.
+    int nrows;
+    // Where each row starts in `search_text`, and where the text ends.
+    size_t offsets[TERMBUF_MAX_WRAPPED_ROWS + 1];
+};
 
+// Put the text of the logical line starting at `first` in `search_text`.
+// Returns false if there is no such line.
+static bool logical_line_text(struct termbuf *tb,
+                              uint64_t first,
+                              struct logical_line *ll_ret) {
+    ll_ret->first = first;
+    ll_ret->nrows = 0;
+
+    size_t offset = 0;
+    for (;;) {
+        size_t len;
+        if (!search_line_text(tb, first + ll_ret->nrows, false, offset,
+                              &len)) {
+            break;
+        }
+        ll_ret->offsets[ll_ret->nrows++] = offset;
+        offset += len;
 
-const int MAX_ROW_LENGTH = 256;
+        if (starts_line(tb, first + ll_ret->nrows)) {
+            break;
+        }
+    }
+    ll_ret->offsets[ll_ret->nrows] = offset;
+    return ll_ret->nrows > 0;
+}
 
-struct scrollback_row {
-    char ascii[255];
-    uint8_t nitems;
-};
+// The line and column of the character at `offset` in a logical line.
+static void logical_line_position(struct termbuf *tb,
+                                  const struct logical_line *ll,
+                                  size_t offset,
+                                  uint64_t *line_ret,
+                                  int *col_ret) {
+    int row = 0;
+    while (row + 1 < ll->nrows && ll->offsets[row + 1] <= offset) {
+        row ++;
+    }
 
-void termbuf_scrollback_push_row(struct termbuf *tb,
-                                 struct termbuf_char *data,
-                                 int length) {
-    assert(length <= MAX_ROW_LENGTH);
+    int col = 1;
+    for (size_t i = ll->offsets[row]; i < offset; i++) {
+        col += (tb->search_text[i] & 0xC0) != 0x80;
+    }
+    *line_ret = ll->first + row;
+    *col_ret = col;
+}
 
-    const long PAGE_SIZE = sysconf(_SC_PAGE_SIZE);
-    assert(PAGE_SIZE % sizeof(struct scrollback_row) == 0);
+/*
+  Find the next match in the logical line in `search_text`, starting at byte
+  `*from`, and move `*from` past where it starts. Overlapping matches count.
+ */
+static bool logical_line_match(struct termbuf *tb,
+                               struct regex *re,
+                               const struct logical_line *ll,
+                               size_t *from,
+                               struct termbuf_match *match_ret) {
+    const uint8_t *text = tb->search_text;
+    const size_t len = ll->offsets[ll->nrows];
+
+    size_t start;
+    size_t end;
+    if (!regex_search(re, text, len, *from, &start, &end)) {
+        return false;
+    }
+    logical_line_position(tb, ll, start, &match_ret->line, &match_ret->col);
 
-    struct scrollback_row *writeptr;
-    enum offset_result ret;
-    ret = ringbuf_writep(&tb->scrollback,
-                         sizeof(struct scrollback_row),
-                         (void **) &writeptr);
+    // The end is the start of the last character.
+    end --;
+    while (end > start && (text[end] & 0xC0) == 0x80) {
+        end --;
+    }
+    logical_line_position(tb, ll, end, &match_ret->end_line,
+                          &match_ret->end_col);
 
-    if (ret != RINGBUF_SUCCESS) {
-        assert(false);
+    *from = start + 1;
+    while (*from < len && (text[*from] & 0xC0) == 0x80) {
+        (*from) ++;
     }
+    return true;
+}
 
-    writeptr->nitems = length;
-    for (int i = 0; i < length; i++) {
-        writeptr->ascii[i] = data[i].utf8_char[0];
+bool termbuf_search_regex(struct termbuf *tb,
+                          struct regex *re,
+                          uint64_t line,
+                          int col,
+                          bool older,
+                          struct termbuf_match *match_ret) {
+    const uint64_t first = tb->scrollback.first;
+    const uint64_t screen_end = tb->scrollback.end + tb->nrows;
+    if (line < first) {
+        line = first;
+        col = older ? 1 : 0;
+    }
+    if (line >= screen_end) {
+        line = screen_end - 1;
+        col = older ? INT_MAX : tb->ncols + 1;
     }
 
+    struct logical_line ll;
+    uint64_t start = line_start(tb, line);
+
+    while (logical_line_text(tb, start, &ll)) {
+        bool found = false;
+        size_t from = 0;
+        struct termbuf_match m;
+        while (logical_line_match(tb, re, &ll, &from, &m)) {
+            bool before = m.line < line || (m.line == line && m.col < col);
+            bool after = m.line > line || (m.line == line && m.col > col);
+            if (older && !before) {
+                break;
+            }
+            if (older || after) {
+                *match_ret = m;
+                found = true;
+                if (!older) {
+                    break;
+                }
+            }
+        }
+        if (found) {
+            return true;
+        }
+
+        if (older) {
+            if (start <= first) {
+                return false;
+            }
+            start = line_start(tb, start - 1);
+        } else {
+            start += ll.nrows;
+        }
+    }
+
+    return false;
 }
 
-void termbuf_scrollback_get_row(struct termbuf *tb,
-                                int rowindex,
-                                const char **ascii_ret,
-                                int *length_ret) {
-    #define OUT_OF_BOUNDS_LEN 11
-    static const char *OUT_OF_BOUNDS = "END OF DATA";
-
-    struct scrollback_row *row;
-    enum offset_result ret;
-    ret = ringbuf_getp(&tb->scrollback,
-                       rowindex * sizeof(struct scrollback_row),
-                       sizeof(struct scrollback_row),
-                       (void **) &row);
-
-    if (ret == RINGBUF_OUT_OF_BOUNDS) {
-        *ascii_ret = OUT_OF_BOUNDS;
-        *length_ret = OUT_OF_BOUNDS_LEN;
-        return;
+int termbuf_search_regex_lines(struct termbuf *tb,
+                               struct regex *re,
+                               uint64_t first,
+                               uint64_t last,
+                               struct termbuf_match *matches_ret,
+                               int max) {
+    if (first < tb->scrollback.first) {
+        first = tb->scrollback.first;
     }
-    if (ret != RINGBUF_SUCCESS) {
-        fprintf(stderr, "ret: %d\n", ret);
-        assert(false);
+
+    int n = 0;
+    struct logical_line ll;
+    uint64_t start = line_start(tb, first);
+
+    while (start <= last && logical_line_text(tb, start, &ll)) {
+        size_t from = 0;
+        struct termbuf_match m;
+        while (n < max && logical_line_match(tb, re, &ll, &from, &m)) {
+            if (m.line > last) {
+                return n;
+            }
+            if (m.end_line >= first) {
+                matches_ret[n++] = m;
+            }
+        }
+        start += ll.nrows;
     }
 
-    *ascii_ret = (const char *) row + offsetof(struct scrollback_row, ascii);
-    *length_ret = row->nitems;
+    return n;
 }
 
 
@@ -688,10 +2175,108 @@ struct parser_table_entry {
 
 struct parser_table_entry parser_table[256 * NSTATES];
 
+/*
+  Most of what the shell sends us is plain printable ASCII text, and going
+  through the parser table and `termbuf_insert` for every single one of those
+  bytes is slow. So when we're in the ground state we first look for a run of
+  printable ASCII (0x20--0x7E) and hand all of it to `termbuf_insert_run`.
+
+  Finding the end of the run is done 32 resp. 16 bytes at a time with AVX2
+  resp. SSE2 when available. Bytes are compared as signed, so 0x80--0xFF are
+  negative and the printable bytes are exactly the ones that are greater than
+  0x1F and not equal to 0x7F.
+ */
+
+size_t scan_printable_ascii_scalar(const uint8_t *data, size_t len) {
+    size_t i = 0;
+    while (i < len && 0x20 <= data[i] && data[i] <= 0x7E) {
+        i++;
+    }
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+size_t scan_printable_ascii_sse2(const uint8_t *data, size_t len) {
+    const __m128i space_minus_one = _mm_set1_epi8(0x1F);
+    const __m128i del = _mm_set1_epi8(0x7F);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+        __m128i printable = _mm_andnot_si128(_mm_cmpeq_epi8(v, del),
+                                             _mm_cmpgt_epi8(v, space_minus_one));
+        unsigned int mask = _mm_movemask_epi8(printable);
+        if (mask != 0xFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+
+    return i + scan_printable_ascii_scalar(data + i, len - i);
+}
+
+__attribute__((target("avx2")))
+size_t scan_printable_ascii_avx2(const uint8_t *data, size_t len) {
+    const __m256i space_minus_one = _mm256_set1_epi8(0x1F);
+    const __m256i del = _mm256_set1_epi8(0x7F);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (data + i));
+        __m256i printable = _mm256_andnot_si256(
+            _mm256_cmpeq_epi8(v, del),
+            _mm256_cmpgt_epi8(v, space_minus_one));
+        unsigned int mask = _mm256_movemask_epi8(printable);
+        if (mask != 0xFFFFFFFF) {
+            return i + __builtin_ctz(~mask);
+        }
+    }
+
+    return i + scan_printable_ascii_sse2(data + i, len - i);
+}
+#endif
+
+// Returns the number of printable ASCII bytes at the start of `data`.
+size_t scan_printable_ascii(const uint8_t *data, size_t len) {
+    static size_t (*scan)(const uint8_t *data, size_t len) = NULL;
+
+    if (scan == NULL) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            scan = scan_printable_ascii_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            scan = scan_printable_ascii_sse2;
+        } else {
+            scan = scan_printable_ascii_scalar;
+        }
+#else
+        scan = scan_printable_ascii_scalar;
+#endif
+    }
+
+    return scan(data, len);
+}
+
 void termbuf_parse(struct termbuf *tb, uint8_t *data, size_t len) {
     while (len > 0) {
+        if (tb->p_state == P_STATE_GROUND) {
+            size_t n = scan_printable_ascii(data, len);
+            if (n > 0) {
+                diagnostics_type(DIAGNOSTICS_TERM_PARSE_INPUT,
+                                 __FILE__,
+                                 __LINE__);
+                diagnostics_printfe("%.*s", (int) n, (char *) data);
+
+                termbuf_insert_run(tb, data, n);
+                data += n;
+                len -= n;
+                continue;
+            }
+        }
+
         diagnostics_type(DIAGNOSTICS_TERM_PARSE_INPUT, __FILE__, __LINE__);
-        diagnostics_printfe((char *) data, 1);
+        diagnostics_printfe("%c", *data);
 
         size_t index = tb->p_state * 256 + *data;
         struct parser_table_entry entry = parser_table[index];
@@ -841,10 +2426,12 @@ void action_c0(struct termbuf *tb, char ch) {
             return;
         }
     case '\n':  // Line feed.
-        tb->row ++;
-        if (tb->row > tb->nrows) {
-            tb->row = tb->nrows;
+        // Only scroll when we're at the bottom of the scrolling region, below
+        // the region the cursor just gets stuck at the bottom of the screen.
+        if (tb->row == tb->scroll_bottom) {
             termbuf_shift(tb);
+        } else if (tb->row < tb->nrows) {
+            tb->row ++;
         }
         return;
     case '\v':  // Line tabulation.
@@ -890,9 +2477,23 @@ void action_c0(struct termbuf *tb, char ch) {
         assert(false);
     case 31:  // Unit separator.
         assert(false);
+    case 68:  // Index (IND), ESC D
+        action_c0(tb, '\n');
+        return;
+    case 69:  // Next line (NEL), ESC E
+        action_c0(tb, '\n');
+        tb->col = 1;
+        return;
     case 72:  // Tab set
         tabstops_set(&tb->tabstops, tb->col);
         return;
+    case 77:  // Reverse index (RI), ESC M
+        if (tb->row == tb->scroll_top) {
+            termbuf_scroll_down(tb, tb->scroll_top, tb->scroll_bottom, 1);
+        } else if (tb->row > 1) {
+            tb->row --;
+        }
+        return;
     }
 
     diagnostics_type(DIAGNOSTICS_TERM_CODE_ERROR, __FILE__, __LINE__);
@@ -1428,9 +3029,6 @@ void action_csi_chomp_final_byte(struct termbuf *tb, char ch) {
     // Load LEDs (DECLL)
     // https://vt100.net/docs/vt510-rm/DECLL.html
     if (ch == 'q') { /* TODO */ assert(false); }
-    // Set Top and Bottom Margins (DECSTBM)
-    // https://vt100.net/docs/vt510-rm/DECSTBM.html
-    if (ch == 'r') { /* TODO */ assert(false); }
     // Same as DECSC (ESC 7)
     // https://vt100.net/docs/vt510-rm/DECSLRM.html
     if (ch == 's') {
@@ -1526,9 +3124,15 @@ void action_csi_chomp_final_byte(struct termbuf *tb, char ch) {
 
     // CSI 0 J, ED, erase display from cursor to end of scree.
     if (ch == 'J' && (len == 0 || (len == 1 && p1 == (uint16_t) -1))) {
+        struct termbuf_char *row = termbuf_row(tb, tb->row);
         for (int i = tb->col; i <= tb->ncols; i++) {
-            tb->buf[(tb->row - 1) * tb->ncols + i - 1].flags = FLAG_LENGTH_0;
+            row[i - 1].flags = FLAG_LENGTH_0;
+        }
+        if (tb->col <= tb->ncols) {
+            termbuf_damage_span(tb, tb->row, tb->col, tb->ncols);
         }
+        // The rest of the row is gone, it doesn't go on in the next one.
+        *termbuf_row_wrapped(tb, tb->row) = false;
         return;
     }
 
@@ -1540,14 +3144,22 @@ void action_csi_chomp_final_byte(struct termbuf *tb, char ch) {
 
     // CSI 2 J, ED, erase entire display.
     if (ch == 'J' && len == 1 && p1 == 2) {
+        // The rows are all in `buf` no matter how they're ordered.
         memset(tb->buf, 0, tb->ncols * tb->nrows * sizeof(struct termbuf_char));
+        memset(tb->wrapped, 0, tb->nrows * sizeof(bool));
+        termbuf_damage_all(tb);
         return;
     }
 
     // CSI 3 J, ED, erase entire display and clear the scrollback buffer.
     if (ch == 'J' && len == 1 && p1 == 3) {
+        // The rows are all in `buf` no matter how they're ordered.
         memset(tb->buf, 0, tb->ncols * tb->nrows * sizeof(struct termbuf_char));
-        printf("TODO: clear scrollback buffer.\n");
+        memset(tb->wrapped, 0, tb->nrows * sizeof(bool));
+        termbuf_damage_all(tb);
+        scrollback_clear(&tb->scrollback);
+        search_index_clear(&tb->search_index);
+        tb->scroll_position = 0;
         return;
     }
 
@@ -1555,9 +3167,13 @@ void action_csi_chomp_final_byte(struct termbuf *tb, char ch) {
     if (ch == 'K' && (len == 0 || len == 1)) {
         p1 = p1 == (uint16_t) -1 ? 1 : p1;
 
-        memset(tb->buf + ((tb->row - 1) * tb->ncols) + tb->col - 1,
+        memset(termbuf_row(tb, tb->row) + tb->col - 1,
                0,
                (tb->ncols - tb->col + 1) * sizeof(struct termbuf_char));
+        if (tb->col <= tb->ncols) {
+            termbuf_damage_span(tb, tb->row, tb->col, tb->ncols);
+        }
+        *termbuf_row_wrapped(tb, tb->row) = false;
         return;
     }
 
@@ -1573,20 +3189,55 @@ void action_csi_chomp_final_byte(struct termbuf *tb, char ch) {
         assert(false);
     }
 
+    // CSI Ps L, IL, Insert line.
+    // https://vt100.net/docs/vt510-rm/IL.html
+    if (ch == 'L') {
+        assert(len <= 1);
+        if (len == 0 || p1 == 0) { p1 = 1; }
+
+        // Has no effect outside of the scrolling region.
+        if (tb->row < tb->scroll_top || tb->row > tb->scroll_bottom) {
+            return;
+        }
+
+        termbuf_scroll_down(tb, tb->row, tb->scroll_bottom, p1);
+        tb->col = 1;
+        return;
+    }
+
     // CSI Ps M, DL, Delete line.
     // https://vt100.net/docs/vt510-rm/DL.html
     if (ch == 'M') {
         assert(len <= 1);
-        if (len == 0) { p1 = 1; }
+        if (len == 0 || p1 == 0) { p1 = 1; }
+
+        // Has no effect outside of the scrolling region.
+        if (tb->row < tb->scroll_top || tb->row > tb->scroll_bottom) {
+            return;
+        }
+
+        // The deleted lines are gone for good, they shouldn't end up in the
+        // scrollback buffer.
+        scroll_rows_up(tb, tb->row, tb->scroll_bottom, p1, false);
+        tb->col = 1;
+        return;
+    }
 
-        // TODO: handle
-        assert(tb->row + p1 < tb->nrows);
+    // CSI Ps S, SU, Scroll up.
+    // https://vt100.net/docs/vt510-rm/SU.html
+    if (ch == 'S') {
+        assert(len <= 1);
+        if (len == 0 || p1 == 0) { p1 = 1; }
+        termbuf_scroll_up(tb, tb->scroll_top, tb->scroll_bottom, p1);
+        return;
+    }
 
-        struct pair_s dest  = pair(tb->row, 1);
-        struct pair_s src   = pair(tb->row + p1, 1);
-        struct pair_s count = pair(p1, tb->ncols);
-        termbuf_memmove(tb, dest, src, count);
-        termbuf_memzero(tb, src, count);
+    // CSI Ps T, SD, Scroll down.
+    // https://vt100.net/docs/vt510-rm/SD.html
+    if (ch == 'T') {
+        assert(len <= 1);
+        if (len == 0 || p1 == 0) { p1 = 1; }
+        termbuf_scroll_down(tb, tb->scroll_top, tb->scroll_bottom, p1);
         return;
     }
 
@@ -1608,12 +3259,24 @@ void action_csi_chomp_final_byte(struct termbuf *tb, char ch) {
     // ESC[<t>;<b>r Set scrolling region (DECSTBM)
     // See: https://vt100.net/docs/vt510-rm/DECSTBM.html
     if (len <= 2 && ch == 'r') {
+        int top = p1 == (uint16_t) -1 || p1 == 0 ? 1 : p1;
+        int bottom = p2 == (uint16_t) -1 || p2 == 0 ? tb->nrows : p2;
+        bottom = bottom > tb->nrows ? tb->nrows : bottom;
 
         // from vt100.net:
         // > The value of the top margin (Pt) must be less than the bottom
         // > margin (Pb).
-        assert(p1 < p2);
-        printf("TODO: Handle DECSTBM\n");
+        // Other terminals ignore the sequence if this is not the case.
+        if (top >= bottom) {
+            return;
+        }
+
+        tb->scroll_top = top;
+        tb->scroll_bottom = bottom;
+
+        // DECSTBM moves the cursor to the home position.
+        tb->row = 1;
+        tb->col = 1;
         return;
     }
 
@@ -2064,7 +3727,7 @@ void action_osc_chomp_end(struct termbuf *tb, char ch) {
             tb->default_bg.b = b;
         }
 
-        rendering_render_rect(1, 1, tb->nrows, tb->ncols, tb->buf, tb->nrows);
+        termbuf_damage_all(tb);
         return;
     }
 
@@ -8044,8 +9707,8 @@ void cu_assert_buf_equals(CuTest *tc, struct termbuf *tb1, struct termbuf *tb2)
     for(int row = 1; row <= tb1->nrows; row++) {
         for (int col = 1; col <= tb1->ncols; col++) {
             int index = col - 1 + (row - 1) * ncols;
-            struct termbuf_char c1 = tb1->buf[index];
-            struct termbuf_char c2 = tb1->buf[index];
+            struct termbuf_char c1 = termbuf_row(tb1, row)[col - 1];
+            struct termbuf_char c2 = termbuf_row(tb2, row)[col - 1];
             int len1 = c1.flags & FLAG_LENGTH_MASK;
             int len2 = c2.flags & FLAG_LENGTH_MASK;
             CuAssertIntEquals(tc, 1, len1);
@@ -8074,6 +9737,21 @@ void insert_termbuf_contents(struct termbuf *tb, const char *contents) {
     tb->flags = old_flags;
 }
 
+void cu_assert_rows_equal(CuTest *tc, struct termbuf *tb, const char *expected) {
+    char *actual = calloc(tb->nrows * tb->ncols + 1, 1);
+
+    for (int row = 1; row <= tb->nrows; row++) {
+        for (int col = 1; col <= tb->ncols; col++) {
+            struct termbuf_char c = termbuf_row(tb, row)[col - 1];
+            actual[(row - 1) * tb->ncols + col - 1] =
+                (c.flags & FLAG_LENGTH_MASK) == 0 ? '.' : c.utf8_char[0];
+        }
+    }
+
+    CuAssertStrEquals(tc, expected, actual);
+    free(actual);
+}
+
 void test_buffer_resize_noop(CuTest *tc) {
     int dummy_pty = 0;
 
@@ -8098,65 +9776,705 @@ void test_buffer_resize_noop(CuTest *tc) {
     termbuf_free(&tb2);
 }
 
+// The text is reflowed, and what doesn't fit goes to the scrollback buffer.
 void test_buffer_resize_shrink(CuTest *tc) {
     int dummy_pty = 0;
 
-    const char *content1 =
-        "123"
-        "abc";
+    struct termbuf tb;
+    termbuf_initialize(4, 5, dummy_pty, &tb);
+    insert_termbuf_contents(&tb, "12345abcdexyzwhijklm");
+    termbuf_resize(&tb, 2, 3);
+
+    cu_assert_rows_equal(tc, &tb, "ijklm.");
+    CuAssertIntEquals(tc, 2, tb.row);
+    CuAssertIntEquals(tc, 3, tb.col);
+
+    CuAssertIntEquals(tc, 5, scrollback_nrows(&tb.scrollback));
+    const struct termbuf_char *cells;
+    int length;
+    CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, 5, &cells, &length));
+    CuAssertIntEquals(tc, 3, length);
+    CuAssertIntEquals(tc, '1', cells[0].utf8_char[0]);
+    CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, 1, &cells, &length));
+    CuAssertIntEquals(tc, 'z', cells[0].utf8_char[0]);
+
+    termbuf_free(&tb);
+}
 
-    const char *content2 =
-        "12345"
-        "abcde"
-        "xyzwh"
-        "ijklm";
+void test_buffer_resize_grow_shrink(CuTest *tc) {
+    int dummy_pty = 0;
 
-    struct termbuf tb1;
-    termbuf_initialize(2, 3, dummy_pty, &tb1);
-    insert_termbuf_contents(&tb1, content1);
+    struct termbuf tb;
+    termbuf_initialize(2, 3, dummy_pty, &tb);
+    insert_termbuf_contents(&tb, "123abc");
 
-    struct termbuf tb2;
-    termbuf_initialize(4, 5, dummy_pty, &tb2);
-    insert_termbuf_contents(&tb2, content2);
-    termbuf_resize(&tb2, 2, 3);
+    termbuf_resize(&tb, 4, 5);
+    cu_assert_rows_equal(tc, &tb, "123abc..............");
+    CuAssertIntEquals(tc, 2, tb.row);
+    CuAssertIntEquals(tc, 2, tb.col);
 
-    cu_assert_buf_equals(tc, &tb1, &tb2);
+    // The cursor is after the "c" at the start of the next row now, which
+    // doesn't fit.
+    termbuf_resize(&tb, 2, 3);
+    cu_assert_rows_equal(tc, &tb, "abc...");
+    CuAssertIntEquals(tc, 2, tb.row);
+    CuAssertIntEquals(tc, 1, tb.col);
 
-    termbuf_free(&tb1);
-    termbuf_free(&tb2);
+    termbuf_free(&tb);
 }
 
-void test_buffer_resize_grow_shrink(CuTest *tc) {
+// Lines that didn't wrap stay apart, and the cursor stays with its text.
+void test_buffer_resize_reflow(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(4, 4, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+    const char *text = "abcdef\r\nxy\r\n12";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    cu_assert_rows_equal(tc, &tb, "abcdef..xy..12..");
+
+    termbuf_resize(&tb, 4, 6);
+    cu_assert_rows_equal(tc, &tb, "abcdefxy....12..........");
+    CuAssertIntEquals(tc, 3, tb.row);
+    CuAssertIntEquals(tc, 3, tb.col);
+
+    termbuf_resize(&tb, 4, 2);
+    cu_assert_rows_equal(tc, &tb, "efxy12..");
+    CuAssertIntEquals(tc, 4, tb.row);
+    CuAssertIntEquals(tc, 1, tb.col);
+    CuAssertIntEquals(tc, 2, scrollback_nrows(&tb.scrollback));
+
+    // The cursor was just past the end of "12", which is the next row now.
+    termbuf_parse(&tb, (uint8_t *) "3", 1);
+    cu_assert_rows_equal(tc, &tb, "efxy123.");
+
+    termbuf_free(&tb);
+}
+
+// The row the cursor is moved past the end of the text onto stays in place,
+// with the lines after it below it.
+void test_buffer_resize_reflow_cursor_past_text(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(4, 10, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+    const char *text = "hello\r\nworld\r\nfoo\x1B[1;9H";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+
+    termbuf_resize(&tb, 4, 4);
+    cu_assert_rows_equal(tc, &tb, "....world...foo.");
+    CuAssertIntEquals(tc, 1, tb.row);
+    CuAssertIntEquals(tc, 1, tb.col);
+    CuAssertIntEquals(tc, 2, scrollback_nrows(&tb.scrollback));
+
+    termbuf_free(&tb);
+}
+
+// A row that wrapped around but was erased since is reflowed on its own, both
+// on the screen and in the scrollback buffer.
+void test_buffer_resize_reflow_erased_row(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(4, 10, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+    const char *text = "\x1B[Haaaaaaaaaaaa\x1B[Hfoo\x1B[K\r\nbar\x1B[K";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    // Scroll both rows out, and then do the same again on the screen.
+    termbuf_parse(&tb, (uint8_t *) "\x1B[4;1H\r\n\r\n", 10);
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    CuAssertIntEquals(tc, 2, scrollback_nrows(&tb.scrollback));
+
+    // At a width that the two rows would fit together in.
+    termbuf_resize(&tb, 4, 20);
+    cu_assert_rows_equal(tc, &tb,
+                         "foo................."
+                         "bar................."
+                         "...................."
+                         "....................");
+    CuAssertIntEquals(tc, 2, tb.row);
+    CuAssertIntEquals(tc, 4, tb.col);
+
+    CuAssertIntEquals(tc, 2, scrollback_nrows(&tb.scrollback));
+    const struct termbuf_char *cells;
+    int length;
+    CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, 2, &cells, &length));
+    CuAssertIntEquals(tc, 3, length);
+    CuAssertIntEquals(tc, 'f', cells[0].utf8_char[0]);
+    CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, 1, &cells, &length));
+    CuAssertIntEquals(tc, 3, length);
+    CuAssertIntEquals(tc, 'b', cells[0].utf8_char[0]);
+    CuAssertTrue(tc, !termbuf_scrollback_get_row(&tb, 3, &cells, &length));
+
+    termbuf_free(&tb);
+}
+
+// Resizing back and forth reuses the storage the last resize left behind,
+// and so does switching to the alternate buffer and back.
+void test_buffer_resize_reuses_rows(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(4, 4, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+    const char *text = "abcdef";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    struct termbuf_char *buf = tb.buf;
+
+    termbuf_resize(&tb, 3, 3);
+    cu_assert_rows_equal(tc, &tb, "abcdef...");
+
+    termbuf_resize(&tb, 4, 4);
+    CuAssertPtrEquals(tc, buf, tb.buf);
+    cu_assert_rows_equal(tc, &tb, "abcdef..........");
+
+    termbuf_use_alternate_buffer(&tb);
+    struct termbuf_char *alternate_buf = tb.buf;
+    termbuf_parse(&tb, (uint8_t *) "x", 1);
+    termbuf_use_main_buffer(&tb);
+    CuAssertPtrEquals(tc, alternate_buf, tb.spare.buf);
+
+    termbuf_use_alternate_buffer(&tb);
+    CuAssertPtrEquals(tc, alternate_buf, tb.buf);
+    cu_assert_rows_equal(tc, &tb, "................");
+    termbuf_use_main_buffer(&tb);
+    cu_assert_rows_equal(tc, &tb, "abcdef..........");
+
+    termbuf_free(&tb);
+}
+
+// Rows in the scrollback buffer are shown at the current width.
+void test_scrollback_reflow(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(2, 4, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+    const char *text = "abcdefghij\r\nxy\r\n\r\n\r\n";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    CuAssertIntEquals(tc, 5, scrollback_nrows(&tb.scrollback));
+
+    const struct termbuf_char *cells;
+    int length;
+    struct {
+        int ncols;
+        const char *rows;  // From the top, separated by '|'.
+    } cases[] = {
+        { 4, "abcd|efgh|ij|xy||" },
+        { 3, "abc|def|ghi|j|xy||" },
+        { 10, "abcdefghij|xy||" },
+        { 20, "abcdefghij|xy||" },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        termbuf_resize(&tb, 2, cases[i].ncols);
+
+        int nrows = 0;
+        for (const char *r = cases[i].rows; *r != '\0'; r++) {
+            nrows += *r == '|';
+        }
+
+        // Going over the rows in both directions gives the same rows.
+        for (int pass = 0; pass < 2; pass++) {
+            char rows[16][32] = { { 0 } };
+            for (int j = 0; j < nrows; j++) {
+                int n = pass == 0 ? nrows - j : j + 1;
+                CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, n, &cells,
+                                                            &length));
+                for (int k = 0; k < length; k++) {
+                    rows[nrows - n][k] = cells[k].utf8_char[0];
+                }
+            }
+
+            char all[64] = { 0 };
+            for (int j = 0; j < nrows; j++) {
+                strcat(all, rows[j]);
+                strcat(all, "|");
+            }
+            CuAssertStrEquals(tc, cases[i].rows, all);
+            CuAssertTrue(tc, !termbuf_scrollback_get_row(&tb, nrows + 1,
+                                                         &cells, &length));
+        }
+    }
+
+    // A match in the first line, shown wrapped at a width of 3.
+    termbuf_resize(&tb, 2, 3);
+    struct termbuf_match m = {
+        .line = 0,
+        .col = 3,
+        .end_line = 1,
+        .end_col = 1,
+    };
+    int start = 0;
+    int end = 0;
+    CuAssertTrue(tc, termbuf_scrollback_match_cols(&tb, 6, &m, &start, &end));
+    CuAssertIntEquals(tc, 3, start);
+    CuAssertIntEquals(tc, 3, end);
+    CuAssertTrue(tc, termbuf_scrollback_match_cols(&tb, 5, &m, &start, &end));
+    CuAssertIntEquals(tc, 1, start);
+    CuAssertIntEquals(tc, 2, end);
+    CuAssertTrue(tc, !termbuf_scrollback_match_cols(&tb, 4, &m, &start,
+                                                    &end));
+    CuAssertIntEquals(tc, 5, termbuf_scrollback_row_of(&tb, 1, 1));
+    CuAssertIntEquals(tc, 1, termbuf_scrollback_line(&tb, 4));
+
+    // New rows push the rest up.
+    termbuf_parse(&tb, (uint8_t *) "\r\n", 2);
+    CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, 7, &cells, &length));
+    CuAssertIntEquals(tc, 'a', cells[0].utf8_char[0]);
+
+    termbuf_free(&tb);
+}
+
+void cu_assert_damage_equals(CuTest *tc,
+                             struct termbuf *tb,
+                             int row,
+                             int start,
+                             int end) {
+    CuAssertIntEquals(tc, start, tb->damage[row - 1].start);
+    CuAssertIntEquals(tc, end, tb->damage[row - 1].end);
+}
+
+void test_damage_insert(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(3, 5, dummy_pty, &tb);
+    termbuf_damage_clear(&tb);
+
+    tb.row = 2;
+    tb.col = 2;
+    insert_termbuf_contents(&tb, "ab");
+
+    // Only the two cells we wrote to should be damaged.
+    CuAssertTrue(tc, tb.damage[0].start > tb.damage[0].end);
+    cu_assert_damage_equals(tc, &tb, 2, 2, 3);
+    CuAssertTrue(tc, tb.damage[2].start > tb.damage[2].end);
+
+    termbuf_damage_clear(&tb);
+    tb.col = 5;
+    insert_termbuf_contents(&tb, "c");
+    tb.col = 1;
+    insert_termbuf_contents(&tb, "d");
+    cu_assert_damage_equals(tc, &tb, 2, 1, 5);
+
+    termbuf_free(&tb);
+}
+
+void test_damage_shift(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(2, 3, dummy_pty, &tb);
+    insert_termbuf_contents(&tb, "123abc");
+    termbuf_damage_clear(&tb);
+
+    // Wrapping at the bottom of the screen shifts every row.
+    insert_termbuf_contents(&tb, "x");
+    cu_assert_damage_equals(tc, &tb, 1, 1, 3);
+    cu_assert_damage_equals(tc, &tb, 2, 1, 3);
+
+    termbuf_free(&tb);
+}
+
+void test_damage_resize(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(2, 3, dummy_pty, &tb);
+    termbuf_damage_clear(&tb);
+
+    termbuf_resize(&tb, 4, 5);
+    for (int row = 1; row <= 4; row++) {
+        cu_assert_damage_equals(tc, &tb, row, 1, 5);
+    }
+
+    termbuf_free(&tb);
+}
+
+/*
+  Compare the first byte of every cell of `tb` with `expected`, where empty
+  cells are written as '.'.
+ */
+void test_scroll_whole_screen(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(3, 2, dummy_pty, &tb);
+    insert_termbuf_contents(&tb, "112233");
+
+    uint8_t lf[] = "\n";
+    termbuf_parse(&tb, lf, 1);
+    cu_assert_rows_equal(tc, &tb, "2233..");
+    CuAssertIntEquals(tc, 1, tb.row_head);
+
+    // Reverse index at the top of the screen scrolls down.
+    tb.row = 1;
+    uint8_t ri[] = "\x1BM";
+    termbuf_parse(&tb, ri, 2);
+    cu_assert_rows_equal(tc, &tb, "..2233");
+
+    termbuf_free(&tb);
+}
+
+void test_scroll_region(CuTest *tc) {
+    int dummy_pty = 0;
+
+    struct termbuf tb;
+    termbuf_initialize(4, 2, dummy_pty, &tb);
+    insert_termbuf_contents(&tb, "11223344");
+
+    // Set the scrolling region to rows 2-3 and line feed at it's bottom.
+    uint8_t data[] = "\x1B[2;3r\x1B[3;1H\n";
+    termbuf_parse(&tb, data, sizeof(data) - 1);
+    cu_assert_rows_equal(tc, &tb, "1133..44");
+    CuAssertIntEquals(tc, 3, tb.row);
+
+    termbuf_free(&tb);
+}
+
+void test_insert_delete_line(CuTest *tc) {
     int dummy_pty = 0;
 
-    const char *content1 =
-        "123"
-        "abc";
+    struct termbuf tb;
+    termbuf_initialize(4, 2, dummy_pty, &tb);
+    insert_termbuf_contents(&tb, "11223344");
+
+    uint8_t il[] = "\x1B[2;1H\x1B[L";
+    termbuf_parse(&tb, il, sizeof(il) - 1);
+    cu_assert_rows_equal(tc, &tb, "11..2233");
+
+    uint8_t dl[] = "\x1B[1;1H\x1B[2M";
+    termbuf_parse(&tb, dl, sizeof(dl) - 1);
+    cu_assert_rows_equal(tc, &tb, "2233....");
+
+    termbuf_free(&tb);
+}
+
+void test_scan_printable_ascii(CuTest *tc) {
+    uint8_t data[100];
+
+    // Put every possible byte at every position of a run of printable bytes,
+    // so that we hit both the vectorized loops and the scalar tails.
+    for (int pos = 0; pos < 100; pos++) {
+        for (int byte = 0; byte < 256; byte++) {
+            memset(data, 'a', 100);
+            data[pos] = byte;
+
+            bool printable = 0x20 <= byte && byte <= 0x7E;
+            size_t expected = printable ? 100 : (size_t) pos;
+            CuAssertIntEquals(tc, expected, scan_printable_ascii(data, 100));
+            CuAssertIntEquals(tc,
+                              expected,
+                              scan_printable_ascii_scalar(data, 100));
+        }
+    }
+}
 
-    const char *content2 =
-        "123"
-        "abc";
+void test_insert_run(CuTest *tc) {
+    int dummy_pty = 0;
+    const char *content = "Hello there, this wraps around a couple of times";
 
     struct termbuf tb1;
-    termbuf_initialize(2, 3, dummy_pty, &tb1);
-    insert_termbuf_contents(&tb1, content1);
+    termbuf_initialize(3, 7, dummy_pty, &tb1);
+    tb1.flags |= FLAG_DECAWM;
+    tb1.col = 3;
+    for (const char *c = content; *c != '\0'; c++) {
+        termbuf_insert(&tb1, (const uint8_t *) c, 1);
+    }
 
     struct termbuf tb2;
-    termbuf_initialize(2, 3, dummy_pty, &tb2);
-    insert_termbuf_contents(&tb2, content2);
-    termbuf_resize(&tb2, 4, 5);
-    termbuf_resize(&tb2, 2, 3);
-
-    cu_assert_buf_equals(tc, &tb1, &tb2);
+    termbuf_initialize(3, 7, dummy_pty, &tb2);
+    tb2.flags |= FLAG_DECAWM;
+    tb2.col = 3;
+    termbuf_insert_run(&tb2, (const uint8_t *) content, strlen(content));
+
+    CuAssertIntEquals(tc, tb1.row, tb2.row);
+    CuAssertIntEquals(tc, tb1.col, tb2.col);
+    for (int row = 1; row <= 3; row++) {
+        CuAssertBytesEquals(tc,
+                            (unsigned char *) termbuf_row(&tb1, row),
+                            (unsigned char *) termbuf_row(&tb2, row),
+                            7 * sizeof(struct termbuf_char));
+    }
 
     termbuf_free(&tb1);
     termbuf_free(&tb2);
 }
 
+// Rows pushed into the scrollback buffer keep their characters and styling.
+void test_scrollback_row(CuTest *tc) {
+    int dummy_pty = 0;
+    struct termbuf tb;
+    termbuf_initialize(2, 10, dummy_pty, &tb);
+
+    uint8_t *data = (uint8_t *) "\x1B[1;31mab\x1B[m\xC3\xA7 x\x1B[42m  \x1B[m ";
+    termbuf_parse(&tb, data, strlen((char *) data));
+
+    struct termbuf_char expected[10];
+    memcpy(expected, termbuf_row(&tb, 1), sizeof(expected));
+
+    CuAssertIntEquals(tc, 0, scrollback_nrows(&tb.scrollback));
+    data = (uint8_t *) "\r\n\n";
+    termbuf_parse(&tb, data, strlen((char *) data));
+    CuAssertIntEquals(tc, 1, scrollback_nrows(&tb.scrollback));
+
+    const struct termbuf_char *cells = NULL;
+    int length = 0;
+    CuAssertTrue(tc, termbuf_scrollback_get_row(&tb, 1, &cells, &length));
+
+    // The trailing space and the empty cells after it are dropped, the spaces
+    // with a green background are kept.
+    CuAssertIntEquals(tc, 7, length);
+    for (int i = 0; i < length; i++) {
+        int len = expected[i].flags & FLAG_LENGTH_MASK;
+        CuAssertIntEquals(tc, expected[i].flags, cells[i].flags);
+        CuAssertBytesEquals(tc,
+                            expected[i].utf8_char,
+                            cells[i].utf8_char,
+                            len);
+        CuAssertBytesEquals(tc,
+                            (unsigned char *) &expected[i].fg,
+                            (unsigned char *) &cells[i].fg,
+                            sizeof(struct color));
+        CuAssertBytesEquals(tc,
+                            (unsigned char *) &expected[i].bg,
+                            (unsigned char *) &cells[i].bg,
+                            sizeof(struct color));
+    }
+    CuAssertTrue(tc, !termbuf_scrollback_get_row(&tb, 2, &cells, &length));
+
+    termbuf_free(&tb);
+}
+
+// A typical log line takes up a lot less space than its cells.
+void test_scrollback_row_size(CuTest *tc) {
+    int dummy_pty = 0;
+    struct termbuf tb;
+    termbuf_initialize(1, 80, dummy_pty, &tb);
+
+    uint8_t *data = (uint8_t *) "2024-03-01 12:00:00 \x1B[32mINFO\x1B[m "
+                                "Processed request id=42 in 3ms\n";
+    termbuf_parse(&tb, data, strlen((char *) data));
+
+    const void *row;
+    size_t len = 0;
+    CuAssertTrue(tc, scrollback_get(&tb.scrollback, 1, &row, &len));
+    // 3 runs and 55 characters.
+    CuAssertIntEquals(tc,
+                      sizeof(struct scrollback_row_header)
+                      + 3 * sizeof(struct scrollback_run)
+                      + 55,
+                      len);
+    CuAssertTrue(tc, len * 10 < 80 * sizeof(struct termbuf_char));
+
+    termbuf_free(&tb);
+}
+
+void test_search(CuTest *tc) {
+    int dummy_pty = 0;
+    struct termbuf tb;
+    termbuf_initialize(3, 40, dummy_pty, &tb);
+
+    char line[64];
+    for (int i = 0; i < 2000; i++) {
+        if (i == 100) {
+            snprintf(line, sizeof(line), "line %d ERROR\r\n", i);
+        } else if (i == 1500) {
+            snprintf(line, sizeof(line), "line %d ERROR ERROR\r\n", i);
+        } else {
+            snprintf(line, sizeof(line), "line %d\r\n", i);
+        }
+        termbuf_parse(&tb, (uint8_t *) line, strlen(line));
+    }
+    termbuf_parse(&tb, (uint8_t *) "the end", 7);
+
+    // Lines 1998 and 1999 and "the end" are on the screen.
+    CuAssertIntEquals(tc, 1998, termbuf_line(&tb, 1));
+
+    struct termbuf_match m = { 0 };
+    const uint8_t *query = (uint8_t *) "ERROR";
+    uint64_t bottom = termbuf_line(&tb, 3);
+
+    CuAssertTrue(tc, termbuf_search(&tb, query, 5, bottom, INT_MAX, true, &m));
+    CuAssertIntEquals(tc, 1500, m.line);
+    CuAssertIntEquals(tc, 17, m.col);
+    CuAssertIntEquals(tc, 1500, m.end_line);
+    CuAssertIntEquals(tc, 21, m.end_col);
+
+    CuAssertTrue(tc, termbuf_search(&tb, query, 5, 1500, 17, true, &m));
+    CuAssertIntEquals(tc, 1500, m.line);
+    CuAssertIntEquals(tc, 11, m.col);
+
+    CuAssertTrue(tc, termbuf_search(&tb, query, 5, 1500, 11, true, &m));
+    CuAssertIntEquals(tc, 100, m.line);
+    CuAssertIntEquals(tc, 10, m.col);
+
+    CuAssertTrue(tc, !termbuf_search(&tb, query, 5, 100, 10, true, &m));
+
+    CuAssertTrue(tc, termbuf_search(&tb, query, 5, 100, 10, false, &m));
+    CuAssertIntEquals(tc, 1500, m.line);
+    CuAssertIntEquals(tc, 11, m.col);
+
+    CuAssertTrue(tc, !termbuf_search(&tb, query, 5, 1500, 17, false, &m));
+
+    // Lower case ignores case, upper case doesn't.
+    CuAssertTrue(tc, termbuf_search(&tb, (uint8_t *) "error", 5, bottom,
+                                    INT_MAX, true, &m));
+    CuAssertIntEquals(tc, 1500, m.line);
+    CuAssertTrue(tc, !termbuf_search(&tb, (uint8_t *) "Error", 5, bottom,
+                                     INT_MAX, true, &m));
+
+    // The screen is searched too.
+    CuAssertTrue(tc, termbuf_search(&tb, (uint8_t *) "end", 3, 0, 0, false,
+                                    &m));
+    CuAssertIntEquals(tc, bottom, m.line);
+    CuAssertIntEquals(tc, 5, m.col);
+
+    // Short queries don't get any help from the index.
+    CuAssertTrue(tc, termbuf_search(&tb, (uint8_t *) "42", 2, bottom, INT_MAX,
+                                    true, &m));
+    CuAssertIntEquals(tc, 1942, m.line);
+
+    termbuf_free(&tb);
+}
+
+void test_search_regex(CuTest *tc) {
+    int dummy_pty = 0;
+    struct termbuf tb;
+    termbuf_initialize(3, 10, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+
+    // Wraps around into lines 1 and 2.
+    const char *text = "0123456789ab ERROR 42\r\n";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    for (int i = 0; i < 10; i++) {
+        termbuf_parse(&tb, (uint8_t *) "x\r\n", 3);
+    }
+    // Wraps around on the screen.
+    text = "the end of the line";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    CuAssertIntEquals(tc, 12, termbuf_line(&tb, 1));
+
+    struct regex re;
+    struct termbuf_match m = { 0 };
+    uint64_t bottom = termbuf_line(&tb, 3);
+
+    const char *pattern = "error \\d+";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, termbuf_search_regex(&tb, &re, bottom, INT_MAX, true,
+                                          &m));
+    CuAssertIntEquals(tc, 1, m.line);
+    CuAssertIntEquals(tc, 4, m.col);
+    CuAssertIntEquals(tc, 2, m.end_line);
+    CuAssertIntEquals(tc, 1, m.end_col);
+    CuAssertTrue(tc, !termbuf_search_regex(&tb, &re, 1, 4, true, &m));
+    regex_free(&re);
+
+    // ^ is the start of the logical line, not of the row.
+    pattern = "^ab";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, !termbuf_search_regex(&tb, &re, 0, 0, false, &m));
+    regex_free(&re);
+
+    pattern = "9ab";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, termbuf_search_regex(&tb, &re, 0, 0, false, &m));
+    CuAssertIntEquals(tc, 0, m.line);
+    CuAssertIntEquals(tc, 10, m.col);
+    CuAssertIntEquals(tc, 1, m.end_line);
+    CuAssertIntEquals(tc, 2, m.end_col);
+    regex_free(&re);
+
+    struct termbuf_match matches[4];
+    pattern = "[0-9]";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertIntEquals(tc, 2, termbuf_search_regex_lines(&tb, &re, 1, 2,
+                                                        matches, 4));
+    CuAssertIntEquals(tc, 1, matches[0].line);
+    CuAssertIntEquals(tc, 10, matches[0].col);
+    CuAssertIntEquals(tc, 2, matches[1].line);
+    CuAssertIntEquals(tc, 1, matches[1].col);
+    regex_free(&re);
+
+    // Trailing blanks are left out on the screen too.
+    pattern = "x$";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, termbuf_search_regex(&tb, &re, bottom, INT_MAX, true,
+                                          &m));
+    CuAssertIntEquals(tc, 12, m.line);
+    CuAssertIntEquals(tc, 1, m.col);
+    regex_free(&re);
+
+    pattern = "of the l";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, termbuf_search_regex(&tb, &re, 5, 1, false, &m));
+    CuAssertIntEquals(tc, 13, m.line);
+    CuAssertIntEquals(tc, 9, m.col);
+    CuAssertIntEquals(tc, 14, m.end_line);
+    CuAssertIntEquals(tc, 6, m.end_col);
+    regex_free(&re);
+
+    termbuf_free(&tb);
+}
+
+// A row that wrapped around and was then erased doesn't go on in the next one
+// any more.
+void test_search_regex_erased_row(CuTest *tc) {
+    int dummy_pty = 0;
+    struct termbuf tb;
+    termbuf_initialize(4, 10, dummy_pty, &tb);
+    tb.flags |= FLAG_DECAWM;
+
+    const char *text = "aaaaaaaaaaXX\x1B[Hfoo\x1B[K\r\nbar\x1B[K";
+    termbuf_parse(&tb, (uint8_t *) text, strlen(text));
+    CuAssertTrue(tc, !*termbuf_row_wrapped(&tb, 1));
+
+    struct regex re;
+    struct termbuf_match m = { 0 };
+    uint64_t bottom = termbuf_line(&tb, 4);
+
+    const char *pattern = "foo *bar";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, !termbuf_search_regex(&tb, &re, bottom, INT_MAX, true,
+                                           &m));
+    regex_free(&re);
+
+    pattern = "^bar";
+    CuAssertTrue(tc, regex_compile((uint8_t *) pattern, strlen(pattern), &re));
+    CuAssertTrue(tc, termbuf_search_regex(&tb, &re, bottom, INT_MAX, true,
+                                          &m));
+    CuAssertIntEquals(tc, termbuf_line(&tb, 2), m.line);
+    CuAssertIntEquals(tc, 1, m.col);
+    regex_free(&re);
+
+    termbuf_free(&tb);
+}
+
 CuSuite *termbuf_test_suite() {
     CuSuite *suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_buffer_resize_noop);
     SUITE_ADD_TEST(suite, test_buffer_resize_shrink);
     SUITE_ADD_TEST(suite, test_buffer_resize_grow_shrink);
+    SUITE_ADD_TEST(suite, test_buffer_resize_reflow);
+    SUITE_ADD_TEST(suite, test_buffer_resize_reflow_cursor_past_text);
+    SUITE_ADD_TEST(suite, test_buffer_resize_reflow_erased_row);
+    SUITE_ADD_TEST(suite, test_buffer_resize_reuses_rows);
+    SUITE_ADD_TEST(suite, test_damage_insert);
+    SUITE_ADD_TEST(suite, test_damage_shift);
+    SUITE_ADD_TEST(suite, test_damage_resize);
+    SUITE_ADD_TEST(suite, test_scroll_whole_screen);
+    SUITE_ADD_TEST(suite, test_scroll_region);
+    SUITE_ADD_TEST(suite, test_insert_delete_line);
+    SUITE_ADD_TEST(suite, test_scan_printable_ascii);
+    SUITE_ADD_TEST(suite, test_insert_run);
+    SUITE_ADD_TEST(suite, test_scrollback_row);
+    SUITE_ADD_TEST(suite, test_scrollback_row_size);
+    SUITE_ADD_TEST(suite, test_scrollback_reflow);
+    SUITE_ADD_TEST(suite, test_search);
+    SUITE_ADD_TEST(suite, test_search_regex);
+    SUITE_ADD_TEST(suite, test_search_regex_erased_row);
     return suite;
 }
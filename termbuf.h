@@ -6,6 +6,9 @@
 #include <X11/Xlib.h>
 
 #include "./ringbuf.h"
+#include "./scrollback.h"
+#include "./search.h"
+#include "./regex.h"
 #include "./tabstops.h"
 
 #include "./CuTest.h"
@@ -138,6 +141,58 @@ union parser_data {
     } ansi_osc_chomping;
 };
 
+// Text that wraps around over more rows than this is treated as if it was
+// broken up into several lines, so that no single line is too costly to deal
+// with. The break is after each row whose line is a multiple of this.
+#define TERMBUF_MAX_WRAPPED_ROWS 64
+
+/*
+  What part of the scrollback buffer was looked at last, and how it's laid out
+  at the current width. See REFLOWING THE SCROLLBACK in termbuf.c.
+ */
+struct termbuf_view {
+    int ncols;     // The width the rest is for, 0 if it's not set.
+    uint64_t end;  // `scrollback.end` at the time.
+    // The newest line of the scrollback buffer at the time, and how many rows
+    // it's shown as.
+    uint64_t tail_first;
+    int tail_nrows;
+    // The line looked at last, it's the rows with ids `first` through
+    // `end_line - 1`, and it's shown as the rows `n` through `n + nrows - 1`
+    // counting from the bottom of the scrollback buffer.
+    uint64_t first;
+    uint64_t end_line;
+    size_t n;
+    int nrows;
+    int ncells;
+    int row_cells[TERMBUF_MAX_WRAPPED_ROWS];  // The cells in each of its rows.
+    // Whether its cells are decoded into `scrollback_cells`.
+    bool decoded;
+};
+
+/*
+  The memory behind the rows of a screen, with room for `rows_capacity` rows
+  and `cells_capacity` cells. It's usually larger than the screen using it,
+  see `take_rows` in termbuf.c.
+ */
+struct termbuf_storage {
+    struct termbuf_char *buf;
+    struct termbuf_char **rows;
+    bool *wrapped;
+    int rows_capacity;
+    int cells_capacity;
+};
+
+/*
+  The columns `start` through `end` (1-indexed, inclusive) of a row have changed
+  since the last call to `termbuf_damage_clear`, and need to be redrawn. If
+  `start > end` the row is undamaged.
+ */
+struct termbuf_damage {
+    int start;
+    int end;
+};
+
 struct termbuf {
     int nrows;
     int ncols;
@@ -159,9 +214,43 @@ struct termbuf {
     int pty_fd;
     enum  parser_state p_state;
     union parser_data  p_data;
+    // The cells of the terminal, `nrows * ncols` of them. Don't index into
+    // this directly, rows are shuffled around when scrolling so use
+    // `termbuf_row` instead.
     struct termbuf_char *buf;
-    // The scrollback buffer
-    struct ringbuf scrollback;
+    // `nrows` pointers into `buf`, one for each row. This is a ring where
+    // the topmost row on the screen is `rows[row_head]`. Scrolling the whole
+    // screen is then just a matter of advancing `row_head`, and scrolling part
+    // of the screen is a matter of rotating some of the pointers.
+    struct termbuf_char **rows;
+    int row_head;
+    // One flag per row of `buf`, in the order they are in `buf`, set if the
+    // text in the row wrapped around to the next row. See
+    // `termbuf_row_wrapped`.
+    bool *wrapped;
+    // How much room there is in `buf`, `rows` and `wrapped`, see
+    // `termbuf_storage`.
+    int rows_capacity;
+    int cells_capacity;
+    // The storage that the last screen resized away from left behind, kept
+    // around for the next resize. `buf` is NULL if there is none.
+    struct termbuf_storage spare;
+    // The scrolling region set with DECSTBM, 1-indexed and inclusive.
+    int scroll_top;
+    int scroll_bottom;
+    // The scrollback buffer, see `termbuf_scrollback_push_row` for what the
+    // rows in it look like.
+    struct scrollback scrollback;
+    // Rows in the scrollback buffer are decoded into here when they're looked
+    // at, see `termbuf_scrollback_get_row`.
+    struct termbuf_char *scrollback_cells;
+    int scrollback_cells_capacity;
+    struct termbuf_view view;
+    // A trigram index over the text of the scrollback buffer, and where rows
+    // are put while they're searched, see `termbuf_search`.
+    struct search_index search_index;
+    uint8_t *search_text;
+    size_t search_text_capacity;
     // The tabstops bitset
     struct tabstops tabstops;
     // The number of rows that the user has scrolled into the scrollback buffer.
@@ -173,10 +262,33 @@ struct termbuf {
     // Used with alternate buffer
     struct termbuf_char *mainbuf; // When this != NULL we use alt buf and this
                                   // is the main buffer.
+    struct termbuf_char **mainrows;
+    bool *mainwrapped;
+    int main_row_head;
+    int main_rows_capacity;
+    int main_cells_capacity;
     int alt_saved_row; // When using alternate buffer, this keeps track of main
     int alt_saved_col; // buffers saved cursor, and vice-versa.
+    // One entry per row, records which parts of `buf` needs to be redrawn.
+    struct termbuf_damage *damage;
+    int damage_capacity;
 };
 
+// Get the cells of a row (1-indexed).
+static inline struct termbuf_char *termbuf_row(struct termbuf *tb, int row) {
+    int i = tb->row_head + row - 1;
+    if (i >= tb->nrows) {
+        i -= tb->nrows;
+    }
+    return tb->rows[i];
+}
+
+// Whether the text in a row (1-indexed) wrapped around to the next row. The
+// flag belongs to the cells of the row, so it moves with them when scrolling.
+static inline bool *termbuf_row_wrapped(struct termbuf *tb, int row) {
+    return &tb->wrapped[(termbuf_row(tb, row) - tb->buf) / tb->ncols];
+}
+
 void termbuf_initialize(int nrows,
                         int ncols,
                         int pty_fd,
@@ -197,21 +309,116 @@ void unknown_csi(struct termbuf *tb, char final_byte, char *file, int line);
 // cursor appropriately.
 void termbuf_insert(struct termbuf *tb, const uint8_t *utf8_char, int len);
 
+// Insert a run of printable ASCII characters (0x20--0x7E), this does the same
+// thing as calling `termbuf_insert` for each of them, only faster.
+void termbuf_insert_run(struct termbuf *tb, const uint8_t *ascii, size_t len);
+
 // When the cursor is at the bottom at the terminal, and we encounter a line
 // feed '\n' we should push the topmost row into the scrollback buffer and shift
 // all other lines up one row to make room for a new empty row. This function
-// does that
+// does that (within the scrolling region).
 void termbuf_shift(struct termbuf *tb);
 
+// Scroll the rows `srow` through `erow` (inclusive) up resp. down `n` rows,
+// leaving `n` empty rows at the bottom resp. top. Rows scrolled out of the top
+// of the screen are pushed into the scrollback buffer.
+void termbuf_scroll_up(struct termbuf *tb, int srow, int erow, int n);
+void termbuf_scroll_down(struct termbuf *tb, int srow, int erow, int n);
+
 void termbuf_resize(struct termbuf *tb, int nnrows, int nncols);
 
+// Mark the columns `scol` through `ecol` (inclusive) of `row` as damaged.
+void termbuf_damage_span(struct termbuf *tb, int row, int scol, int ecol);
+// Mark the rows `srow` through `erow` (inclusive) as damaged.
+void termbuf_damage_rows(struct termbuf *tb, int srow, int erow);
+void termbuf_damage_all(struct termbuf *tb);
+// Called once the damaged parts of the buffer have been redrawn.
+void termbuf_damage_clear(struct termbuf *tb);
+
+// Replace the scrollback buffer with an empty one that holds at most
+// `max_rows` rows, using at most `max_bytes` of memory.
+void termbuf_configure_scrollback(struct termbuf *tb,
+                                  size_t max_rows,
+                                  size_t max_bytes);
+// Push a row into the scrollback buffer, `wrapped` says if its text wrapped
+// around to the next row.
 void termbuf_scrollback_push_row(struct termbuf *tb,
                                  struct termbuf_char *data,
-                                 int length);
-void termbuf_scrollback_get_row(struct termbuf *tb,
-                                int offset,
-                                const char **ascii_ret,
+                                 int length,
+                                 bool wrapped);
+// Get row `n` of the scrollback buffer the way it's shown at the current
+// width, counting from the bottom which is row 1. Returns false if there is no
+// such row. The returned cells are valid until the next call to a `termbuf_*`
+// function. See REFLOWING THE SCROLLBACK in termbuf.c.
+bool termbuf_scrollback_get_row(struct termbuf *tb,
+                                int n,
+                                const struct termbuf_char **cells_ret,
                                 int *length_ret);
+// Whether the scrollback buffer has a row `n`, same as above.
+bool termbuf_scrollback_has_row(struct termbuf *tb, int n);
+// The line of the first cell in row `n` of the scrollback buffer, same as
+// above. See `termbuf_line`.
+uint64_t termbuf_scrollback_line(struct termbuf *tb, int n);
+// The row of the scrollback buffer, same as above, that column `col` of `line`
+// is shown in. Returns 0 if `line` isn't in the scrollback buffer.
+int termbuf_scrollback_row_of(struct termbuf *tb, uint64_t line, int col);
+
+// A match found by `termbuf_search` or `termbuf_search_regex`. A regex match
+// can go on over several lines if the text wrapped around.
+struct termbuf_match {
+    uint64_t line;  // See `termbuf_line`.
+    int col;        // 1-indexed.
+    // The last cell of the match.
+    uint64_t end_line;
+    int end_col;
+};
+
+// The columns of screen row `row` resp. row `n` of the scrollback buffer, see
+// `termbuf_scrollback_get_row`, that `match` covers. Returns false if none.
+bool termbuf_row_match_cols(struct termbuf *tb,
+                            int row,
+                            const struct termbuf_match *match,
+                            int *start_ret,
+                            int *end_ret);
+bool termbuf_scrollback_match_cols(struct termbuf *tb,
+                                   int n,
+                                   const struct termbuf_match *match,
+                                   int *start_ret,
+                                   int *end_ret);
+
+// Lines number the rows of the scrollback buffer and the screen together, from
+// the oldest row to the bottom of the screen. A row in the scrollback buffer
+// keeps the line it had on the screen, so lines are stable as rows scroll.
+// This is the line of screen row `row`.
+uint64_t termbuf_line(struct termbuf *tb, int row);
+// Search the scrollback buffer and the screen for the text `query`. If `older`
+// is set this finds the closest match that starts before column `col` of
+// `line`, otherwise the closest one that starts after it. The search ignores
+// case unless the query has upper case letters in it. Returns false if there
+// is no match.
+bool termbuf_search(struct termbuf *tb,
+                    const uint8_t *query,
+                    size_t len,
+                    uint64_t line,
+                    int col,
+                    bool older,
+                    struct termbuf_match *match_ret);
+// Same as `termbuf_search` but for the regular expression `re`, see regex.h.
+// Rows that wrapped around into the next one are searched as one line.
+bool termbuf_search_regex(struct termbuf *tb,
+                          struct regex *re,
+                          uint64_t line,
+                          int col,
+                          bool older,
+                          struct termbuf_match *match_ret);
+// Find the matches of `re` that are on lines `first` through `last`, at least
+// partly, for highlighting them. Returns how many there are, at most `max`.
+int termbuf_search_regex_lines(struct termbuf *tb,
+                               struct regex *re,
+                               uint64_t first,
+                               uint64_t last,
+                               struct termbuf_match *matches_ret,
+                               int max);
 
 CuSuite *termbuf_test_suite();
 
@@ -0,0 +1,215 @@
+/*
+  A headless benchmark of the parser. This feeds a handful of canned corpora
+  through `termbuf_parse`, the same way `handle_primary_pty_input` does it in
+  chunks of 4096 bytes, and reports the throughput for each of them. No X11 or
+  OpenGL is involved, so this measures the cost of parsing and updating the
+  terminal buffer only.
+
+  Build and run with `make bench`, or run `./build/bench/bench <name> ...` to
+  only run some of the corpora.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "../termbuf.h"
+
+// The size of each corpus, and how many times we parse it.
+#define CORPUS_SIZE (8 * 1024 * 1024)
+#define ITERATIONS 5
+// Same as in `handle_primary_pty_input`.
+#define CHUNK_SIZE 4096
+
+#define NROWS 50
+#define NCOLS 200
+
+struct corpus {
+    uint8_t *data;
+    size_t len;
+};
+
+/*
+  Append to the corpus printf-style, returns false once the corpus is full.
+ */
+__attribute__((format(printf, 2, 3)))
+bool corpus_printf(struct corpus *c, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf((char *) c->data + c->len,
+                      CORPUS_SIZE - c->len,
+                      format,
+                      ap);
+    va_end(ap);
+
+    assert(n >= 0);
+    if (c->len + n >= CORPUS_SIZE) {
+        return false;
+    }
+    c->len += n;
+    return true;
+}
+
+// Lines from a typical log file, plain ASCII.
+void generate_ascii_log(struct corpus *c) {
+    static const char *LEVELS[] = { "INFO", "DEBUG", "WARN", "INFO" };
+    for (int i = 0; ; i++) {
+        if (!corpus_printf(c,
+                           "2024-03-%02d 12:%02d:%02d.%03d %-5s [worker-%d] "
+                           "Processed request id=%d path=/api/v1/items/%d "
+                           "in %dms\r\n",
+                           i % 28 + 1, i % 60, (i * 7) % 60, i % 1000,
+                           LEVELS[i % 4], i % 8, i, i * 31 % 10007,
+                           i % 97)) {
+            return;
+        }
+    }
+}
+
+// Colorful output, like `ls --color` or a compiler's diagnostics. A lot of
+// short runs of text separated by SGR sequences.
+void generate_sgr_heavy(struct corpus *c) {
+    for (int i = 0; ; i++) {
+        if (!corpus_printf(c,
+                           "\x1B[1;31merror\x1B[0m: \x1B[1mfile%d.c:%d:%d\x1B[m "
+                           "\x1B[38;5;%dmunused\x1B[39m variable "
+                           "\x1B[38;2;%d;%d;%dm'x%d'\x1B[0m "
+                           "\x1B[4munderlined\x1B[24m \x1B[7minverted\x1B[27m "
+                           "\x1B[42;30m ok \x1B[49;39m\r\n",
+                           i % 13, i % 500, i % 80, i % 256,
+                           i % 256, (i * 3) % 256, (i * 7) % 256, i)) {
+            return;
+        }
+    }
+}
+
+// Text that's mostly multi-byte UTF-8.
+void generate_utf8_cjk(struct corpus *c) {
+    for (int i = 0; ; i++) {
+        if (!corpus_printf(c,
+                           "%d 日本語のテキストを表示する 中文字符测试 "
+                           "한국어 텍스트 Ærø Åkesson smörgåsbord "
+                           "→ ✓ λ∀∃ “quoted”\r\n",
+                           i)) {
+            return;
+        }
+    }
+}
+
+// A full screen TUI application (think htop or vim) that redraws parts of the
+// screen by moving the cursor around.
+void generate_cursor_motion(struct corpus *c) {
+    if (!corpus_printf(c, "\x1B[?1049h\x1B[?25l")) {
+        return;
+    }
+
+    for (int i = 0; ; i++) {
+        int row = i % NROWS + 1;
+        int col = (i * 17) % (NCOLS - 40) + 1;
+        if (!corpus_printf(c,
+                           "\x1B[%d;%dH\x1B[K\x1B[1;3%dm%5.1f%%\x1B[m "
+                           "\x1B[%dG[%-20.*s]\x1B[%dA\x1B[%dB\x1B[3C\x1B[2D%d",
+                           row, col, i % 8, (i % 1000) / 10.0,
+                           col + 8, i % 21, "||||||||||||||||||||",
+                           row > 1 ? 1 : 0, row > 1 ? 1 : 0, i)) {
+            return;
+        }
+    }
+}
+
+// Lots of short lines so that we scroll all the time, some of it in a
+// scrolling region.
+void generate_scroll_flood(struct corpus *c) {
+    for (int i = 0; ; i++) {
+        bool ok;
+        if (i % 1000 == 0) {
+            ok = corpus_printf(c, "\x1B[5;%dr\x1B[%d;1H", NROWS - 5, NROWS - 5);
+        } else if (i % 1000 == 500) {
+            ok = corpus_printf(c, "\x1B[r\x1B[%d;1H", NROWS);
+        } else {
+            ok = corpus_printf(c, "%d\r\n", i);
+        }
+        if (!ok) {
+            return;
+        }
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*generate)(struct corpus *c);
+} CORPORA[] = {
+    { "ascii-log",     generate_ascii_log },
+    { "sgr-heavy",     generate_sgr_heavy },
+    { "utf8-cjk",      generate_utf8_cjk },
+    { "cursor-motion", generate_cursor_motion },
+    { "scroll-flood",  generate_scroll_flood },
+};
+#define NCORPORA (sizeof(CORPORA) / sizeof(CORPORA[0]))
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void run(const char *name, void (*generate)(struct corpus *c), int dev_null) {
+    struct corpus c = {
+        .data = malloc(CORPUS_SIZE),
+        .len = 0,
+    };
+    assert(c.data != NULL);
+    generate(&c);
+
+    // Keep the fastest iteration, the others are slower because of noise.
+    double best = 1e300;
+    for (int i = 0; i < ITERATIONS; i++) {
+        struct termbuf tb;
+        termbuf_initialize(NROWS, NCOLS, dev_null, &tb);
+        tb.flags |= FLAG_DECAWM;
+
+        double start = now();
+        for (size_t offset = 0; offset < c.len; offset += CHUNK_SIZE) {
+            size_t n = c.len - offset < CHUNK_SIZE ? c.len - offset : CHUNK_SIZE;
+            termbuf_parse(&tb, c.data + offset, n);
+        }
+        double elapsed = now() - start;
+
+        best = elapsed < best ? elapsed : best;
+        termbuf_free(&tb);
+    }
+
+    printf("%-15s %10.2f MB/s %10.3f ns/byte\n",
+           name,
+           c.len / best / 1e6,
+           best * 1e9 / c.len);
+
+    free(c.data);
+}
+
+int main(int argc, char **argv) {
+    int dev_null = open("/dev/null", O_WRONLY);
+    assert(dev_null != -1);
+
+    printf("%-15s %15s %18s\n", "corpus", "throughput", "cost");
+
+    for (size_t i = 0; i < NCORPORA; i++) {
+        bool selected = argc == 1;
+        for (int j = 1; j < argc; j++) {
+            selected |= strcmp(argv[j], CORPORA[i].name) == 0;
+        }
+
+        if (selected) {
+            run(CORPORA[i].name, CORPORA[i].generate, dev_null);
+        }
+    }
+
+    close(dev_null);
+    return 0;
+}
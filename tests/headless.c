@@ -0,0 +1,19 @@
+/*
+  What the headless programs in here (./tests/bench.c and ./tests/replay.c)
+  need from min-terminal.c, which they're built without.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "../min-terminal.h"
+
+// termbuf.c and handlers.c respond to some sequences by writing back to the
+// shell, in here we just throw that away.
+int min_terminal_write_to_shellf(int pty_fd, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    const int did_write = vdprintf(pty_fd, format, ap);
+    va_end(ap);
+    return did_write;
+}
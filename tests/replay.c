@@ -0,0 +1,147 @@
+/*
+  Replays a recording made with `min-terminal --record FILE`, see recording.h.
+
+  By default the recording is fed through `termbuf_parse` as fast as possible,
+  in the same chunks as it was read from the pty originally, and we report how
+  long that took. This is headless like ./tests/bench.c, so it only measures
+  parsing and updating the terminal buffer, but unlike the benchmark it's real
+  world input.
+
+  Usage: ./build/replay/replay [--realtime] [--raw] FILE
+
+  --realtime  Wait between chunks so that they're replayed at the speed they
+              were recorded.
+  --raw       Don't parse anything, write the recorded bytes to stdout instead.
+              To replay a recording through the whole terminal, renderer
+              included, run it inside of min-terminal like so:
+                  min-terminal -e "build/replay/replay --raw FILE"
+              Resizes can't be replayed this way, so make sure the window
+              has the same size as when the recording was made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "../termbuf.h"
+#include "../recording.h"
+
+uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Sleep until `time` nanoseconds have passed since `start`.
+void sleep_until(uint64_t start, uint64_t time) {
+    struct timespec ts = {
+        .tv_sec = (start + time) / 1000000000,
+        .tv_nsec = (start + time) % 1000000000,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+void write_raw(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t did_write = write(STDOUT_FILENO, data, len);
+        if (did_write == -1 && errno == EINTR) {
+            continue;
+        }
+        assert(did_write != -1);
+        data += did_write;
+        len -= did_write;
+    }
+}
+
+void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--realtime] [--raw] FILE\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    bool realtime = false;
+    bool raw = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--raw") == 0) {
+            raw = true;
+        } else if (path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (path == NULL) {
+        usage(argv[0]);
+    }
+
+    struct recording_reader r;
+    if (!recording_reader_open(path, &r)) {
+        fprintf(stderr, "`%s` isn't a min-terminal recording\n", path);
+        return EXIT_FAILURE;
+    }
+
+    int dev_null = open("/dev/null", O_WRONLY);
+    assert(dev_null != -1);
+
+    struct termbuf tb;
+    if (!raw) {
+        termbuf_initialize(r.nrows, r.ncols, dev_null, &tb);
+    }
+
+    size_t nbytes = 0;
+    size_t nframes = 0;
+    uint64_t start = now();
+
+    struct recording_frame frame;
+    while (recording_reader_next(&r, &frame)) {
+        if (realtime) {
+            sleep_until(start, frame.time);
+        }
+
+        switch (frame.type) {
+        case RECORDING_FRAME_DATA:
+            if (raw) {
+                write_raw(frame.data, frame.len);
+            } else {
+                termbuf_parse(&tb, (uint8_t *) frame.data, frame.len);
+            }
+            nbytes += frame.len;
+            break;
+        case RECORDING_FRAME_RESIZE:
+            if (!raw) {
+                termbuf_resize(&tb, frame.nrows, frame.ncols);
+            }
+            break;
+        }
+
+        nframes ++;
+    }
+
+    double elapsed = (now() - start) * 1e-9;
+
+    // stdout might be the terminal we're replaying to, so report on stderr.
+    fprintf(stderr,
+            "%zu bytes in %zu frames, %.3f s, %.2f MB/s\n",
+            nbytes,
+            nframes,
+            elapsed,
+            nbytes / elapsed / 1e6);
+
+    if (!raw) {
+        termbuf_free(&tb);
+    }
+    recording_reader_close(&r);
+    close(dev_null);
+    return 0;
+}
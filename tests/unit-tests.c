@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <CuTest.h>
 #include "../ringbuf.h"
+#include "../scrollback.h"
+#include "../compress.h"
+#include "../search.h"
+#include "../regex.h"
 #include "../termbuf.h"
+#include "../recording.h"
 
 #ifdef UNITTEST
 int main(void) {
@@ -11,7 +16,12 @@ int main(void) {
     CuSuite *suite = CuSuiteNew();
 
     CuSuiteAddSuite(suite, ringbuf_test_suite());
+    CuSuiteAddSuite(suite, scrollback_test_suite());
+    CuSuiteAddSuite(suite, compress_test_suite());
+    CuSuiteAddSuite(suite, search_test_suite());
+    CuSuiteAddSuite(suite, regex_test_suite());
     CuSuiteAddSuite(suite, termbuf_test_suite());
+    CuSuiteAddSuite(suite, recording_test_suite());
     CuSuiteRun(suite);
 
     CuSuiteSummary(suite, output);